@@ -1,7 +1,7 @@
 #version 460
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(location = 0) in vec3 color;
+layout(location = 0) flat in vec3 color;
 
 layout(location = 0) out vec4 outColor;
 
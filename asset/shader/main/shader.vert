@@ -9,16 +9,48 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
 } ubo;
 
-layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 midpoint;
+// one per object, the dequantize parameters map quantized attributes back
+// to model space and are the identity for float ones, the rest is read by
+// the cull pass only
+struct Object {
+    mat4 model;
+    vec4 pos_scale;
+    vec4 pos_offset;
+    vec4 midpoint_scale;
+    vec4 midpoint_offset;
+    vec4 bounds_center;
+    vec4 bounds_extent;
+    uint count;
+    uint first;
+    int vertex_offset;
+    uint is_indexed;
+    uint state;
+    uint first_command;
+    uint slot;
+};
 
-layout(location = 0) out vec3 fragColor;
+// the objects of a mesh are drawn as consecutive instances
+layout(std430, binding = 1) readonly buffer Objects {
+    Object objects[];
+};
+
+layout(location = 0) in vec3 stored_pos;
+layout(location = 1) in vec3 stored_midpoint;
+
+// shaded per triangle from the provoking vertex, the only corner that
+// carries the triangle midpoint once the converter welds vertices
+layout(location = 0) flat out vec3 fragColor;
 
 void main() {
+    Object object = objects[gl_InstanceIndex];
+    vec3 pos = stored_pos * object.pos_scale.xyz + object.pos_offset.xyz;
+    vec3 model_midpoint = stored_midpoint * object.midpoint_scale.xyz + object.midpoint_offset.xyz;
+    vec3 midpoint = (object.model * vec4(model_midpoint, 1.0)).xyz;
+
     const float MAX_LIGHT_DISTANCE = 50.0;
     float d = distance(midpoint, vec3(0.0, 0.0, 0.0));
     float i = clamp(d, 0, MAX_LIGHT_DISTANCE) / MAX_LIGHT_DISTANCE;
     fragColor = (1 - i) * vec3(1.0, 0.0, 0.0);
 
-    gl_Position = ubo.proj * ubo.view * vec4(pos, 1.0);
+    gl_Position = ubo.proj * ubo.view * object.model * vec4(pos, 1.0);
 }
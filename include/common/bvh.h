@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+
+// Bounding volume hierarchies over the chunks of a mesh: chunk i holds the
+// triangles [i * BVH_CHUNK_TRIANGLE_COUNT, (i + 1) * BVH_CHUNK_TRIANGLE_COUNT)
+// in index order, the last one fewer. The renderer culls and draws the same
+// chunks.
+#define BVH_CHUNK_TRIANGLE_COUNT 64
+// primitives a leaf holds unless the depth limit forces more into it
+#define BVH_MAX_LEAF_COUNT 4
+// nodes on the path from the root to any leaf, bounds the traversal stacks
+#define BVH_MAX_DEPTH 64
+#define BVH_BIN_COUNT 16
+
+// 32 bytes, flattened depth first so an inner node's first child directly
+// follows it.
+struct BvhNode {
+    float min[3];
+    // first entry of the leaf in the primitive list, for inner nodes the
+    // index of the second child
+    uint32_t offset;
+    float max[3];
+    // primitives of a leaf, 0 for inner nodes
+    uint16_t count;
+    // axis an inner node is split along, rays visit the near child first
+    uint16_t axis;
+};
+
+struct BvhBox {
+    float min[3];
+    float max[3];
+};
+
+// Returns 1 and shrinks *distance when the ray hits the primitive closer than
+// *distance.
+typedef int (*BvhIntersect)(
+    void *context,
+    uint32_t primitive,
+    float const origin[3],
+    float const direction[3],
+    float *distance
+);
+
+// Binned SAH build over count boxes, in doubles so script/create_meshes.py
+// builds the same nodes. nodes must have room for 2 * count - 1 of them and
+// primitives for count; primitives receives the box indices in leaf order.
+// Subtrees are built on thread_count threads, the result does not depend on
+// it. Returns the node count, 0 for no boxes.
+uint32_t
+bvh_build(
+    uint32_t count,
+    struct BvhBox const *boxes,
+    uint32_t thread_count,
+    struct BvhNode *nodes,
+    uint32_t *primitives
+);
+
+// Returns 0 unless every child is in bounds, children come after their
+// parent, no path exceeds BVH_MAX_DEPTH nodes, inner nodes split along x, y
+// or z, the leaf ranges follow each other in node order and cover all
+// primitives exactly once, and every primitive is below box_count.
+int
+bvh_validate(
+    uint32_t node_count,
+    struct BvhNode const *nodes,
+    uint32_t primitive_count,
+    uint32_t const *primitives,
+    uint32_t box_count
+);
+
+// Writes the primitives whose leaves are at least partly inside the planes,
+// laid out like mat4_frustum_planes' and not necessarily normalized, and
+// returns how many there are. Planes a node is entirely inside of are not
+// tested again below it.
+uint32_t
+bvh_cull(
+    uint32_t node_count,
+    struct BvhNode const *nodes,
+    uint32_t const *primitives,
+    float const planes[6][4],
+    uint32_t *visible
+);
+
+// Closest hit along the ray up to *distance, leaves are tested near to far.
+// Returns 1 and the hit distance in *distance on a hit.
+int
+bvh_cast_ray(
+    uint32_t node_count,
+    struct BvhNode const *nodes,
+    uint32_t const *primitives,
+    float const origin[3],
+    float const direction[3],
+    float *distance,
+    BvhIntersect intersect,
+    void *context
+);
@@ -1,9 +1,123 @@
 #pragma once
 
-#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <common/bvh.h>
+#include <graphics/io.h>
 #include <graphics/vertex.h>
 
+// Mesh container, every field little endian:
+//   header, 16 byte aligned section payloads, section table
+// Readers accept any minor version of their major version and skip section
+// types they do not know.
+#define IO_MESH_MAGIC "FLKM"
+#define IO_MESH_VERSION_MAJOR 1
+#define IO_MESH_VERSION_MINOR 2
+// reads back as 0x01020304 only when the file matches the host byte order
+#define IO_MESH_ENDIAN_MARKER 0x01020304u
+#define IO_MESH_ALIGNMENT 16
+
+enum IoMeshSectionType {
+    // struct Vertex records
+    IO_MESH_SECTION_VERTEX = 1,
+    // triangle list of indices into the vertex section, uint16_t when the
+    // element size is 2, else uint32_t
+    IO_MESH_SECTION_INDEX = 2,
+    // one struct IoMeshBounds per mesh
+    IO_MESH_SECTION_BOUNDS = 3,
+    // reserved, not written yet
+    IO_MESH_SECTION_MESHLET = 4,
+    IO_MESH_SECTION_LOD = 5,
+    // struct VertexQuantized records relative to the first bounds, used
+    // instead of the vertex section when present (since 1.1)
+    IO_MESH_SECTION_VERTEX_QUANTIZED = 6,
+    // struct BvhNode records of a BVH over the mesh's chunks of
+    // BVH_CHUNK_TRIANGLE_COUNT triangles, root first (since 1.2)
+    IO_MESH_SECTION_BVH_NODE = 7,
+    // uint32_t chunk indices the BVH leaves refer to, present with the
+    // node section (since 1.2)
+    IO_MESH_SECTION_BVH_PRIMITIVE = 8,
+};
+
+struct IoMeshHeader {
+    char magic[4];
+    uint16_t version_major;
+    uint16_t version_minor;
+    uint32_t endian_marker;
+    uint32_t section_count;
+    uint64_t section_table_offset;
+    uint64_t file_size;
+};
+
+struct IoMeshSection {
+    uint32_t type;
+    uint32_t element_size;
+    uint64_t offset;
+    uint64_t size;
+    // crc32 of the payload, as computed by zlib
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+struct IoMeshBounds {
+    float min[3];
+    float max[3];
+};
+
+// A mesh file mapped read only, the pointers point straight into the mapping.
+struct IoMappedMesh {
+    uint32_t vertex_count;
+    // struct Vertex or struct VertexQuantized records
+    enum VertexFormat vertex_format;
+    void const *vertices;
+    // index_count is 0 for meshes without an index section
+    uint32_t index_count;
+    uint32_t index_size;
+    void const *indices;
+    uint32_t bounds_count;
+    struct IoMeshBounds const *bounds;
+    // bvh_node_count is 0 for meshes without a BVH
+    uint32_t bvh_node_count;
+    struct BvhNode const *bvh_nodes;
+    uint32_t bvh_primitive_count;
+    uint32_t const *bvh_primitives;
+    uint32_t section_count;
+    struct IoMeshSection const *sections;
+    void *base;
+    size_t size;
+    // points into a mapping owned by someone else, such as an asset pack
+    int is_view;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+};
+
+// IO_RESULT_INVALID when the file is not a valid container of a supported
+// version. Payload checksums are not verified here.
+enum IoResult
+io_map_mesh(char const *path, struct IoMappedMesh *mesh);
+
+// Parses a container already in memory without copying it, data must be 16
+// byte aligned and outlive the mesh. Validated like io_map_mesh.
+enum IoResult
+io_view_mesh(void const *data, size_t size, struct IoMappedMesh *mesh);
+
+// Releases the mapping, views are only cleared.
 void
-io_load_mesh(FILE *file, uint32_t *count, struct Vertex *vertices);
+io_unmap_mesh(struct IoMappedMesh *mesh);
+
+// Reads every payload once. IO_RESULT_CORRUPT on the first checksum
+// mismatch, IO_RESULT_INVALID for an index past the vertices or a BVH that
+// bvh_validate rejects.
+enum IoResult
+io_verify_mesh(struct IoMappedMesh const *mesh);
+
+// zlib compatible crc32, the checksum stored in each section.
+uint32_t
+io_crc32(void const *data, size_t size);
+
+// Returns the first section of the given type, 0 if there is none.
+struct IoMeshSection const *
+io_find_mesh_section(struct IoMappedMesh const *mesh, enum IoMeshSectionType type);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "game/io.h"
+#include "graphics/pack.h"
+
+// Background mesh loading. The stream threads map each requested file and
+// verify its checksums, which also faults every page in, so the render
+// thread only copies resident memory into the staging buffer. Completed
+// requests are handed out by stream_poll in completion order.
+// With a pack, requested names are looked up in it first and streamed
+// meshes point into its mapping, the loose file is the fallback.
+
+enum StreamStatus {
+    STREAM_STATUS_DONE,
+    // the file could not be mapped or failed verification
+    STREAM_STATUS_FAILED,
+};
+
+struct StreamEvent {
+    uint32_t handle;
+    enum StreamStatus status;
+    // why the request failed
+    enum IoResult result;
+    // valid when done, the caller releases it with io_unmap_mesh before
+    // the pack is unmapped
+    struct IoMappedMesh mesh;
+};
+
+// thread_count 0 starts one thread. pack may be 0, else it stays mapped
+// until stream_deinit.
+void stream_init(uint32_t thread_count, struct IoPack const *pack);
+
+// Waits for the requests being loaded, drops the queued ones and unmaps
+// every completed mesh that was not polled.
+void stream_deinit(void);
+
+// Queues a pack entry name or path for loading and returns its handle,
+// never 0. The path is copied.
+uint32_t stream_request_mesh(char const *path);
+
+// Never blocks. Returns 1 and fills event when a request has completed.
+int stream_poll(struct StreamEvent *event);
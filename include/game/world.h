@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "game/io.h"
+
+// Static level geometry for ray queries on the cpu: camera collision and
+// picking. Meshes sit at the origin, where the game places its maps, and are
+// queried through the BVHs stored in their files.
+
+struct WorldHit {
+    // along the ray, whose direction is normalized
+    float distance;
+    // of the triangle hit, normalized and facing the ray origin
+    float normal[3];
+    uint32_t mesh;
+    uint32_t triangle;
+};
+
+void world_init(void);
+
+void world_deinit(void);
+
+// Copies the mesh's dequantized positions, indices and BVH, so the caller
+// may unmap it right away. Returns its handle, never 0, or 0 when the mesh
+// has no BVH.
+uint32_t world_add_mesh(struct IoMappedMesh const *mesh);
+
+// Closest triangle within max_distance of the ray, either side of it counts.
+// Picking casts from the camera through the cursor.
+int world_cast_ray(float const origin[3], float const direction[3], float max_distance, struct WorldHit *hit);
+
+// Moves position by delta but stops radius short of any triangle in the way,
+// measured along the movement, and slides what is left along it.
+void world_move(float position[3], float const delta[3], float radius);
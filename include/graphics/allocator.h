@@ -0,0 +1,41 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <stdint.h>
+
+struct GfxBlock;
+
+// A range carved out of a larger VkDeviceMemory block. Host visible blocks
+// are persistently mapped, mapped points at offset inside the block.
+struct GfxAllocation {
+    struct GfxBlock *block;
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped;
+};
+
+struct GfxAllocatorStats {
+    uint32_t block_count;
+    uint32_t allocation_count;
+    // driver allocations available, from maxMemoryAllocationCount
+    uint32_t max_block_count;
+    VkDeviceSize block_size;
+    VkDeviceSize used_size;
+    VkDeviceSize largest_free_size;
+};
+
+void gfx_allocator_init(VkPhysicalDevice physical_device, VkDevice device);
+
+void gfx_allocator_deinit(void);
+
+uint32_t gfx_get_memory_type(uint32_t type_filter, VkMemoryPropertyFlags flags);
+
+void gfx_allocate_buffer_memory(VkBuffer buffer, VkMemoryPropertyFlags flags, struct GfxAllocation *allocation);
+
+void gfx_allocate_image_memory(VkImage image, VkMemoryPropertyFlags flags, struct GfxAllocation *allocation);
+
+void gfx_free(struct GfxAllocation *allocation);
+
+void gfx_allocator_get_stats(struct GfxAllocatorStats *stats);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// box arrays are padded to this many boxes, the widest batch a kernel tests
+#define GFX_CULL_BOX_PADDING 8
+
+// Axis aligned boxes as a structure of arrays, so a kernel loads the same
+// coordinate of 4 or 8 boxes at once. Every array holds capacity floats and
+// is 32 byte aligned; padding boxes are never reported visible.
+struct GfxCullBoxes {
+    uint32_t count;
+    uint32_t capacity;
+    float *center[3];
+    float *extent[3];
+};
+
+void gfx_init_cull_boxes(uint32_t count, struct GfxCullBoxes *boxes);
+
+void gfx_free_cull_boxes(struct GfxCullBoxes *boxes);
+
+void gfx_set_cull_box(struct GfxCullBoxes *boxes, uint32_t index, float const min[3], float const max[3]);
+
+// Writes the indices of the boxes at least partly inside the frustum, in
+// ascending order, and returns how many there are. The planes are laid out
+// like mat4_frustum_planes' and need not be normalized, so planes moved into
+// a model's space with its matrix work as they are. visible must have room
+// for boxes->capacity indices.
+uint32_t gfx_cull_boxes(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible);
+
+// One box at a time, the reference the batched kernel is checked and
+// measured against.
+uint32_t gfx_cull_boxes_scalar(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible);
+
+// "avx" (8 boxes per iteration), "sse" (4) or "scalar", picked at compile
+// time from the instruction sets the compiler may target.
+char const *gfx_cull_kernel_name(void);
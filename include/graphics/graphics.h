@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 
+#include "common/bvh.h"
 #include "graphics/vertex.h"
 
 struct UBO {
@@ -9,11 +10,122 @@ struct UBO {
     float proj[4][4];
 };
 
+struct GraphicsConfig {
+    // render into offscreen images instead of a window swapchain
+    int is_headless;
+    // offscreen image size, only used when is_headless is set
+    uint32_t width;
+    uint32_t height;
+    // threads recording the scene each frame, 0 or 1 records on the caller
+    uint32_t record_thread_count;
+    // indices (or vertices for unindexed maps) per draw item handed to the
+    // recorder, 0 uses the default
+    uint32_t draw_item_vertex_count;
+    // frames the cpu may queue ahead of the gpu: 1 for the lowest latency,
+    // up to 3 for throughput, 0 uses the default of 2
+    uint32_t frames_in_flight;
+    // pace frames with a timeline semaphore when the device supports
+    // VK_KHR_timeline_semaphore, else fall back to one fence per frame
+    int use_timeline_semaphore;
+    // bytes of device memory shared by the vertices and indices of every
+    // registered mesh, 0 uses the default of 64 MiB
+    uint64_t mesh_arena_size;
+    // objects that can exist at once, 0 uses the default of 16384
+    uint32_t max_object_count;
+    // cull objects against the view frustum in a compute pass and draw the
+    // survivors indirectly when the device supports multi draw indirect,
+    // else cull every object's mesh chunks on the cpu and record the visible
+    // ones
+    int use_indirect_draws;
+    // with indirect draws, draw what was visible last frame first, then test
+    // every object against a depth pyramid of that and draw the newly
+    // visible ones
+    int use_occlusion_culling;
+};
+
+struct GraphicsFrameStats {
+    int is_gpu_time_valid;
+    // gpu time of the most recently completed frame
+    double gpu_time_ms;
+    // incremented every time gpu_time_ms is updated
+    uint64_t gpu_sample_count;
+    // cpu time spent recording the last frame's command buffers
+    double record_time_ms;
+    // set when frames are paced by a timeline semaphore
+    int is_timeline_enabled;
+    // set when objects are culled on the gpu and drawn indirectly, with the
+    // draw count read back by the gpu where VK_KHR_draw_indirect_count is
+    // available
+    int is_indirect_enabled;
+    int is_indirect_count_enabled;
+    // set when the indirect draws are split into the two occlusion phases
+    int is_occlusion_enabled;
+    // mesh chunks tested against the frustum on the cpu for the last frame,
+    // summed over objects, and how many of them were drawn; both stay 0 with
+    // indirect draws
+    uint64_t chunk_count;
+    uint64_t visible_chunk_count;
+    // startup cost of creating the pipelines, set when the on disk pipeline
+    // cache matched the device
+    int is_pipeline_cache_warm;
+    double pipeline_time_ms;
+};
+
+// Vertices with an optional triangle list of indices into them, in model
+// space.
+struct GraphicsMesh {
+    uint32_t vertex_count;
+    // struct Vertex or struct VertexQuantized records
+    enum VertexFormat vertex_format;
+    void const *vertices;
+    // quantized vertices are relative to these bounds, which also cull the
+    // mesh's objects and so must enclose every vertex
+    float bounds_min[3];
+    float bounds_max[3];
+    // 0 draws the vertices as a plain triangle list
+    uint32_t index_count;
+    // 2 or 4 bytes per index
+    uint32_t index_size;
+    void const *indices;
+    // optional BVH over the mesh's chunks, see common/bvh.h, walked instead
+    // of testing every chunk when culling on the cpu; it must pass
+    // bvh_validate and is ignored unless it covers every chunk
+    uint32_t bvh_node_count;
+    struct BvhNode const *bvh_nodes;
+    uint32_t bvh_primitive_count;
+    uint32_t const *bvh_primitives;
+};
+
+struct GraphicsMemoryStats {
+    // device memory blocks requested from the driver
+    uint32_t block_count;
+    uint32_t max_block_count;
+    // resources sub-allocated from the blocks
+    uint32_t allocation_count;
+    uint64_t reserved_bytes;
+    uint64_t used_bytes;
+    uint64_t largest_free_bytes;
+};
+
+// Meshes and objects are referred to by handles, 0 is never a valid one.
+// Objects draw a mesh with a model matrix, laid out like struct UBO's
+// matrices. Objects are batched by mesh, so every object of a mesh costs one
+// instance of a single draw.
 struct graphics {
-    void (*init)(void);
+    void (*init)(struct GraphicsConfig const *config);
     void (*deinit)(void);
     void (*draw_frame)(struct UBO *ubo);
-    void (*load_map)(uint32_t const size, struct Vertex vertices[static const size]);
+    // The mesh is copied into a staging buffer before register_mesh
+    // returns, so the caller may release it right away. Its objects are
+    // drawn once the upload has finished. Returns 0 when the mesh arena is
+    // full. Meshes stay registered until deinit.
+    uint32_t (*register_mesh)(struct GraphicsMesh const *mesh);
+    // Returns 0 when max_object_count objects exist.
+    uint32_t (*create_object)(uint32_t mesh, float const transform[4][4]);
+    void (*set_object_transform)(uint32_t object, float const transform[4][4]);
+    void (*destroy_object)(uint32_t object);
+    void (*get_frame_stats)(struct GraphicsFrameStats *stats);
+    void (*get_memory_stats)(struct GraphicsMemoryStats *stats);
 };
 
 extern const struct graphics graphics;
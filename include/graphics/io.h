@@ -1,7 +1,88 @@
 #pragma once
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
-int io_read_spirv(char const *relative_path, uint32_t *size, uint32_t **spirv);
+enum IoResult {
+    IO_RESULT_OK,
+    // the file does not exist or cannot be opened
+    IO_RESULT_NOT_FOUND,
+    // the operating system reported an error while reading
+    IO_RESULT_READ_FAILED,
+    // the file ended before the expected size, usually a truncated file or
+    // one replaced while being read
+    IO_RESULT_SHORT_READ,
+    IO_RESULT_OUT_OF_MEMORY,
+    // the contents are not in the expected format
+    IO_RESULT_INVALID,
+    // a checksum does not match the contents
+    IO_RESULT_CORRUPT,
+    IO_RESULT_WRITE_FAILED,
+};
+
+char const *io_result_string(enum IoResult result);
+
+// Buffered sequential reads of exact sizes. The first failure sticks: every
+// later read returns it, so a sequence of reads can be checked once at the
+// end with the result of io_close_reader.
+struct IoReader {
+    FILE *file;
+    // of the file when it was opened
+    uint64_t size;
+    uint64_t position;
+    enum IoResult result;
+    void *buffer;
+};
+
+// buffer_size 0 uses a 64 KiB buffer. The reader must be closed even when
+// opening fails.
+enum IoResult io_open_reader(char const *relative_path, size_t buffer_size, struct IoReader *reader);
+
+// Reads exactly size bytes. Reading past the end is a short read.
+enum IoResult io_read(struct IoReader *reader, size_t size, void *data);
+
+// Returns the sticky result.
+enum IoResult io_close_reader(struct IoReader *reader);
+
+// *spirv is 4 byte aligned and freed by the caller with free, or
+// _aligned_free on Windows; it is 0 unless the result is IO_RESULT_OK.
+enum IoResult io_read_spirv(char const *relative_path, uint32_t *size, uint32_t **spirv);
+
+// *data must be freed by the caller, it is 0 unless the result is
+// IO_RESULT_OK. Empty files are invalid.
+enum IoResult io_read_file(char const *relative_path, size_t *size, void **data);
+
+enum IoResult io_write_file(char const *relative_path, size_t size, void const *data);
+
+enum IoBackend {
+    // one blocking open and read after the other
+    IO_BACKEND_POSIX,
+    // batched submissions on Linux, falls back to posix where unavailable
+    IO_BACKEND_URING,
+};
+
+struct IoFile {
+    // 0 when the file could not be read
+    void *data;
+    size_t size;
+};
+
+struct IoFileBatch {
+    // the backend that did the reads
+    enum IoBackend backend;
+    uint32_t count;
+    uint32_t read_count;
+    // in the order of the paths
+    struct IoFile *files;
+    // holds the data of every file, 16 byte aligned
+    void *storage;
+};
+
+// Reads each file completely into one allocation, released with
+// io_free_files. Returns the number of files read, the others have no data.
+uint32_t io_read_files(uint32_t count, char const *const paths[], enum IoBackend backend, struct IoFileBatch *batch);
+
+void io_free_files(struct IoFileBatch *batch);
 
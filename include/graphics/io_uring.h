@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "graphics/io.h"
+
+// The io_uring backend of io_read_files, Linux only. batch->files holds
+// count zeroed entries. Returns 0, having read nothing, when io_uring is not
+// available, and 1 once every file has been attempted.
+int io_read_files_uring(uint32_t count, char const *const paths[], struct IoFileBatch *batch);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Asset pack, one file holding every processed asset, every field little
+// endian:
+//   header, bucket table, entry names, page aligned entry payloads
+// The bucket table is an open addressing hash table keyed by the FNV-1a hash
+// of the entry name and probed linearly, so a lookup touches the first pages
+// of the file only. Entry names are the file names of the packed assets.
+#define IO_PACK_MAGIC "FLKP"
+#define IO_PACK_VERSION_MAJOR 1
+#define IO_PACK_VERSION_MINOR 0
+// reads back as 0x01020304 only when the file matches the host byte order
+#define IO_PACK_ENDIAN_MARKER 0x01020304u
+#define IO_PACK_ALIGNMENT 4096
+
+struct IoPackHeader {
+    char magic[4];
+    uint16_t version_major;
+    uint16_t version_minor;
+    uint32_t endian_marker;
+    uint32_t entry_count;
+    // a power of two, at least twice the entry count
+    uint32_t bucket_count;
+    uint32_t reserved;
+    uint64_t bucket_offset;
+    uint64_t name_offset;
+    uint64_t name_size;
+    uint64_t file_size;
+};
+
+struct IoPackEntry {
+    uint64_t hash;
+    // relative to the start of the file, a multiple of IO_PACK_ALIGNMENT
+    uint64_t offset;
+    uint64_t size;
+    // into the names, which are not null terminated
+    uint32_t name_offset;
+    // 0 marks an empty bucket
+    uint32_t name_size;
+};
+
+// A pack mapped read only, entries are read straight from the mapping.
+struct IoPack {
+    uint32_t entry_count;
+    uint32_t bucket_count;
+    struct IoPackEntry const *buckets;
+    char const *names;
+    void *base;
+    size_t size;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#endif
+};
+
+// 64 bit FNV-1a, the hash the buckets are keyed by.
+uint64_t
+io_hash_pack_name(char const *name, size_t size);
+
+// Returns 0 when the file cannot be mapped or is not a valid pack of a
+// supported version.
+int
+io_map_pack(char const *path, struct IoPack *pack);
+
+void
+io_unmap_pack(struct IoPack *pack);
+
+// Resolves name to where its payload lies in the mapping, returns 0 when the
+// pack has no such entry.
+int
+io_find_pack_entry(struct IoPack const *pack, char const *name, uint64_t *offset, uint64_t *size);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <volk/volk.h>
+
+#include <stdint.h>
+
+// A range of indices, or of vertices for meshes without indices, drawn once
+// per object of the instance range. Indirect draw items stand for a range of
+// indirect commands instead, first and count index the commands.
+struct GfxDrawItem {
+    uint32_t first;
+    uint32_t count;
+    // added to each index, 0 for meshes without indices
+    int32_t vertex_offset;
+    // into the object records, which the vertex shader reads by instance
+    uint32_t first_instance;
+    uint32_t instance_count;
+    // into GfxRecordInfo::states
+    uint32_t state;
+};
+
+enum GfxDrawMode {
+    GFX_DRAW_MODE_DIRECT,
+    // every item is one multi draw over its commands
+    GFX_DRAW_MODE_INDIRECT,
+    // the item's count is a maximum, the gpu reads the actual draw count
+    // from the state's entry in the count buffer
+    GFX_DRAW_MODE_INDIRECT_COUNT,
+};
+
+// The bindings a run of draw items shares.
+struct GfxDrawState {
+    VkPipeline pipeline;
+    int is_indexed;
+    VkIndexType index_type;
+};
+
+// Everything a worker needs to record its slice of the draw items into a
+// secondary command buffer that continues the given render pass.
+struct GfxRecordInfo {
+    VkRenderPass render_pass;
+    VkFramebuffer framebuffer;
+    VkPipelineLayout pipeline_layout;
+    // viewport and scissor are dynamic, secondaries do not inherit them
+    VkExtent2D extent;
+    VkDescriptorSet descriptor_set;
+    uint32_t uniform_offset;
+    uint32_t object_offset;
+    // holds the vertices and indices of every mesh, bound at offset 0
+    VkBuffer vertex_buffer;
+    struct GfxDrawState const *states;
+    // sorted by state, so each slice rebinds a few times at most
+    uint32_t draw_count;
+    struct GfxDrawItem const *draws;
+    enum GfxDrawMode draw_mode;
+    // indirect modes only: tightly packed commands of command_stride bytes
+    // and one uint32_t draw count per state
+    VkBuffer indirect_buffer;
+    VkDeviceSize command_offset;
+    uint32_t command_stride;
+    VkDeviceSize count_offset;
+    // set when the primary executes the secondaries in two render passes
+    int is_executed_twice;
+};
+
+// The calling thread acts as worker 0, so thread_count - 1 threads are
+// started. Each worker owns one command pool per frame in flight.
+void gfx_recorder_init(VkDevice device, uint32_t queue_family_index, uint32_t thread_count, uint32_t frame_count);
+
+void gfx_recorder_deinit(void);
+
+// Records info->draws split into one slice per worker and blocks until all
+// slices are recorded. The returned secondary command buffers stay valid
+// until the same frame is recorded again.
+VkCommandBuffer const *gfx_recorder_record(uint32_t frame, struct GfxRecordInfo const *info, uint32_t *count);
@@ -1,13 +1,13 @@
 #pragma once
 
-#include <vulkan/vulkan.h>
+#include <volk/volk.h>
+
+#include "graphics/allocator.h"
 
 struct GfxResource {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    struct GfxAllocation allocation;
 };
 
-uint32_t gfx_get_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter, VkMemoryPropertyFlags flags);
-
 void gfx_destroy_resource(VkDevice device, struct GfxResource *resource, VkAllocationCallbacks const *allocator);
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 struct VertexPos {
     float x;
     float y;
@@ -22,3 +24,27 @@ struct Vertex {
     struct VertexPos pos;
     struct VertexCentroid centroid;
 } __attribute__((__packed__));
+
+// snorm relative to the mesh bounds: -32767 is the minimum and 32767 the
+// maximum of each axis. w is padding, three component 16 bit vertex formats
+// are optional in Vulkan.
+struct VertexQuantizedPos {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    int16_t w;
+} __attribute__((__packed__));
+
+// Half the size of struct Vertex. The centroid is 10 bit unorm per axis
+// relative to the mesh bounds, packed like VK_FORMAT_A2B10G10R10_UNORM_PACK32
+// with x in the low bits.
+struct VertexQuantized {
+    struct VertexQuantizedPos pos;
+    uint32_t centroid;
+} __attribute__((__packed__));
+
+enum VertexFormat {
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_QUANTIZED,
+    VERTEX_FORMAT_COUNT,
+};
@@ -1,43 +1,542 @@
-import io
+import math
 import struct
 import sys
+import zlib
 
 from pathlib import PurePath
 
-for file_name in sys.argv[1:]:
-    vertex_file_name = PurePath(file_name)
-    vertex_file_name = vertex_file_name.with_suffix('.vertex')
+# Mesh container, mirrors include/game/io.h. Every field is little endian:
+#   header, 16 byte aligned section payloads, section table
+MAGIC = b'FLKM'
+VERSION_MAJOR = 1
+VERSION_MINOR = 2
+ENDIAN_MARKER = 0x01020304
+ALIGNMENT = 16
+
+SECTION_VERTEX = 1
+SECTION_INDEX = 2
+SECTION_BOUNDS = 3
+SECTION_MESHLET = 4
+SECTION_LOD = 5
+SECTION_VERTEX_QUANTIZED = 6
+SECTION_BVH_NODE = 7
+SECTION_BVH_PRIMITIVE = 8
+
+# BVH parameters, mirror include/common/bvh.h
+BVH_CHUNK_TRIANGLE_COUNT = 64
+BVH_MAX_LEAF_COUNT = 4
+BVH_MAX_DEPTH = 64
+BVH_BIN_COUNT = 16
+
+# magic, version major, version minor, endian marker, section count,
+# section table offset, file size
+HEADER = struct.Struct('<4sHHIIQQ')
+# type, element size, offset, size, crc32, reserved
+SECTION = struct.Struct('<IIQQII')
+# struct Vertex: position, triangle centroid
+VERTEX = struct.Struct('<ffffff')
+# struct VertexQuantized: snorm position, padding, 10:10:10 unorm centroid
+VERTEX_QUANTIZED = struct.Struct('<hhhhI')
+# struct IoMeshBounds: min, max
+BOUNDS = struct.Struct('<ffffff')
+# struct BvhNode: min, offset, max, count, axis
+BVH_NODE = struct.Struct('<fffIfffHH')
+
+
+def read_stl(stl):
+    """Returns the triangles of a binary stl file as tuples of 3 positions."""
+    stl.read(80)
+    num_triangles = int.from_bytes(stl.read(4), byteorder='little')
+
+    triangles = []
+    for t in range(num_triangles):
+        normal_vector = struct.unpack('<fff', stl.read(12))
+        vertex1 = struct.unpack('<fff', stl.read(12))
+        vertex2 = struct.unpack('<fff', stl.read(12))
+        vertex3 = struct.unpack('<fff', stl.read(12))
+        triangles.append((vertex1, vertex2, vertex3))
+        # attribute byte count, records are a fixed 50 bytes regardless
+        stl.read(2)
+
+    return triangles
+
+
+def build_vertices(triangles):
+    """Welds the triangles into a vertex buffer and a triangle list of indices.
+
+    The shaders take the color from the triangle centroid, flat shaded from
+    the provoking (first) vertex. Only that corner has to carry the centroid,
+    the other two reuse any vertex at the same position. Triangles are rotated,
+    which keeps their winding, so the provoking corner preferably lands on a
+    position that has no vertex yet.
+    """
+    vertices = bytearray()
+    indices = []
+    by_position = {}
+    by_key = {}
+
+    def add_vertex(position, centroid):
+        key = (position, centroid)
+        if key not in by_key:
+            by_key[key] = len(by_key)
+            vertices.extend(VERTEX.pack(*position, *centroid))
+        by_position.setdefault(position, by_key[key])
+        return by_key[key]
+
+    for triangle in triangles:
+        centroid = tuple((triangle[0][i] + triangle[1][i] + triangle[2][i]) / 3 for i in range(3))
+        # round through float32 so equal centroids compare equal once packed
+        centroid = struct.unpack('<fff', struct.pack('<fff', *centroid))
+
+        first = 0
+        for corner in range(3):
+            if triangle[corner] not in by_position:
+                first = corner
+                break
+        rotated = triangle[first:] + triangle[:first]
+
+        indices.append(add_vertex(rotated[0], centroid))
+        for position in rotated[1:]:
+            if position in by_position:
+                indices.append(by_position[position])
+            else:
+                indices.append(add_vertex(position, centroid))
+
+    return bytes(vertices), indices
+
+
+# Vertex cache model used by the optimizer (Forsyth's LRU) and by the FIFO
+# statistics reported by the converter.
+OPTIMIZER_CACHE_SIZE = 32
+STATISTICS_CACHE_SIZE = 16
+# the overdraw pass may give up this much of the cache efficiency
+OVERDRAW_THRESHOLD = 1.05
+
+
+def transformed_vertex_count(indices, cache_size=STATISTICS_CACHE_SIZE, triangles=None):
+    """Vertices a FIFO post transform cache of cache_size shades for the
+    given triangles (all of them by default)."""
+    cache = []
+    misses = 0
+    for t in (range(len(indices) // 3) if triangles is None else triangles):
+        for v in indices[3 * t:3 * t + 3]:
+            if v not in cache:
+                misses += 1
+                cache.append(v)
+                if len(cache) > cache_size:
+                    cache.pop(0)
+    return misses
+
+
+def print_cache_statistics(name, indices, vertex_count):
+    """ACMR: vertices shaded per triangle, ATVR: vertices shaded per vertex."""
+    misses = transformed_vertex_count(indices)
+    print('    %-10s ACMR %.3f  ATVR %.3f' % (name, misses / max(len(indices) // 3, 1), misses / max(vertex_count, 1)))
+
+
+def forsyth_vertex_score(cache_position, valence):
+    if valence == 0:
+        return -1.0
+
+    score = 0.0
+    if cache_position >= 0:
+        if cache_position < 3:
+            # the last triangle's vertices, deliberately not the best choice
+            score = 0.75
+        else:
+            score = (1.0 - (cache_position - 3) / (OPTIMIZER_CACHE_SIZE - 3)) ** 1.5
+    # favour vertices with few triangles left so they get finished off
+    return score + 2.0 * valence ** -0.5
+
+
+def triangle_vertex_score(vertex_score, indices, t):
+    # summed left to right, not with sum(), so flicker-meshc rounds the same
+    return vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] + vertex_score[indices[3 * t + 2]]
+
+
+def optimize_vertex_cache(indices, vertex_count):
+    """Tom Forsyth's linear speed vertex cache optimisation. Only the order of
+    the triangles changes, the corners of each triangle keep their order so
+    the provoking vertex stays first."""
+    triangle_count = len(indices) // 3
+    vertex_triangles = [[] for _ in range(vertex_count)]
+    for t in range(triangle_count):
+        for v in indices[3 * t:3 * t + 3]:
+            vertex_triangles[v].append(t)
+
+    cache_position = [-1] * vertex_count
+    vertex_score = [forsyth_vertex_score(-1, len(vertex_triangles[v])) for v in range(vertex_count)]
+    triangle_score = [triangle_vertex_score(vertex_score, indices, t) for t in range(triangle_count)]
+    is_emitted = [False] * triangle_count
+
+    cache = []
+    order = []
+    next_unemitted = 0
+    best = max(range(triangle_count), key=triangle_score.__getitem__, default=-1)
+    while len(order) < triangle_count:
+        if best < 0:
+            # nothing in the cache touches a triangle left, start elsewhere
+            while is_emitted[next_unemitted]:
+                next_unemitted += 1
+            best = next_unemitted
+
+        triangle = indices[3 * best:3 * best + 3]
+        is_emitted[best] = True
+        order.append(best)
+        for v in triangle:
+            vertex_triangles[v].remove(best)
+
+        cache = list(dict.fromkeys(triangle)) + [v for v in cache if v not in triangle]
+        evicted = cache[OPTIMIZER_CACHE_SIZE:]
+        cache = cache[:OPTIMIZER_CACHE_SIZE]
+        for v in evicted:
+            cache_position[v] = -1
+        for i, v in enumerate(cache):
+            cache_position[v] = i
+
+        touched = set()
+        for v in cache + evicted:
+            vertex_score[v] = forsyth_vertex_score(cache_position[v], len(vertex_triangles[v]))
+            touched.update(vertex_triangles[v])
+
+        # ascending order makes ties deterministic, flicker-meshc matches it
+        best = -1
+        best_score = -1.0
+        for t in sorted(touched):
+            triangle_score[t] = triangle_vertex_score(vertex_score, indices, t)
+            if triangle_score[t] > best_score:
+                best, best_score = t, triangle_score[t]
+
+    return [v for t in order for v in indices[3 * t:3 * t + 3]]
+
+
+def cluster_boundaries(indices):
+    """Splits a cache optimized triangle order into clusters that can be
+    reordered without losing more than OVERDRAW_THRESHOLD of cache efficiency
+    (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+    Overdraw")."""
+    triangle_count = len(indices) // 3
+
+    # hard boundaries where the cache starts over, every corner missed
+    hard = [0]
+    cache = []
+    for t in range(triangle_count):
+        triangle = indices[3 * t:3 * t + 3]
+        if t and all(v not in cache for v in triangle):
+            hard.append(t)
+        for v in triangle:
+            if v not in cache:
+                cache.append(v)
+                if len(cache) > STATISTICS_CACHE_SIZE:
+                    cache.pop(0)
+    hard.append(triangle_count)
+
+    # soft boundaries inside each hard cluster, wherever the cluster so far
+    # is already within the threshold of the whole cluster's ACMR
+    boundaries = []
+    for start, end in zip(hard, hard[1:]):
+        threshold = OVERDRAW_THRESHOLD * transformed_vertex_count(indices, triangles=range(start, end)) / (end - start)
+        boundaries.append(start)
+        cache = []
+        misses = 0
+        cluster_start = start
+        for t in range(start, end):
+            for v in indices[3 * t:3 * t + 3]:
+                if v not in cache:
+                    misses += 1
+                    cache.append(v)
+                    if len(cache) > STATISTICS_CACHE_SIZE:
+                        cache.pop(0)
+            if t + 1 < end and misses / (t + 1 - cluster_start) <= threshold:
+                boundaries.append(t + 1)
+                cache = []
+                misses = 0
+                cluster_start = t + 1
+    boundaries.append(triangle_count)
+
+    return boundaries
+
 
-    with open(file_name, mode="rb") as stl, open(vertex_file_name, mode="wb") as vertex:
-        header = stl.read(80)
-        num_triangles_b = stl.read(4)
-        num_triangles = int.from_bytes(num_triangles_b, byteorder='little')
-        num_vertices_b = struct.pack('I', num_triangles * 3)
+def optimize_overdraw(indices, positions):
+    """Draws clusters facing away from the mesh center first, they are the
+    most likely to occlude the rest."""
+    boundaries = cluster_boundaries(indices)
+    mesh_center = [0.0, 0.0, 0.0]
+    for p in positions:
+        for i in range(3):
+            mesh_center[i] += p[i]
+    mesh_center = [x / max(len(positions), 1) for x in mesh_center]
 
-        vertex.write(num_vertices_b)
+    clusters = []
+    for start, end in zip(boundaries, boundaries[1:]):
+        area_center = [0.0, 0.0, 0.0]
+        normal = [0.0, 0.0, 0.0]
+        area_sum = 0.0
+        for t in range(start, end):
+            a, b, c = (positions[v] for v in indices[3 * t:3 * t + 3])
+            u = [b[i] - a[i] for i in range(3)]
+            w = [c[i] - a[i] for i in range(3)]
+            n = [u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]]
+            area = math.sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2])
+            for i in range(3):
+                area_center[i] += area * (a[i] + b[i] + c[i]) / 3
+                normal[i] += n[i]
+            area_sum += area
+        if area_sum:
+            area_center = [x / area_sum for x in area_center]
+        length = math.sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]) or 1.0
+        occlusion = 0.0
+        for i in range(3):
+            occlusion += (area_center[i] - mesh_center[i]) * normal[i] / length
+        clusters.append((-occlusion, start, end))
 
-        for t in range(num_triangles):
-            normal_vector = struct.unpack('fff', stl.read(12))
-            vertex1_b = stl.read(12)
-            vertex1 = struct.unpack('fff', vertex1_b)
+    clusters.sort()
+    return [v for _, start, end in clusters for v in indices[3 * start:3 * end]], len(clusters)
 
-            vertex2_b = stl.read(12)
-            vertex2 = struct.unpack('fff', vertex2_b)
 
-            vertex3_b = stl.read(12)
-            vertex3 = struct.unpack('fff', vertex3_b)
+def optimize_vertex_fetch(vertices, indices):
+    """Renumbers the vertices in the order the indices first use them so
+    vertex fetches walk memory forward."""
+    remap = {}
+    for v in indices:
+        if v not in remap:
+            remap[v] = len(remap)
+
+    fetched = bytearray(len(remap) * VERTEX.size)
+    for old, new in remap.items():
+        fetched[new * VERTEX.size:(new + 1) * VERTEX.size] = vertices[old * VERTEX.size:(old + 1) * VERTEX.size]
+
+    return bytes(fetched), [remap[v] for v in indices]
+
+
+def optimize(vertices, indices):
+    vertex_count = len(vertices) // VERTEX.size
+    positions = [VERTEX.unpack_from(vertices, v * VERTEX.size)[:3] for v in range(vertex_count)]
+
+    print_cache_statistics('input', indices, vertex_count)
+    indices = optimize_vertex_cache(indices, vertex_count)
+    indices, cluster_count = optimize_overdraw(indices, positions)
+    vertices, indices = optimize_vertex_fetch(vertices, indices)
+    print_cache_statistics('optimized', indices, vertex_count)
+    print('    %d overdraw clusters' % cluster_count)
+
+    return vertices, indices
+
+
+def build_indices(indices, vertex_count):
+    """16 bit indices when every vertex can be addressed with them."""
+    index_format = '<H' if vertex_count <= 0x10000 else '<I'
+    element_size = struct.calcsize(index_format)
+    payload = struct.pack('<%d%s' % (len(indices), index_format[1]), *indices)
+    return element_size, payload
+
+
+def build_bounds(triangles):
+    positions = [v for triangle in triangles for v in triangle]
+    if not positions:
+        return [0.0, 0.0, 0.0], [0.0, 0.0, 0.0]
+
+    low = [min(p[i] for p in positions) for i in range(3)]
+    high = [max(p[i] for p in positions) for i in range(3)]
+    return low, high
+
+
+def quantize_vertices(vertices, low, high):
+    """struct VertexQuantized records, positions snorm and centroids 10 bit
+    unorm relative to the bounds. Rounded as floor(x + 0.5) in doubles, like
+    flicker-meshc."""
+    quantized = bytearray()
+    for v in range(len(vertices) // VERTEX.size):
+        values = VERTEX.unpack_from(vertices, v * VERTEX.size)
+        pos = [0, 0, 0]
+        centroid = 0
+        for i in range(3):
+            extent = high[i] - low[i]
+            if extent > 0:
+                snorm = ((values[i] - low[i]) / extent * 2 - 1) * 32767
+                pos[i] = min(max(math.floor(snorm + 0.5), -32767), 32767)
+                unorm = (values[3 + i] - low[i]) / extent * 1023
+                centroid |= min(max(math.floor(unorm + 0.5), 0), 1023) << (10 * i)
+        quantized.extend(VERTEX_QUANTIZED.pack(*pos, 0, centroid))
+    return bytes(quantized)
+
+
+def box_area(box):
+    """Half the surface area, like bvh.c's get_area."""
+    lo, hi = box
+    dx = hi[0] - lo[0]
+    dy = hi[1] - lo[1]
+    dz = hi[2] - lo[2]
+    return dx * dy + dy * dz + dz * dx
+
+
+def union_boxes(boxes):
+    return (
+        [min(box[0][i] for box in boxes) for i in range(3)],
+        [max(box[1][i] for box in boxes) for i in range(3)],
+    )
+
+
+def get_bin(center, low, extent):
+    return min(int(BVH_BIN_COUNT * (center - low) / extent), BVH_BIN_COUNT - 1)
+
+
+def build_bvh_node(boxes, centers, order, depth, nodes):
+    """Appends the subtree over the boxes in order depth first and returns
+    the box indices in leaf order. Same decisions as bvh.c's build_node."""
+    bounds = union_boxes([boxes[b] for b in order])
+    index = len(nodes)
+    nodes.append(None)
+    count = len(order)
+
+    def leaf():
+        nodes[index] = (bounds, None, count, 0)
+        return order
+
+    if count == 1 or depth + 1 >= BVH_MAX_DEPTH:
+        return leaf()
+
+    best_cost = math.inf
+    best_axis = 0
+    best_split = 0
+    for axis in range(3):
+        low = min(centers[b][axis] for b in order)
+        extent = max(centers[b][axis] for b in order) - low
+        if not extent > 0:
+            continue
+
+        bins = [[] for _ in range(BVH_BIN_COUNT)]
+        for b in order:
+            bins[get_bin(centers[b][axis], low, extent)].append(b)
+        for split in range(1, BVH_BIN_COUNT):
+            left = [b for i in range(split) for b in bins[i]]
+            right = [b for i in range(split, BVH_BIN_COUNT) for b in bins[i]]
+            if not left or not right:
+                continue
+            cost = (len(left) * box_area(union_boxes([boxes[b] for b in left]))
+                    + len(right) * box_area(union_boxes([boxes[b] for b in right])))
+            if cost < best_cost:
+                best_cost = cost
+                best_axis = axis
+                best_split = split
+
+    if best_split:
+        if count <= BVH_MAX_LEAF_COUNT and best_cost >= count * box_area(bounds):
+            return leaf()
+        low = min(centers[b][best_axis] for b in order)
+        extent = max(centers[b][best_axis] for b in order) - low
+        left = [b for b in order if get_bin(centers[b][best_axis], low, extent) < best_split]
+        right = [b for b in order if get_bin(centers[b][best_axis], low, extent) >= best_split]
+    elif count <= BVH_MAX_LEAF_COUNT:
+        return leaf()
+    else:
+        left = order[:count // 2]
+        right = order[count // 2:]
+
+    order = build_bvh_node(boxes, centers, left, depth + 1, nodes)
+    second = len(nodes)
+    order = order + build_bvh_node(boxes, centers, right, depth + 1, nodes)
+    nodes[index] = (bounds, second, 0, best_axis)
+    return order
+
+
+def build_bvh(vertices, indices, low, high):
+    """Binned SAH BVH over chunks of BVH_CHUNK_TRIANGLE_COUNT triangles in
+    index order, returns the node and primitive payloads. The chunk boxes
+    are grown by twice the largest quantization error, like flicker-meshc."""
+    pad = [(high[i] - low[i]) / 32767 for i in range(3)]
+    chunk_size = 3 * BVH_CHUNK_TRIANGLE_COUNT
+    boxes = []
+    for first in range(0, len(indices), chunk_size):
+        positions = [VERTEX.unpack_from(vertices, v * VERTEX.size)[:3] for v in indices[first:first + chunk_size]]
+        lo = [min(p[i] for p in positions) - pad[i] for i in range(3)]
+        hi = [max(p[i] for p in positions) + pad[i] for i in range(3)]
+        # rounded to floats like the stored boxes
+        box = struct.unpack('<6f', struct.pack('<6f', *lo, *hi))
+        boxes.append((box[:3], box[3:]))
+    centers = [[0.5 * (box[0][i] + box[1][i]) for i in range(3)] for box in boxes]
+
+    nodes = []
+    primitives = []
+    if boxes:
+        primitives = build_bvh_node(boxes, centers, list(range(len(boxes))), 0, nodes)
+
+    node_payload = bytearray()
+    first = 0
+    leaf_offsets = []
+    for bounds, second, count, axis in nodes:
+        leaf_offsets.append(first)
+        first += count
+    for (bounds, second, count, axis), leaf_offset in zip(nodes, leaf_offsets):
+        offset = leaf_offset if second is None else second
+        node_payload.extend(BVH_NODE.pack(*bounds[0], offset, *bounds[1], count, axis))
+    primitive_payload = struct.pack('<%dI' % len(primitives), *primitives)
+
+    print('    %d bvh nodes over %d chunks' % (len(nodes), len(boxes)))
+    return bytes(node_payload), primitive_payload
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
+
+
+def write_container(out, sections):
+    """sections is a list of (type, element size, payload bytes)."""
+    table = []
+    offset = align(HEADER.size)
+    for section_type, element_size, payload in sections:
+        table.append((section_type, element_size, offset, len(payload), zlib.crc32(payload)))
+        offset = align(offset + len(payload))
+
+    table_offset = offset
+    file_size = table_offset + len(sections) * SECTION.size
+
+    out.write(HEADER.pack(MAGIC, VERSION_MAJOR, VERSION_MINOR, ENDIAN_MARKER, len(sections), table_offset, file_size))
+    position = HEADER.size
+    for (section_type, element_size, offset, size, checksum), (_, _, payload) in zip(table, sections):
+        out.write(bytes(offset - position))
+        out.write(payload)
+        position = offset + size
+    out.write(bytes(table_offset - position))
+    for section_type, element_size, offset, size, checksum in table:
+        out.write(SECTION.pack(section_type, element_size, offset, size, checksum, 0))
+
+
+for file_name in sys.argv[1:]:
+    vertex_file_name = PurePath(file_name)
+    vertex_file_name = vertex_file_name.with_suffix('.vertex')
+
+    with open(file_name, mode="rb") as stl:
+        triangles = read_stl(stl)
 
-            centroid_x = (vertex1[0] + vertex2[0] + vertex3[0]) / 3
-            centroid_y = (vertex1[1] + vertex2[1] + vertex3[1]) / 3
-            centroid_z = (vertex1[2] + vertex2[2] + vertex3[2]) / 3
-            centroid_b = struct.pack('fff', centroid_x, centroid_y, centroid_z)
+    print('%s:' % vertex_file_name.name)
+    vertices, indices = build_vertices(triangles)
+    vertices, indices = optimize(vertices, indices)
+    vertex_count = len(vertices) // VERTEX.size
+    index_size, index_payload = build_indices(indices, vertex_count)
+    low, high = build_bounds(triangles)
+    quantized = quantize_vertices(vertices, low, high)
+    bvh_nodes, bvh_primitives = build_bvh(vertices, indices, low, high)
 
-            vertex.write(vertex1_b)
-            vertex.write(centroid_b)
-            vertex.write(vertex2_b)
-            vertex.write(centroid_b)
-            vertex.write(vertex3_b)
-            vertex.write(centroid_b)
+    with open(vertex_file_name, mode="wb") as vertex:
+        write_container(vertex, [
+            (SECTION_VERTEX_QUANTIZED, VERTEX_QUANTIZED.size, quantized),
+            (SECTION_INDEX, index_size, index_payload),
+            (SECTION_BOUNDS, BOUNDS.size, BOUNDS.pack(*low, *high)),
+            (SECTION_BVH_NODE, BVH_NODE.size, bvh_nodes),
+            (SECTION_BVH_PRIMITIVE, 4, bvh_primitives),
+        ])
 
-            num_attr = int.from_bytes(stl.read(2), byteorder='little')
-            stl.read(num_attr)
+    # bytes the gpu fetches to draw the mesh once, before welding and
+    # quantizing and after
+    unwelded_size = 3 * len(triangles) * VERTEX.size
+    welded_size = len(quantized) + len(index_payload)
+    print('    %d -> %d vertices (%.2fx fewer), %d bit indices, %d -> %d bytes (%.1f%% saved)' % (
+        3 * len(triangles),
+        vertex_count,
+        3 * len(triangles) / max(vertex_count, 1),
+        8 * index_size,
+        unwelded_size,
+        welded_size,
+        100.0 * (1 - welded_size / max(unwelded_size, 1)),
+    ))
@@ -0,0 +1,151 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/linmath.h"
+#include "graphics/cull.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+// Tests random boxes against the frustum of a camera in the middle of them
+// with the batched kernel and the one box at a time reference, checking they
+// agree, and reports boxes tested per microsecond.
+
+#define DEFAULT_BOX_COUNT (64 * 1024)
+#define DEFAULT_RUN_COUNT 200
+// boxes are spread over a cube of this half size around the camera
+#define SCENE_EXTENT 500.0f
+#define MAX_BOX_EXTENT 8.0f
+
+static double
+get_time_us(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1000000.0 + time.tv_nsec / 1000.0;
+}
+
+static int
+compare_double(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+
+    return (x > y) - (x < y);
+}
+
+// xorshift, so every run tests the same boxes
+static float
+random_float(uint32_t *state, float const min, float const max)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return min + (max - min) * (*state / (float)UINT32_MAX);
+}
+
+static double
+measure(
+    char const *name,
+    uint32_t (*cull)(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible),
+    float const planes[6][4],
+    struct GfxCullBoxes const *boxes,
+    uint32_t *visible,
+    uint32_t const run_count,
+    double *samples)
+{
+    uint32_t visible_count = 0;
+    for (uint32_t i = 0; i < run_count; i++) {
+        double begin_time = get_time_us();
+        visible_count = cull(planes, boxes, visible);
+        samples[i] = get_time_us() - begin_time;
+    }
+
+    qsort(samples, run_count, sizeof *samples, compare_double);
+    double median = samples[run_count / 2];
+    printf(
+        "%-6s: median %9.3f us  min %9.3f us  %8.1f boxes/us  (%u visible)\n",
+        name,
+        median,
+        samples[0],
+        median > 0.0 ? boxes->count / median : 0.0,
+        visible_count
+    );
+
+    return median;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t box_count = argc > 1 ? strtoul(argv[1], 0, 10) : DEFAULT_BOX_COUNT;
+    uint32_t run_count = argc > 2 ? strtoul(argv[2], 0, 10) : DEFAULT_RUN_COUNT;
+    if (!box_count || !run_count) {
+        fprintf(stderr, "usage: %s [boxes] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    struct GfxCullBoxes boxes;
+    gfx_init_cull_boxes(box_count, &boxes);
+    uint32_t state = 0x9e3779b9;
+    for (uint32_t i = 0; i < box_count; i++) {
+        float min[3];
+        float max[3];
+        for (int j = 0; j < 3; j++) {
+            min[j] = random_float(&state, -SCENE_EXTENT, SCENE_EXTENT);
+            max[j] = min[j] + random_float(&state, 0.0f, MAX_BOX_EXTENT);
+        }
+        gfx_set_cull_box(&boxes, i, min, max);
+    }
+
+    // the game's camera at the origin looking down a diagonal
+    struct {
+        float view[4][4];
+        float proj[4][4];
+    } ubo;
+    float pos[3] = {0.0f, 0.0f, 0.0f};
+    float yaw = 0.7f;
+    float pitch = 0.2f;
+    mat4_view(ubo.view, pos, cosf(yaw), sinf(yaw), cosf(pitch), sinf(pitch));
+    mat4_perspective(ubo.proj, 16.0f / 9.0f, 90.0f * M_PI / 180.0f, 0.01f, 1000.0f);
+    float view_proj[4][4];
+    mat4_mul(view_proj, ubo.view, ubo.proj);
+    float planes[6][4];
+    mat4_frustum_planes(planes, view_proj);
+
+    uint32_t *visible = malloc(boxes.capacity * sizeof *visible);
+    uint32_t *expected = malloc(boxes.capacity * sizeof *expected);
+    double *samples = malloc(run_count * sizeof *samples);
+    if (!visible || !expected || !samples) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    uint32_t expected_count = gfx_cull_boxes_scalar(planes, &boxes, expected);
+    uint32_t visible_count = gfx_cull_boxes(planes, &boxes, visible);
+    if (visible_count != expected_count || memcmp(visible, expected, visible_count * sizeof *visible)) {
+        fprintf(stderr, "%s kernel disagrees with the scalar one\n", gfx_cull_kernel_name());
+        return 1;
+    }
+
+    printf("%u boxes, %u runs\n", box_count, run_count);
+    double scalar_time = measure("scalar", gfx_cull_boxes_scalar, planes, &boxes, visible, run_count, samples);
+    double batched_time = measure(gfx_cull_kernel_name(), gfx_cull_boxes, planes, &boxes, visible, run_count, samples);
+    if (batched_time > 0.0) {
+        printf("speedup: %.2fx\n", scalar_time / batched_time);
+    }
+
+    free(samples);
+    free(expected);
+    free(visible);
+    gfx_free_cull_boxes(&boxes);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "graphics/io.h"
+
+// Loads every file of a directory with both io backends, cold and warm.
+// Cold runs evict the files from the page cache with posix_fadvise first,
+// which only drops clean pages nobody maps; run it on an idle machine.
+
+#define DEFAULT_DIRECTORY "asset/mesh"
+#define DEFAULT_SUFFIX ".vertex"
+#define DEFAULT_RUN_COUNT 5
+#define MAX_PATH_SIZE 4096
+
+static double
+get_time_ms(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static int
+compare_double(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+has_suffix(char const *name, char const *suffix)
+{
+    size_t name_size = strlen(name);
+    size_t suffix_size = strlen(suffix);
+
+    return name_size >= suffix_size && !strcmp(name + name_size - suffix_size, suffix);
+}
+
+static uint32_t
+list_files(char const *directory, char const *suffix, char ***paths)
+{
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    *paths = 0;
+
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (!has_suffix(entry->d_name, suffix)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            *paths = realloc(*paths, capacity * sizeof **paths);
+        }
+        (*paths)[count] = malloc(MAX_PATH_SIZE);
+        snprintf((*paths)[count], MAX_PATH_SIZE, "%s/%s", directory, entry->d_name);
+        count += 1;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+static void
+evict_files(uint32_t const count, char *const paths[])
+{
+    for (uint32_t i = 0; i < count; i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+static double
+load_files(uint32_t const count, char *const paths[], enum IoBackend const backend, enum IoBackend *used, uint64_t *size)
+{
+    struct IoFileBatch batch;
+    double begin = get_time_ms();
+    io_read_files(count, (char const *const *)paths, backend, &batch);
+    double time = get_time_ms() - begin;
+
+    *used = batch.backend;
+    *size = 0;
+    for (uint32_t i = 0; i < batch.count; i++) {
+        *size += batch.files[i].size;
+    }
+    io_free_files(&batch);
+
+    return time;
+}
+
+static void
+report(char const *name, char const *state, uint32_t const count, double samples[static const count], uint64_t const size)
+{
+    qsort(samples, count, sizeof *samples, compare_double);
+    double median = samples[count / 2];
+    printf(
+        "%-7s %-4s: median %8.3f ms  min %8.3f ms  %8.1f MiB/s\n",
+        name,
+        state,
+        median,
+        samples[0],
+        median > 0.0 ? size / (1024.0 * 1024.0) / (median / 1000.0) : 0.0
+    );
+}
+
+int
+main(int argc, char **argv)
+{
+    char const *directory = argc > 1 ? argv[1] : DEFAULT_DIRECTORY;
+    char const *suffix = argc > 2 ? argv[2] : DEFAULT_SUFFIX;
+    uint32_t run_count = argc > 3 ? strtoul(argv[3], 0, 10) : DEFAULT_RUN_COUNT;
+    if (run_count == 0) {
+        fprintf(stderr, "usage: %s [directory] [suffix] [runs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char **paths;
+    uint32_t count = list_files(directory, suffix, &paths);
+    if (!count) {
+        fprintf(stderr, "no %s files in %s\n", suffix, directory);
+        return EXIT_FAILURE;
+    }
+
+    double *cold_samples = malloc(run_count * sizeof *cold_samples);
+    double *warm_samples = malloc(run_count * sizeof *warm_samples);
+    enum IoBackend backends[] = { IO_BACKEND_POSIX, IO_BACKEND_URING };
+    char const *names[] = { "posix", "uring" };
+    uint64_t size = 0;
+
+    for (uint32_t b = 0; b < sizeof backends / sizeof *backends; b++) {
+        enum IoBackend used = backends[b];
+        for (uint32_t i = 0; i < run_count; i++) {
+            evict_files(count, paths);
+            cold_samples[i] = load_files(count, paths, backends[b], &used, &size);
+        }
+        for (uint32_t i = 0; i < run_count; i++) {
+            warm_samples[i] = load_files(count, paths, backends[b], &used, &size);
+        }
+
+        if (used != backends[b]) {
+            printf("%s unavailable, measured %s\n", names[b], names[used]);
+        }
+        if (b == 0) {
+            printf("%s: %" PRIu32 " files, %.1f MiB, %" PRIu32 " runs\n", directory, count, size / (1024.0 * 1024.0), run_count);
+        }
+        report(names[b], "cold", run_count, cold_samples, size);
+        report(names[b], "warm", run_count, warm_samples, size);
+    }
+
+    free(warm_samples);
+    free(cold_samples);
+    for (uint32_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+
+    return EXIT_SUCCESS;
+}
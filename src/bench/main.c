@@ -0,0 +1,270 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "game/io.h"
+#include "graphics/graphics.h"
+#include "graphics/vertex.h"
+#include "common/linmath.h"
+#include "platform/platform.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+#define DEFAULT_MAP "asset/mesh/map1.vertex"
+#define DEFAULT_FRAME_COUNT 1000
+#define DEFAULT_WIDTH 1280
+#define DEFAULT_HEIGHT 720
+#define DEFAULT_THREAD_COUNT 1
+#define DEFAULT_OBJECT_COUNT 1
+// frames rendered before sampling starts so pipeline warm up is not measured
+#define WARMUP_FRAME_COUNT 16
+
+static struct UBO ubo;
+static float camera_pos[3] = {0.0f, 9.5f, 0.0f};
+
+static int
+compare_double(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile, samples must be sorted
+static double
+percentile(size_t const count, double const samples[static const count], double const p)
+{
+    size_t rank = (size_t)ceil(p / 100.0 * count);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    return samples[rank - 1];
+}
+
+static void
+report(char const *name, size_t const count, double samples[static const count])
+{
+    if (count == 0) {
+        printf("%-6s time: unavailable\n", name);
+        return;
+    }
+
+    qsort(samples, count, sizeof *samples, compare_double);
+    printf(
+        "%-6s time (ms): p50 %8.3f  p95 %8.3f  p99 %8.3f  (%zu samples)\n",
+        name,
+        percentile(count, samples, 50.0),
+        percentile(count, samples, 95.0),
+        percentile(count, samples, 99.0),
+        count
+    );
+}
+
+// scripted camera path: one slow orbit around the spawn point while looking
+// around, so every run renders the same sequence of views
+static void
+update_camera(uint32_t const frame, uint32_t const frame_count)
+{
+    float t = 2.0f * M_PI * frame / frame_count;
+    float pos[3] = {
+        camera_pos[0] + 4.0f * sinf(t),
+        camera_pos[1],
+        camera_pos[2] + 4.0f * cosf(t),
+    };
+    float yaw = t;
+    float pitch = 0.25f * sinf(2.0f * t);
+
+    mat4_view(ubo.view, pos, cosf(yaw), sinf(yaw), cosf(pitch), sinf(pitch));
+}
+
+// copies of the map on a square grid in the xz plane, one map apart, with
+// the first one at the origin
+static void
+create_objects(uint32_t const mesh, struct GraphicsMesh const *graphics_mesh, uint32_t const object_count)
+{
+    uint32_t side = (uint32_t)ceil(sqrt(object_count));
+    float spacing_x = graphics_mesh->bounds_max[0] - graphics_mesh->bounds_min[0];
+    float spacing_z = graphics_mesh->bounds_max[2] - graphics_mesh->bounds_min[2];
+
+    for (uint32_t i = 0; i < object_count; i++) {
+        float transform[4][4];
+        mat4_translation(transform, (i % side) * spacing_x, 0.0f, (i / side) * spacing_z);
+        uint32_t object = graphics.create_object(mesh, transform);
+        assert(object);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    char const *map = argc > 1 ? argv[1] : DEFAULT_MAP;
+    uint32_t frame_count = argc > 2 ? strtoul(argv[2], 0, 10) : DEFAULT_FRAME_COUNT;
+    uint32_t width = argc > 3 ? strtoul(argv[3], 0, 10) : DEFAULT_WIDTH;
+    uint32_t height = argc > 4 ? strtoul(argv[4], 0, 10) : DEFAULT_HEIGHT;
+    uint32_t thread_count = argc > 5 ? strtoul(argv[5], 0, 10) : DEFAULT_THREAD_COUNT;
+    // 0 keeps the renderer default
+    uint32_t draw_vertex_count = argc > 6 ? strtoul(argv[6], 0, 10) : 0;
+    uint32_t frames_in_flight = argc > 7 ? strtoul(argv[7], 0, 10) : 0;
+    int use_timeline_semaphore = argc > 8 ? atoi(argv[8]) : 1;
+    uint32_t object_count = argc > 9 ? strtoul(argv[9], 0, 10) : DEFAULT_OBJECT_COUNT;
+    int use_indirect_draws = argc > 10 ? atoi(argv[10]) : 1;
+    int use_occlusion_culling = argc > 11 ? atoi(argv[11]) : 1;
+
+    if (frame_count == 0 || width == 0 || height == 0 || thread_count == 0 || draw_vertex_count % 3 || frames_in_flight > 3 || object_count == 0) {
+        fprintf(
+            stderr,
+            "usage: %s [map.vertex] [frames] [width] [height] [threads] [vertices per draw] [frames in flight] [timeline] [objects] [indirect] [occlusion]\n",
+            argv[0]
+        );
+        return EXIT_FAILURE;
+    }
+
+    struct IoMappedMesh mesh;
+    enum IoResult io_result = io_map_mesh(map, &mesh);
+    // the renderer trusts the bvh links
+    if (io_result == IO_RESULT_OK && (io_result = io_verify_mesh(&mesh)) != IO_RESULT_OK) {
+        io_unmap_mesh(&mesh);
+    }
+    if (io_result != IO_RESULT_OK) {
+        fprintf(stderr, "failed to load %s: %s\n", map, io_result_string(io_result));
+        return EXIT_FAILURE;
+    }
+
+    struct GraphicsConfig config = {
+        .is_headless = 1,
+        .width = width,
+        .height = height,
+        .record_thread_count = thread_count,
+        .draw_item_vertex_count = draw_vertex_count,
+        .frames_in_flight = frames_in_flight,
+        .use_timeline_semaphore = use_timeline_semaphore,
+        .max_object_count = object_count,
+        .use_indirect_draws = use_indirect_draws,
+        .use_occlusion_culling = use_occlusion_culling,
+    };
+    graphics.init(&config);
+
+    uint32_t vertex_count = mesh.vertex_count;
+    uint32_t index_count = mesh.index_count;
+    char const *vertex_format = mesh.vertex_format == VERTEX_FORMAT_QUANTIZED ? "quantized" : "float";
+    struct GraphicsMesh graphics_mesh = {
+        .vertex_count = mesh.vertex_count,
+        .vertex_format = mesh.vertex_format,
+        .vertices = mesh.vertices,
+        .index_count = mesh.index_count,
+        .index_size = mesh.index_size,
+        .indices = mesh.indices,
+        .bvh_node_count = mesh.bvh_node_count,
+        .bvh_nodes = mesh.bvh_nodes,
+        .bvh_primitive_count = mesh.bvh_primitive_count,
+        .bvh_primitives = mesh.bvh_primitives,
+    };
+    if (mesh.bounds_count) {
+        memcpy(graphics_mesh.bounds_min, mesh.bounds[0].min, sizeof graphics_mesh.bounds_min);
+        memcpy(graphics_mesh.bounds_max, mesh.bounds[0].max, sizeof graphics_mesh.bounds_max);
+    }
+    uint32_t graphics_handle = graphics.register_mesh(&graphics_mesh);
+    io_unmap_mesh(&mesh);
+    if (!graphics_handle) {
+        graphics.deinit();
+        return EXIT_FAILURE;
+    }
+    create_objects(graphics_handle, &graphics_mesh, object_count);
+
+    mat4_perspective(ubo.proj, (float)width / height, 90.0f * M_PI / 180.0f, 0.01f, 1000.0f);
+
+    double *cpu_samples = malloc(frame_count * sizeof *cpu_samples);
+    double *gpu_samples = malloc(frame_count * sizeof *gpu_samples);
+    double *record_samples = malloc(frame_count * sizeof *record_samples);
+    size_t cpu_sample_count = 0;
+    size_t gpu_sample_count = 0;
+    uint64_t last_gpu_sample = 0;
+
+    long prev_time;
+    platform.get_timestamp(&prev_time);
+    for (uint32_t i = 0; i < WARMUP_FRAME_COUNT + frame_count; i++) {
+        update_camera(i, WARMUP_FRAME_COUNT + frame_count);
+        graphics.draw_frame(&ubo);
+
+        long time;
+        platform.get_timestamp(&time);
+        struct GraphicsFrameStats stats;
+        graphics.get_frame_stats(&stats);
+
+        if (i >= WARMUP_FRAME_COUNT) {
+            record_samples[cpu_sample_count] = stats.record_time_ms;
+            cpu_samples[cpu_sample_count++] = (time - prev_time) / 1000000.0;
+            if (stats.is_gpu_time_valid && stats.gpu_sample_count != last_gpu_sample) {
+                gpu_samples[gpu_sample_count++] = stats.gpu_time_ms;
+            }
+        }
+
+        last_gpu_sample = stats.gpu_sample_count;
+        prev_time = time;
+    }
+
+    printf(
+        "map: %s, %" PRIu32 " %s vertices, %" PRIu32 " indices, %" PRIu32 " objects, %" PRIu32 "x%" PRIu32 ", %" PRIu32 " frames, %" PRIu32 " record threads\n",
+        map,
+        vertex_count,
+        vertex_format,
+        index_count,
+        object_count,
+        width,
+        height,
+        frame_count,
+        thread_count
+    );
+    report("cpu", cpu_sample_count, cpu_samples);
+    report("gpu", gpu_sample_count, gpu_samples);
+    report("record", cpu_sample_count, record_samples);
+
+    struct GraphicsFrameStats stats;
+    graphics.get_frame_stats(&stats);
+    printf("frame pacing: %s\n", stats.is_timeline_enabled ? "timeline semaphore" : "fences");
+    printf(
+        "draws: %s%s\n",
+        !stats.is_indirect_enabled ? "cpu culled chunks"
+            : stats.is_indirect_count_enabled ? "gpu culled, indirect with count" : "gpu culled, indirect",
+        stats.is_occlusion_enabled ? ", two phase occlusion culling" : ""
+    );
+    if (!stats.is_indirect_enabled) {
+        printf(
+            "visible chunks: %llu of %llu\n",
+            (unsigned long long)stats.visible_chunk_count,
+            (unsigned long long)stats.chunk_count
+        );
+    }
+    printf(
+        "pipeline creation: %.3f ms (%s pipeline cache)\n",
+        stats.pipeline_time_ms,
+        stats.is_pipeline_cache_warm ? "warm" : "cold"
+    );
+
+    struct GraphicsMemoryStats memory_stats;
+    graphics.get_memory_stats(&memory_stats);
+    printf(
+        "device memory: %" PRIu32 "/%" PRIu32 " blocks, %" PRIu32 " allocations, %.1f/%.1f MiB used, largest free %.1f MiB\n",
+        memory_stats.block_count,
+        memory_stats.max_block_count,
+        memory_stats.allocation_count,
+        memory_stats.used_bytes / (1024.0 * 1024.0),
+        memory_stats.reserved_bytes / (1024.0 * 1024.0),
+        memory_stats.largest_free_bytes / (1024.0 * 1024.0)
+    );
+
+    free(record_samples);
+    free(gpu_samples);
+    free(cpu_samples);
+
+    graphics.deinit();
+
+    return EXIT_SUCCESS;
+}
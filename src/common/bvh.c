@@ -0,0 +1,550 @@
+#include "common/bvh.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// builds over fewer boxes stay on the calling thread
+#define PARALLEL_MIN_COUNT 1024
+// subtrees handed out per thread, so uneven ones even out
+#define JOBS_PER_THREAD 8
+#define NO_JOB UINT32_MAX
+
+struct BuildNode {
+    struct BvhBox bounds;
+    uint32_t first;
+    uint32_t count;
+    uint32_t axis;
+    // 0 for leaves, the root of a tree is never a child
+    uint32_t left;
+    uint32_t right;
+    // set when the subtree is built by that job instead
+    uint32_t job;
+};
+
+struct BuildTree {
+    uint32_t count;
+    uint32_t capacity;
+    struct BuildNode *nodes;
+};
+
+struct BuildJob {
+    uint32_t first;
+    uint32_t count;
+    uint32_t depth;
+    struct BuildTree tree;
+};
+
+struct BuildContext {
+    struct BvhBox const *boxes;
+    // 3 per box
+    double *centers;
+    // box indices partitioned in place, ends up as the primitive list
+    uint32_t *order;
+    uint32_t *scratch;
+    // subtrees of at most this many boxes are deferred to the jobs, 0 builds
+    // everything in place
+    uint32_t defer_count;
+    uint32_t job_count;
+    uint32_t job_capacity;
+    struct BuildJob *jobs;
+    atomic_uint next_job;
+};
+
+/* Private Functions */
+
+static void
+clear_box(struct BvhBox *box)
+{
+    for (int i = 0; i < 3; i++) {
+        box->min[i] = INFINITY;
+        box->max[i] = -INFINITY;
+    }
+}
+
+static void
+grow_box(struct BvhBox *box, struct BvhBox const *other)
+{
+    for (int i = 0; i < 3; i++) {
+        if (other->min[i] < box->min[i]) {
+            box->min[i] = other->min[i];
+        }
+        if (other->max[i] > box->max[i]) {
+            box->max[i] = other->max[i];
+        }
+    }
+}
+
+// half the surface area, the factor cancels out of every comparison
+static double
+get_area(struct BvhBox const *box)
+{
+    double dx = (double)box->max[0] - box->min[0];
+    double dy = (double)box->max[1] - box->min[1];
+    double dz = (double)box->max[2] - box->min[2];
+
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static uint32_t
+get_bin(double const center, double const min, double const extent)
+{
+    uint32_t bin = BVH_BIN_COUNT * (center - min) / extent;
+
+    return bin < BVH_BIN_COUNT ? bin : BVH_BIN_COUNT - 1;
+}
+
+static uint32_t
+push_node(struct BuildTree *tree)
+{
+    if (tree->count == tree->capacity) {
+        tree->capacity = tree->capacity ? 2 * tree->capacity : 64;
+        tree->nodes = realloc(tree->nodes, tree->capacity * sizeof *tree->nodes);
+        assert(tree->nodes);
+    }
+
+    return tree->count++;
+}
+
+static uint32_t
+push_job(struct BuildContext *context, uint32_t const first, uint32_t const count, uint32_t const depth)
+{
+    if (context->job_count == context->job_capacity) {
+        context->job_capacity = context->job_capacity ? 2 * context->job_capacity : 64;
+        context->jobs = realloc(context->jobs, context->job_capacity * sizeof *context->jobs);
+        assert(context->jobs);
+    }
+    context->jobs[context->job_count] = (struct BuildJob){ .first = first, .count = count, .depth = depth };
+
+    return context->job_count++;
+}
+
+// Splits along the axis and bin boundary with the lowest SAH cost, the first
+// one on ties. A node becomes a leaf when it holds few enough boxes and no
+// split is cheaper than testing them all, or at the depth limit. Boxes whose
+// centers all coincide are split in the middle of their order.
+static uint32_t
+build_node(
+    struct BuildContext *context,
+    struct BuildTree *tree,
+    uint32_t const first,
+    uint32_t const count,
+    uint32_t const depth,
+    int const is_deferring)
+{
+    struct BvhBox bounds;
+    clear_box(&bounds);
+    double center_min[3] = {INFINITY, INFINITY, INFINITY};
+    double center_max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t box = context->order[i];
+        grow_box(&bounds, &context->boxes[box]);
+        for (int j = 0; j < 3; j++) {
+            double center = context->centers[3 * box + j];
+            center_min[j] = center < center_min[j] ? center : center_min[j];
+            center_max[j] = center > center_max[j] ? center : center_max[j];
+        }
+    }
+
+    uint32_t index = push_node(tree);
+    tree->nodes[index] = (struct BuildNode){
+        .bounds = bounds,
+        .first = first,
+        .count = count,
+        .job = NO_JOB,
+    };
+    if (is_deferring && count <= context->defer_count) {
+        tree->nodes[index].job = push_job(context, first, count, depth);
+        return index;
+    }
+    if (count == 1 || depth + 1 >= BVH_MAX_DEPTH) {
+        assert(count <= UINT16_MAX);
+        return index;
+    }
+
+    double best_cost = INFINITY;
+    uint32_t best_axis = 0;
+    uint32_t best_split = 0;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        double extent = center_max[axis] - center_min[axis];
+        if (!(extent > 0.0)) {
+            continue;
+        }
+
+        uint32_t bin_counts[BVH_BIN_COUNT] = {0};
+        struct BvhBox bin_bounds[BVH_BIN_COUNT];
+        for (uint32_t i = 0; i < BVH_BIN_COUNT; i++) {
+            clear_box(&bin_bounds[i]);
+        }
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t box = context->order[i];
+            uint32_t bin = get_bin(context->centers[3 * box + axis], center_min[axis], extent);
+            bin_counts[bin] += 1;
+            grow_box(&bin_bounds[bin], &context->boxes[box]);
+        }
+
+        // right side areas swept from the back, the left side from the front
+        double right_areas[BVH_BIN_COUNT];
+        uint32_t right_counts[BVH_BIN_COUNT];
+        struct BvhBox right;
+        clear_box(&right);
+        uint32_t right_count = 0;
+        for (uint32_t split = BVH_BIN_COUNT - 1; split > 0; split--) {
+            grow_box(&right, &bin_bounds[split]);
+            right_count += bin_counts[split];
+            right_areas[split] = get_area(&right);
+            right_counts[split] = right_count;
+        }
+
+        struct BvhBox left;
+        clear_box(&left);
+        uint32_t left_count = 0;
+        for (uint32_t split = 1; split < BVH_BIN_COUNT; split++) {
+            grow_box(&left, &bin_bounds[split - 1]);
+            left_count += bin_counts[split - 1];
+            if (!left_count || !right_counts[split]) {
+                continue;
+            }
+            double cost = (double)left_count * get_area(&left) + (double)right_counts[split] * right_areas[split];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    uint32_t left_count = count / 2;
+    if (best_split) {
+        if (count <= BVH_MAX_LEAF_COUNT && best_cost >= (double)count * get_area(&bounds)) {
+            return index;
+        }
+
+        // stable, so the order only depends on the input
+        double extent = center_max[best_axis] - center_min[best_axis];
+        left_count = 0;
+        uint32_t right_count = 0;
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t box = context->order[i];
+            if (get_bin(context->centers[3 * box + best_axis], center_min[best_axis], extent) < best_split) {
+                context->order[first + left_count++] = box;
+            } else {
+                context->scratch[first + right_count++] = box;
+            }
+        }
+        memcpy(&context->order[first + left_count], &context->scratch[first], right_count * sizeof *context->order);
+    } else if (count <= BVH_MAX_LEAF_COUNT) {
+        return index;
+    }
+
+    uint32_t left_child = build_node(context, tree, first, left_count, depth + 1, is_deferring);
+    uint32_t right_child = build_node(context, tree, first + left_count, count - left_count, depth + 1, is_deferring);
+    tree->nodes[index].axis = best_axis;
+    tree->nodes[index].left = left_child;
+    tree->nodes[index].right = right_child;
+
+    return index;
+}
+
+static int
+run_jobs(void *arg)
+{
+    struct BuildContext *context = arg;
+
+    for (;;) {
+        uint32_t i = atomic_fetch_add(&context->next_job, 1);
+        if (i >= context->job_count) {
+            break;
+        }
+        struct BuildJob *job = &context->jobs[i];
+        build_node(context, &job->tree, job->first, job->count, job->depth, 0);
+    }
+
+    return 0;
+}
+
+static void
+flatten(
+    struct BuildContext const *context,
+    struct BuildTree const *tree,
+    uint32_t const index,
+    struct BvhNode *nodes,
+    uint32_t *node_count)
+{
+    struct BuildNode const *node = &tree->nodes[index];
+    if (node->job != NO_JOB) {
+        flatten(context, &context->jobs[node->job].tree, 0, nodes, node_count);
+        return;
+    }
+
+    uint32_t out = (*node_count)++;
+    nodes[out] = (struct BvhNode){0};
+    memcpy(nodes[out].min, node->bounds.min, sizeof nodes[out].min);
+    memcpy(nodes[out].max, node->bounds.max, sizeof nodes[out].max);
+    if (!node->left) {
+        nodes[out].offset = node->first;
+        nodes[out].count = node->count;
+        return;
+    }
+
+    flatten(context, tree, node->left, nodes, node_count);
+    nodes[out].offset = *node_count;
+    nodes[out].axis = node->axis;
+    flatten(context, tree, node->right, nodes, node_count);
+}
+
+static int
+is_ray_hitting_box(struct BvhNode const *node, float const origin[3], float const inverse[3], float const distance)
+{
+    float near = 0.0f;
+    float far = distance;
+    for (int i = 0; i < 3; i++) {
+        float t0 = (node->min[i] - origin[i]) * inverse[i];
+        float t1 = (node->max[i] - origin[i]) * inverse[i];
+        if (t0 > t1) {
+            float t = t0;
+            t0 = t1;
+            t1 = t;
+        }
+        // comparisons with NaN are false, so a ray in a slab's plane
+        // ignores that slab
+        near = t0 > near ? t0 : near;
+        far = t1 < far ? t1 : far;
+    }
+
+    return near <= far;
+}
+
+uint32_t
+bvh_build(
+    uint32_t const count,
+    struct BvhBox const *boxes,
+    uint32_t const thread_count,
+    struct BvhNode *nodes,
+    uint32_t *primitives)
+{
+    if (!count) {
+        return 0;
+    }
+
+    struct BuildContext context = {
+        .boxes = boxes,
+        .centers = malloc(3 * (size_t)count * sizeof *context.centers),
+        .order = primitives,
+        .scratch = malloc(count * sizeof *context.scratch),
+        .defer_count = thread_count > 1 && count >= PARALLEL_MIN_COUNT ? count / (JOBS_PER_THREAD * thread_count) : 0,
+    };
+    assert(context.centers && context.scratch);
+    atomic_init(&context.next_job, 0);
+    for (uint32_t i = 0; i < count; i++) {
+        primitives[i] = i;
+        for (int j = 0; j < 3; j++) {
+            context.centers[3 * i + j] = 0.5 * ((double)boxes[i].min[j] + boxes[i].max[j]);
+        }
+    }
+
+    // the top levels are built here, the subtrees below them on the threads
+    struct BuildTree top = {0};
+    build_node(&context, &top, 0, count, 0, context.defer_count != 0);
+
+    uint32_t worker_count = thread_count < context.job_count ? thread_count : context.job_count;
+    thrd_t *threads = malloc((worker_count ? worker_count : 1) * sizeof *threads);
+    assert(threads);
+    for (uint32_t i = 1; i < worker_count; i++) {
+        int status = thrd_create(&threads[i], run_jobs, &context);
+        assert(status == thrd_success);
+        (void)status;
+    }
+    run_jobs(&context);
+    for (uint32_t i = 1; i < worker_count; i++) {
+        thrd_join(threads[i], 0);
+    }
+    free(threads);
+
+    uint32_t node_count = 0;
+    flatten(&context, &top, 0, nodes, &node_count);
+    assert(node_count <= 2 * count - 1);
+
+    for (uint32_t i = 0; i < context.job_count; i++) {
+        free(context.jobs[i].tree.nodes);
+    }
+    free(context.jobs);
+    free(top.nodes);
+    free(context.scratch);
+    free(context.centers);
+
+    return node_count;
+}
+
+int
+bvh_validate(
+    uint32_t const node_count,
+    struct BvhNode const *nodes,
+    uint32_t const primitive_count,
+    uint32_t const *primitives,
+    uint32_t const box_count)
+{
+    for (uint32_t i = 0; i < primitive_count; i++) {
+        if (primitives[i] >= box_count) {
+            return 0;
+        }
+    }
+    if (!node_count) {
+        return 1;
+    }
+
+    // children come after their parent, so one pass in order sees every
+    // node's depth before its children; each node is reached exactly once,
+    // which rules out shared subtrees
+    uint8_t *depths = calloc(node_count, sizeof *depths);
+    assert(depths);
+    depths[0] = 1;
+    int is_valid = 1;
+    // leaves must split the primitives into consecutive ranges in node
+    // order, like flatten writes them, so a traversal writes each primitive
+    // once at most
+    uint32_t leaf_end = 0;
+    for (uint32_t i = 0; i < node_count && is_valid; i++) {
+        struct BvhNode const *node = &nodes[i];
+        if (!depths[i]) {
+            is_valid = 0;
+        } else if (node->count) {
+            is_valid = node->offset == leaf_end && node->count <= primitive_count - leaf_end;
+            leaf_end += node->count;
+        } else if (depths[i] >= BVH_MAX_DEPTH
+            // rays index their direction with it
+            || node->axis >= 3
+            || i + 1 >= node_count
+            || node->offset <= i + 1
+            || node->offset >= node_count
+            || depths[i + 1]
+            || depths[node->offset]) {
+            is_valid = 0;
+        } else {
+            depths[i + 1] = depths[i] + 1;
+            depths[node->offset] = depths[i] + 1;
+        }
+    }
+    free(depths);
+
+    return is_valid && leaf_end == primitive_count;
+}
+
+uint32_t
+bvh_cull(
+    uint32_t const node_count,
+    struct BvhNode const *nodes,
+    uint32_t const *primitives,
+    float const planes[6][4],
+    uint32_t *visible)
+{
+    if (!node_count) {
+        return 0;
+    }
+
+    struct {
+        uint32_t index;
+        uint32_t plane_mask;
+    } stack[BVH_MAX_DEPTH];
+    uint32_t stack_count = 0;
+    uint32_t index = 0;
+    // planes the node still straddles
+    uint32_t plane_mask = 0x3f;
+    uint32_t visible_count = 0;
+
+    for (;;) {
+        struct BvhNode const *node = &nodes[index];
+        int is_outside = 0;
+        for (int p = 0; p < 6 && !is_outside; p++) {
+            if (!(plane_mask & 1u << p)) {
+                continue;
+            }
+            float distance = planes[p][3];
+            float radius = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                distance += planes[p][i] * 0.5f * (node->min[i] + node->max[i]);
+                radius += fabsf(planes[p][i]) * 0.5f * (node->max[i] - node->min[i]);
+            }
+            is_outside = distance < -radius;
+            if (distance >= radius) {
+                plane_mask &= ~(1u << p);
+            }
+        }
+
+        if (!is_outside) {
+            if (!node->count) {
+                stack[stack_count].index = node->offset;
+                stack[stack_count].plane_mask = plane_mask;
+                stack_count += 1;
+                index += 1;
+                continue;
+            }
+            for (uint32_t i = 0; i < node->count; i++) {
+                visible[visible_count++] = primitives[node->offset + i];
+            }
+        }
+
+        if (!stack_count) {
+            break;
+        }
+        stack_count -= 1;
+        index = stack[stack_count].index;
+        plane_mask = stack[stack_count].plane_mask;
+    }
+
+    return visible_count;
+}
+
+int
+bvh_cast_ray(
+    uint32_t const node_count,
+    struct BvhNode const *nodes,
+    uint32_t const *primitives,
+    float const origin[3],
+    float const direction[3],
+    float *distance,
+    BvhIntersect intersect,
+    void *context)
+{
+    if (!node_count) {
+        return 0;
+    }
+
+    float inverse[3];
+    for (int i = 0; i < 3; i++) {
+        inverse[i] = 1.0f / direction[i];
+    }
+
+    uint32_t stack[BVH_MAX_DEPTH];
+    uint32_t stack_count = 0;
+    uint32_t index = 0;
+    int is_hit = 0;
+
+    for (;;) {
+        struct BvhNode const *node = &nodes[index];
+        if (is_ray_hitting_box(node, origin, inverse, *distance)) {
+            if (!node->count) {
+                // the second child is nearer when the ray runs against the
+                // split axis
+                int is_reversed = direction[node->axis] < 0.0f;
+                stack[stack_count++] = is_reversed ? index + 1 : node->offset;
+                index = is_reversed ? node->offset : index + 1;
+                continue;
+            }
+            for (uint32_t i = 0; i < node->count; i++) {
+                is_hit |= intersect(context, primitives[node->offset + i], origin, direction, distance);
+            }
+        }
+
+        if (!stack_count) {
+            break;
+        }
+        index = stack[--stack_count];
+    }
+
+    return is_hit;
+}
@@ -62,6 +62,19 @@ void mat4_mul(float m[4][4], float a[4][4], float b[4][4]) {
     memcpy(m, temp, sizeof temp);
 }
 
+void
+mat4_translation(float m[static 4][4], float x, float y, float z)
+{
+    memset(m, 0, 16 * sizeof m[0][0]);
+    m[0][0] = 1.0f;
+    m[1][1] = 1.0f;
+    m[2][2] = 1.0f;
+    m[3][0] = x;
+    m[3][1] = y;
+    m[3][2] = z;
+    m[3][3] = 1.0f;
+}
+
 void
 mat4_view(float m[static 4][4], float pos[static 3], float cos_yaw, float sin_yaw, float cos_pitch, float sin_pitch)
 {
@@ -130,3 +143,28 @@ void mat4_perspective(float m[static 4][4], float aspect, float fovy, float n, f
 
     mat4_mul(m, p, c);
 }
+
+// Extracts the planes of the frustum m projects to clip space as
+// (normal, distance), normals pointing inwards and normalized, so
+// dot(normal, p) + distance is the signed distance of p to the plane. The
+// depth range is Vulkan's 0 to w. Order: left, right, bottom, top, near, far.
+void
+mat4_frustum_planes(float planes[static 6][4], float m[static 4][4])
+{
+    // m[col][row], so row i of the matrix is m[0..3][i]
+    for (int i = 0; i < 4; i++) {
+        planes[0][i] = m[i][3] + m[i][0];
+        planes[1][i] = m[i][3] - m[i][0];
+        planes[2][i] = m[i][3] + m[i][1];
+        planes[3][i] = m[i][3] - m[i][1];
+        planes[4][i] = m[i][2];
+        planes[5][i] = m[i][3] - m[i][2];
+    }
+
+    for (int i = 0; i < 6; i++) {
+        float l = vec3_length(planes[i]);
+        for (int j = 0; j < 4; j++) {
+            planes[i][j] /= l;
+        }
+    }
+}
@@ -1,23 +1,306 @@
+#ifdef __linux__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "game/io.h"
 
-#include <assert.h>
-#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error Unsupported OS
+#endif
 
 #include "graphics/vertex.h"
 
+static once_flag crc32_once = ONCE_FLAG_INIT;
+static uint32_t crc32_table[256];
+
+static void
+init_crc32_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+        }
+        crc32_table[i] = crc;
+    }
+}
+
+uint32_t
+io_crc32(void const *data, size_t const size)
+{
+    uint8_t const *bytes = data;
+    // meshes are verified on the stream threads
+    call_once(&crc32_once, init_crc32_table);
+
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xffffffffu;
+}
+
+static int
+is_section_valid(struct IoMeshSection const *section, size_t const file_size)
+{
+    return section->offset % IO_MESH_ALIGNMENT == 0
+        && section->offset <= file_size
+        && section->size <= file_size - section->offset
+        && section->element_size
+        && section->size % section->element_size == 0;
+}
+
+static int
+parse_mesh(struct IoMappedMesh *mesh)
+{
+    struct IoMeshHeader header;
+    if (mesh->size < sizeof header) {
+        return 0;
+    }
+    memcpy(&header, mesh->base, sizeof header);
+
+    if (memcmp(header.magic, IO_MESH_MAGIC, sizeof header.magic)
+        || header.endian_marker != IO_MESH_ENDIAN_MARKER
+        || header.version_major != IO_MESH_VERSION_MAJOR
+        || header.file_size != mesh->size) {
+        return 0;
+    }
+
+    uint64_t table_size = (uint64_t)header.section_count * sizeof *mesh->sections;
+    if (header.section_table_offset % IO_MESH_ALIGNMENT
+        || header.section_table_offset > mesh->size
+        || table_size > mesh->size - header.section_table_offset) {
+        return 0;
+    }
+    mesh->section_count = header.section_count;
+    mesh->sections = (struct IoMeshSection const *)((char const *)mesh->base + header.section_table_offset);
+
+    for (uint32_t i = 0; i < mesh->section_count; i++) {
+        if (!is_section_valid(&mesh->sections[i], mesh->size)) {
+            return 0;
+        }
+    }
+
+    struct IoMeshSection const *vertex_section = io_find_mesh_section(mesh, IO_MESH_SECTION_VERTEX_QUANTIZED);
+    uint32_t vertex_size = sizeof(struct VertexQuantized);
+    mesh->vertex_format = VERTEX_FORMAT_QUANTIZED;
+    if (!vertex_section) {
+        vertex_section = io_find_mesh_section(mesh, IO_MESH_SECTION_VERTEX);
+        vertex_size = sizeof(struct Vertex);
+        mesh->vertex_format = VERTEX_FORMAT_FLOAT;
+    }
+    if (!vertex_section || vertex_section->element_size != vertex_size) {
+        return 0;
+    }
+    mesh->vertex_count = vertex_section->size / vertex_size;
+    mesh->vertices = (char const *)mesh->base + vertex_section->offset;
+
+    struct IoMeshSection const *index_section = io_find_mesh_section(mesh, IO_MESH_SECTION_INDEX);
+    if (index_section) {
+        if (index_section->element_size != 2 && index_section->element_size != 4) {
+            return 0;
+        }
+        mesh->index_size = index_section->element_size;
+        mesh->index_count = index_section->size / index_section->element_size;
+        mesh->indices = (char const *)mesh->base + index_section->offset;
+    }
+
+    struct IoMeshSection const *bounds_section = io_find_mesh_section(mesh, IO_MESH_SECTION_BOUNDS);
+    if (bounds_section) {
+        if (bounds_section->element_size != sizeof *mesh->bounds) {
+            return 0;
+        }
+        mesh->bounds_count = bounds_section->size / sizeof *mesh->bounds;
+        mesh->bounds = (struct IoMeshBounds const *)((char const *)mesh->base + bounds_section->offset);
+    }
+
+    struct IoMeshSection const *node_section = io_find_mesh_section(mesh, IO_MESH_SECTION_BVH_NODE);
+    struct IoMeshSection const *primitive_section = io_find_mesh_section(mesh, IO_MESH_SECTION_BVH_PRIMITIVE);
+    if (!node_section != !primitive_section) {
+        return 0;
+    }
+    if (node_section) {
+        if (node_section->element_size != sizeof *mesh->bvh_nodes
+            || primitive_section->element_size != sizeof *mesh->bvh_primitives) {
+            return 0;
+        }
+        mesh->bvh_node_count = node_section->size / sizeof *mesh->bvh_nodes;
+        mesh->bvh_nodes = (struct BvhNode const *)((char const *)mesh->base + node_section->offset);
+        mesh->bvh_primitive_count = primitive_section->size / sizeof *mesh->bvh_primitives;
+        mesh->bvh_primitives = (uint32_t const *)((char const *)mesh->base + primitive_section->offset);
+    }
+
+    // quantized vertices mean nothing without the bounds they are relative to
+    if (mesh->vertex_format == VERTEX_FORMAT_QUANTIZED && !mesh->bounds_count) {
+        return 0;
+    }
+
+    return 1;
+}
+
+enum IoResult
+io_map_mesh(char const *path, struct IoMappedMesh *mesh)
+{
+    memset(mesh, 0, sizeof *mesh);
+    enum IoResult result = IO_RESULT_READ_FAILED;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        goto fail_open;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        goto fail_size;
+    }
+    if (file_size.QuadPart == 0) {
+        result = IO_RESULT_INVALID;
+        goto fail_size;
+    }
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping) {
+        goto fail_size;
+    }
+    void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!base) {
+        CloseHandle(mapping);
+        goto fail_size;
+    }
+    mesh->file_handle = file;
+    mesh->mapping_handle = mapping;
+    mesh->size = file_size.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file == -1) {
+        goto fail_open;
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat)) {
+        goto fail_size;
+    }
+    if (file_stat.st_size == 0) {
+        result = IO_RESULT_INVALID;
+        goto fail_size;
+    }
+    void *base = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (base == MAP_FAILED) {
+        goto fail_size;
+    }
+    // the mapping keeps the file referenced
+    close(file);
+    // the upload reads the file front to back exactly once
+    posix_madvise(base, file_stat.st_size, POSIX_MADV_SEQUENTIAL);
+    mesh->size = file_stat.st_size;
+#endif
+    mesh->base = base;
+
+    if (!parse_mesh(mesh)) {
+        io_unmap_mesh(mesh);
+        return IO_RESULT_INVALID;
+    }
+
+    return IO_RESULT_OK;
+
+  fail_size:
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
+    return result;
+  fail_open:
+    return IO_RESULT_NOT_FOUND;
+}
+
+enum IoResult
+io_view_mesh(void const *data, size_t const size, struct IoMappedMesh *mesh)
+{
+    memset(mesh, 0, sizeof *mesh);
+    if ((uintptr_t)data % IO_MESH_ALIGNMENT) {
+        return IO_RESULT_INVALID;
+    }
+    mesh->base = (void *)data;
+    mesh->size = size;
+    mesh->is_view = 1;
+
+    if (!parse_mesh(mesh)) {
+        memset(mesh, 0, sizeof *mesh);
+        return IO_RESULT_INVALID;
+    }
+
+    return IO_RESULT_OK;
+}
+
 void
-io_load_mesh(FILE *file, uint32_t *count, struct Vertex *vertices)
+io_unmap_mesh(struct IoMappedMesh *mesh)
 {
-    assert(file);
-    assert(count);
+    if (!mesh->base || mesh->is_view) {
+        memset(mesh, 0, sizeof *mesh);
+        return;
+    }
 
-    if (vertices)
-    {
-        fread(vertices, sizeof *vertices, *count, file);
+#ifdef _WIN32
+    UnmapViewOfFile(mesh->base);
+    CloseHandle(mesh->mapping_handle);
+    CloseHandle(mesh->file_handle);
+#else
+    munmap(mesh->base, mesh->size);
+#endif
+    memset(mesh, 0, sizeof *mesh);
+}
+
+enum IoResult
+io_verify_mesh(struct IoMappedMesh const *mesh)
+{
+    for (uint32_t i = 0; i < mesh->section_count; i++) {
+        struct IoMeshSection const *section = &mesh->sections[i];
+        if (io_crc32((uint8_t const *)mesh->base + section->offset, section->size) != section->checksum) {
+            return IO_RESULT_CORRUPT;
+        }
     }
-    else
-    {
-        fread(count, sizeof *count, 1, file);
+
+    // the gpu would read out of bounds for an index past the vertices
+    for (uint32_t i = 0; i < mesh->index_count; i++) {
+        uint32_t index;
+        if (mesh->index_size == 2) {
+            index = ((uint16_t const *)mesh->indices)[i];
+        } else {
+            index = ((uint32_t const *)mesh->indices)[i];
+        }
+        if (index >= mesh->vertex_count) {
+            return IO_RESULT_INVALID;
+        }
+    }
+
+    // traversals trust the node links and index the chunks with the leaves
+    uint32_t triangle_count = (mesh->index_count ? mesh->index_count : mesh->vertex_count) / 3;
+    uint32_t chunk_count = (triangle_count + BVH_CHUNK_TRIANGLE_COUNT - 1) / BVH_CHUNK_TRIANGLE_COUNT;
+    if (!bvh_validate(mesh->bvh_node_count, mesh->bvh_nodes, mesh->bvh_primitive_count, mesh->bvh_primitives, chunk_count)) {
+        return IO_RESULT_INVALID;
     }
+
+    return IO_RESULT_OK;
+}
+
+struct IoMeshSection const *
+io_find_mesh_section(struct IoMappedMesh const *mesh, enum IoMeshSectionType type)
+{
+    for (uint32_t i = 0; i < mesh->section_count; i++) {
+        if (mesh->sections[i].type == type) {
+            return &mesh->sections[i];
+        }
+    }
+
+    return 0;
 }
@@ -2,18 +2,28 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
 #include "game/io.h"
+#include "game/stream.h"
+#include "game/world.h"
 #include "graphics/graphics.h"
+#include "graphics/pack.h"
 #include "graphics/vertex.h"
 #include "common/linmath.h"
 #include "platform/platform.h"
 
+// the shaders and converted meshes packed together, see flicker-pack
+#define ASSET_PACK_PATH "./build/assets.pack"
+
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
 #endif
 
+// the camera stays this far from walls
+#define CAMERA_RADIUS 0.25f
+
 static struct UBO ubo;
 static float camera_pos[3] = {0.0f, 9.5f, 0.0f};
 static float camera_dir[3] = {0.0f, 0.0f, 1.0f};
@@ -26,21 +36,69 @@ static double xmouse_prev = 0.0f;
 static double ymouse_prev = 0.0f;
 static struct PlayerControlEvent control_event;
 
+// hands a streamed mesh to the renderer and the collision world, which both
+// copy it before returning, and places it at the origin
+static void
+load_streamed_mesh(struct StreamEvent *event)
+{
+    if (event->status != STREAM_STATUS_DONE) {
+        fprintf(stderr, "failed to stream mesh %" PRIu32 ": %s\n", event->handle, io_result_string(event->result));
+        return;
+    }
+
+    struct IoMappedMesh *mesh = &event->mesh;
+    struct GraphicsMesh graphics_mesh = {
+        .vertex_count = mesh->vertex_count,
+        .vertex_format = mesh->vertex_format,
+        .vertices = mesh->vertices,
+        .index_count = mesh->index_count,
+        .index_size = mesh->index_size,
+        .indices = mesh->indices,
+        .bvh_node_count = mesh->bvh_node_count,
+        .bvh_nodes = mesh->bvh_nodes,
+        .bvh_primitive_count = mesh->bvh_primitive_count,
+        .bvh_primitives = mesh->bvh_primitives,
+    };
+    if (mesh->bounds_count) {
+        memcpy(graphics_mesh.bounds_min, mesh->bounds[0].min, sizeof graphics_mesh.bounds_min);
+        memcpy(graphics_mesh.bounds_max, mesh->bounds[0].max, sizeof graphics_mesh.bounds_max);
+    }
+    uint32_t graphics_handle = graphics.register_mesh(&graphics_mesh);
+    if (!world_add_mesh(mesh)) {
+        fprintf(stderr, "mesh %" PRIu32 " has no bvh, the camera passes through it\n", event->handle);
+    }
+    io_unmap_mesh(mesh);
+    if (!graphics_handle) {
+        return;
+    }
+
+    float transform[4][4];
+    mat4_translation(transform, 0.0f, 0.0f, 0.0f);
+    if (!graphics.create_object(graphics_handle, transform)) {
+        fprintf(stderr, "failed to place mesh %" PRIu32 "\n", event->handle);
+    }
+}
+
 int
 main(void)
 {
     platform.create_window();
 
-    graphics.init();
+    struct GraphicsConfig config = {
+        .is_headless = 0,
+        .use_timeline_semaphore = 1,
+        .use_indirect_draws = 1,
+        .use_occlusion_culling = 1,
+    };
+    graphics.init(&config);
+    world_init();
 
-    char const *map1 = "asset/mesh/map1.vertex";
-    FILE *file = fopen(map1, "rb");
-    uint32_t vertex_count;
-    io_load_mesh(file, &vertex_count, 0);
-    struct Vertex *vertices = malloc(vertex_count * sizeof *vertices);
-    io_load_mesh(file, &vertex_count, vertices);
-
-    graphics.load_map(vertex_count, vertices);
+    // rendering starts right away, the map shows up once it has streamed in;
+    // loose files are used when the pack has not been built
+    struct IoPack pack;
+    int is_packed = io_map_pack(ASSET_PACK_PATH, &pack);
+    stream_init(1, is_packed ? &pack : 0);
+    stream_request_mesh(is_packed ? "map1.vertex" : "asset/mesh/map1.vertex");
 
     float cos_yaw = cosf(mouse_yaw);
     float sin_yaw = sinf(mouse_yaw);
@@ -63,15 +121,24 @@ main(void)
         float forward[3] = { sin_yaw, 0.0f, cos_yaw, };
         float strafe[3];
         vec3_cross(strafe, forward, up_dir);
-        vec3_add(camera_pos, forward[0] * control_event.forward_time * 0.0000001f, forward[1], forward[2] * control_event.forward_time * 0.0000001f);
-        vec3_add(camera_pos, strafe[0] * control_event.strafe_time * 0.0000001f, strafe[1], strafe[2] * control_event.strafe_time * 0.0000001f);
+        float move[3] = {
+            forward[0] * control_event.forward_time * 0.0000001f + strafe[0] * control_event.strafe_time * 0.0000001f,
+            forward[1] + strafe[1],
+            forward[2] * control_event.forward_time * 0.0000001f + strafe[2] * control_event.strafe_time * 0.0000001f,
+        };
+        world_move(camera_pos, move, CAMERA_RADIUS);
         mat4_view(ubo.view, camera_pos, cos_yaw, sin_yaw, cos_pitch, sin_pitch);
+
+        struct StreamEvent stream_event;
+        while (stream_poll(&stream_event)) {
+            load_streamed_mesh(&stream_event);
+        }
         graphics.draw_frame(&ubo);
     }
 
-    free(vertices);
-    fclose(file);
-
+    stream_deinit();
+    world_deinit();
+    io_unmap_pack(&pack);
     graphics.deinit();
 
     return EXIT_SUCCESS;
@@ -0,0 +1,214 @@
+#include "game/stream.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+struct StreamRequest {
+    uint32_t handle;
+    char *path;
+};
+
+// first..count of a growing array, compacted when it runs full
+struct StreamQueue {
+    uint32_t first;
+    uint32_t count;
+    uint32_t capacity;
+    size_t element_size;
+    void *elements;
+};
+
+static uint32_t thread_count;
+static thrd_t *threads;
+static struct IoPack const *pack;
+
+// guarded by mutex
+static mtx_t mutex;
+static cnd_t request_ready;
+static int is_running;
+static uint32_t next_handle;
+static struct StreamQueue requests;
+static struct StreamQueue events;
+
+/* Private Functions */
+
+static void
+push(struct StreamQueue *queue, void const *element)
+{
+    if (queue->first + queue->count == queue->capacity) {
+        if (queue->first) {
+            memmove(
+                queue->elements,
+                (char *)queue->elements + queue->first * queue->element_size,
+                queue->count * queue->element_size
+            );
+            queue->first = 0;
+        } else {
+            queue->capacity = queue->capacity ? 2 * queue->capacity : 16;
+            queue->elements = realloc(queue->elements, queue->capacity * queue->element_size);
+            assert(queue->elements);
+        }
+    }
+
+    memcpy(
+        (char *)queue->elements + (queue->first + queue->count) * queue->element_size,
+        element,
+        queue->element_size
+    );
+    queue->count += 1;
+}
+
+static int
+pop(struct StreamQueue *queue, void *element)
+{
+    if (!queue->count) {
+        return 0;
+    }
+
+    memcpy(element, (char *)queue->elements + queue->first * queue->element_size, queue->element_size);
+    queue->first += 1;
+    queue->count -= 1;
+    if (!queue->count) {
+        queue->first = 0;
+    }
+
+    return 1;
+}
+
+static void
+load_mesh(struct StreamRequest const *request, struct StreamEvent *event)
+{
+    event->handle = request->handle;
+    event->status = STREAM_STATUS_FAILED;
+    uint64_t offset;
+    uint64_t size;
+    if (pack && io_find_pack_entry(pack, request->path, &offset, &size)) {
+        event->result = io_view_mesh((char const *)pack->base + offset, size, &event->mesh);
+    } else {
+        event->result = io_map_mesh(request->path, &event->mesh);
+    }
+    if (event->result != IO_RESULT_OK) {
+        return;
+    }
+
+    // off the render thread the full verification is cheap enough to keep
+    // in release builds, and it leaves the whole file resident
+    event->result = io_verify_mesh(&event->mesh);
+    if (event->result != IO_RESULT_OK) {
+        io_unmap_mesh(&event->mesh);
+        return;
+    }
+
+    event->status = STREAM_STATUS_DONE;
+}
+
+static int
+run_stream(void *arg)
+{
+    (void)arg;
+    struct StreamRequest request;
+
+    mtx_lock(&mutex);
+    for (;;) {
+        while (is_running && !requests.count) {
+            cnd_wait(&request_ready, &mutex);
+        }
+        if (!is_running) {
+            break;
+        }
+        pop(&requests, &request);
+        mtx_unlock(&mutex);
+
+        struct StreamEvent event = {0};
+        load_mesh(&request, &event);
+        free(request.path);
+
+        mtx_lock(&mutex);
+        push(&events, &event);
+    }
+    mtx_unlock(&mutex);
+
+    return 0;
+}
+
+void
+stream_init(uint32_t count, struct IoPack const *asset_pack)
+{
+    pack = asset_pack;
+    thread_count = count ? count : 1;
+    threads = malloc(thread_count * sizeof *threads);
+    assert(threads);
+
+    requests = (struct StreamQueue){ .element_size = sizeof(struct StreamRequest) };
+    events = (struct StreamQueue){ .element_size = sizeof(struct StreamEvent) };
+    next_handle = 1;
+
+    mtx_init(&mutex, mtx_plain);
+    cnd_init(&request_ready);
+    is_running = 1;
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        int status = thrd_create(&threads[i], run_stream, 0);
+        assert(status == thrd_success);
+        (void)status;
+    }
+}
+
+void
+stream_deinit(void)
+{
+    mtx_lock(&mutex);
+    is_running = 0;
+    cnd_broadcast(&request_ready);
+    mtx_unlock(&mutex);
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        thrd_join(threads[i], 0);
+    }
+
+    struct StreamRequest request;
+    while (pop(&requests, &request)) {
+        free(request.path);
+    }
+    struct StreamEvent event;
+    while (pop(&events, &event)) {
+        if (event.status == STREAM_STATUS_DONE) {
+            io_unmap_mesh(&event.mesh);
+        }
+    }
+
+    cnd_destroy(&request_ready);
+    mtx_destroy(&mutex);
+    free(events.elements);
+    free(requests.elements);
+    free(threads);
+    pack = 0;
+}
+
+uint32_t
+stream_request_mesh(char const *path)
+{
+    size_t size = strlen(path) + 1;
+    struct StreamRequest request = { .path = malloc(size) };
+    assert(request.path);
+    memcpy(request.path, path, size);
+
+    mtx_lock(&mutex);
+    request.handle = next_handle++;
+    push(&requests, &request);
+    cnd_signal(&request_ready);
+    mtx_unlock(&mutex);
+
+    return request.handle;
+}
+
+int
+stream_poll(struct StreamEvent *event)
+{
+    mtx_lock(&mutex);
+    int is_polled = pop(&events, event);
+    mtx_unlock(&mutex);
+
+    return is_polled;
+}
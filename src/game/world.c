@@ -0,0 +1,249 @@
+#include "game/world.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/bvh.h"
+
+// walls a single move slides along before it stops
+#define MAX_SLIDE_COUNT 3
+
+struct WorldMesh {
+    uint32_t triangle_count;
+    float (*positions)[3];
+    uint32_t *indices;
+    uint32_t node_count;
+    struct BvhNode *nodes;
+    uint32_t *primitives;
+};
+
+struct RayQuery {
+    struct WorldMesh const *mesh;
+    uint32_t triangle;
+    float normal[3];
+};
+
+static uint32_t mesh_count;
+static uint32_t mesh_capacity;
+static struct WorldMesh *meshes;
+
+/* Private Functions */
+
+static float
+dot(float const a[3], float const b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void
+cross(float v[3], float const a[3], float const b[3])
+{
+    v[0] = a[1] * b[2] - a[2] * b[1];
+    v[1] = a[2] * b[0] - a[0] * b[2];
+    v[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Moller-Trumbore, shrinks *distance on a closer hit
+static int
+intersect_triangle(
+    struct RayQuery *query,
+    uint32_t const triangle,
+    float const origin[3],
+    float const direction[3],
+    float *distance)
+{
+    uint32_t const *indices = &query->mesh->indices[3 * triangle];
+    float const *a = query->mesh->positions[indices[0]];
+    float const *b = query->mesh->positions[indices[1]];
+    float const *c = query->mesh->positions[indices[2]];
+    float edge1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    float edge2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    float offset[3] = { origin[0] - a[0], origin[1] - a[1], origin[2] - a[2] };
+
+    float p[3];
+    cross(p, direction, edge2);
+    float determinant = dot(edge1, p);
+    // parallel to the triangle or degenerate
+    if (fabsf(determinant) < 1e-12f) {
+        return 0;
+    }
+    float u = dot(offset, p) / determinant;
+    if (u < 0.0f || u > 1.0f) {
+        return 0;
+    }
+    float q[3];
+    cross(q, offset, edge1);
+    float v = dot(direction, q) / determinant;
+    if (v < 0.0f || u + v > 1.0f) {
+        return 0;
+    }
+    float t = dot(edge2, q) / determinant;
+    if (t < 0.0f || t >= *distance) {
+        return 0;
+    }
+
+    *distance = t;
+    query->triangle = triangle;
+    cross(query->normal, edge1, edge2);
+    float length = sqrtf(dot(query->normal, query->normal));
+    float sign = dot(query->normal, direction) > 0.0f ? -1.0f : 1.0f;
+    for (int i = 0; i < 3; i++) {
+        query->normal[i] *= sign / length;
+    }
+
+    return 1;
+}
+
+static int
+intersect_chunk(void *context, uint32_t const chunk, float const origin[3], float const direction[3], float *distance)
+{
+    struct RayQuery *query = context;
+    uint32_t first = chunk * BVH_CHUNK_TRIANGLE_COUNT;
+    uint32_t end = first + BVH_CHUNK_TRIANGLE_COUNT;
+    end = end < query->mesh->triangle_count ? end : query->mesh->triangle_count;
+
+    int is_hit = 0;
+    for (uint32_t triangle = first; triangle < end; triangle++) {
+        is_hit |= intersect_triangle(query, triangle, origin, direction, distance);
+    }
+
+    return is_hit;
+}
+
+void
+world_init(void)
+{
+    mesh_count = 0;
+    mesh_capacity = 0;
+    meshes = 0;
+}
+
+void
+world_deinit(void)
+{
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        free(meshes[i].positions);
+        free(meshes[i].indices);
+        free(meshes[i].nodes);
+        free(meshes[i].primitives);
+    }
+    free(meshes);
+    meshes = 0;
+    mesh_count = 0;
+    mesh_capacity = 0;
+}
+
+uint32_t
+world_add_mesh(struct IoMappedMesh const *mesh)
+{
+    if (!mesh->bvh_node_count) {
+        return 0;
+    }
+
+    if (mesh_count == mesh_capacity) {
+        mesh_capacity = mesh_capacity ? 2 * mesh_capacity : 4;
+        meshes = realloc(meshes, mesh_capacity * sizeof *meshes);
+        assert(meshes);
+    }
+    struct WorldMesh *world_mesh = &meshes[mesh_count];
+
+    uint32_t element_count = mesh->index_count ? mesh->index_count : mesh->vertex_count;
+    *world_mesh = (struct WorldMesh){
+        .triangle_count = element_count / 3,
+        .positions = malloc((mesh->vertex_count ? mesh->vertex_count : 1) * sizeof *world_mesh->positions),
+        .indices = malloc((element_count ? element_count : 1) * sizeof *world_mesh->indices),
+        .node_count = mesh->bvh_node_count,
+        .nodes = malloc(mesh->bvh_node_count * sizeof *world_mesh->nodes),
+        .primitives = malloc((mesh->bvh_primitive_count ? mesh->bvh_primitive_count : 1) * sizeof *world_mesh->primitives),
+    };
+    assert(world_mesh->positions && world_mesh->indices && world_mesh->nodes && world_mesh->primitives);
+    memcpy(world_mesh->nodes, mesh->bvh_nodes, mesh->bvh_node_count * sizeof *world_mesh->nodes);
+    memcpy(world_mesh->primitives, mesh->bvh_primitives, mesh->bvh_primitive_count * sizeof *world_mesh->primitives);
+
+    for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+        float *pos = world_mesh->positions[v];
+        if (mesh->vertex_format == VERTEX_FORMAT_QUANTIZED) {
+            // the same mapping as the vertex shader's
+            struct VertexQuantizedPos const *stored = &((struct VertexQuantized const *)mesh->vertices)[v].pos;
+            int16_t const values[3] = { stored->x, stored->y, stored->z };
+            for (int i = 0; i < 3; i++) {
+                float low = mesh->bounds[0].min[i];
+                float high = mesh->bounds[0].max[i];
+                pos[i] = fmaxf(values[i] / 32767.0f, -1.0f) * 0.5f * (high - low) + 0.5f * (low + high);
+            }
+        } else {
+            struct VertexPos const *stored = &((struct Vertex const *)mesh->vertices)[v].pos;
+            pos[0] = stored->x;
+            pos[1] = stored->y;
+            pos[2] = stored->z;
+        }
+    }
+
+    for (uint32_t i = 0; i < element_count; i++) {
+        if (!mesh->index_count) {
+            world_mesh->indices[i] = i;
+        } else if (mesh->index_size == 2) {
+            world_mesh->indices[i] = ((uint16_t const *)mesh->indices)[i];
+        } else {
+            world_mesh->indices[i] = ((uint32_t const *)mesh->indices)[i];
+        }
+    }
+
+    return ++mesh_count;
+}
+
+int
+world_cast_ray(float const origin[3], float const direction[3], float const max_distance, struct WorldHit *hit)
+{
+    float distance = max_distance;
+    int is_hit = 0;
+
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        struct WorldMesh const *mesh = &meshes[i];
+        struct RayQuery query = { .mesh = mesh };
+        if (bvh_cast_ray(mesh->node_count, mesh->nodes, mesh->primitives, origin, direction, &distance, intersect_chunk, &query)) {
+            is_hit = 1;
+            hit->distance = distance;
+            memcpy(hit->normal, query.normal, sizeof hit->normal);
+            hit->mesh = i + 1;
+            hit->triangle = query.triangle;
+        }
+    }
+
+    return is_hit;
+}
+
+void
+world_move(float position[3], float const delta[3], float const radius)
+{
+    float remaining[3] = { delta[0], delta[1], delta[2] };
+
+    for (int slide = 0; slide < MAX_SLIDE_COUNT; slide++) {
+        float length = sqrtf(dot(remaining, remaining));
+        if (length <= 0.0f) {
+            return;
+        }
+        float direction[3] = { remaining[0] / length, remaining[1] / length, remaining[2] / length };
+
+        struct WorldHit hit;
+        if (!world_cast_ray(position, direction, length + radius, &hit)) {
+            for (int i = 0; i < 3; i++) {
+                position[i] += remaining[i];
+            }
+            return;
+        }
+
+        float travel = hit.distance - radius > 0.0f ? hit.distance - radius : 0.0f;
+        for (int i = 0; i < 3; i++) {
+            position[i] += direction[i] * travel;
+            remaining[i] -= direction[i] * travel;
+        }
+        // what is left of the move runs along the wall
+        float into_wall = dot(remaining, hit.normal);
+        for (int i = 0; i < 3; i++) {
+            remaining[i] -= hit.normal[i] * into_wall;
+        }
+    }
+}
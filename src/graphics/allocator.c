@@ -0,0 +1,342 @@
+#include "graphics/allocator.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Memory is requested from the driver in large blocks per memory type and
+// sub-allocated with a sorted, coalescing free list. Everything runs on the
+// render thread so no locking is done.
+
+#define DEFAULT_BLOCK_SIZE (64ull * 1024 * 1024)
+// heaps at or below this size (integrated / bar memory) get smaller blocks
+#define SMALL_HEAP_SIZE (1024ull * 1024 * 1024)
+
+struct GfxFreeRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+struct GfxBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used_size;
+    uint32_t memory_type;
+    // linear (buffer) and optimal (image) resources are kept in separate
+    // blocks when bufferImageGranularity would otherwise force padding
+    int is_linear;
+    void *mapped;
+    uint32_t allocation_count;
+    uint32_t free_range_count;
+    uint32_t free_range_capacity;
+    struct GfxFreeRange *free_ranges;
+};
+
+static VkResult result;
+static VkDevice device;
+static VkPhysicalDeviceMemoryProperties memory_properties;
+static VkDeviceSize buffer_image_granularity;
+static uint32_t max_block_count;
+static uint32_t block_count;
+static uint32_t block_capacity;
+static struct GfxBlock **blocks;
+
+static VkDeviceSize
+align_up(VkDeviceSize const value, VkDeviceSize const alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static VkDeviceSize
+get_block_size(uint32_t const memory_type)
+{
+    uint32_t heap = memory_properties.memoryTypes[memory_type].heapIndex;
+    VkDeviceSize heap_size = memory_properties.memoryHeaps[heap].size;
+
+    return heap_size <= SMALL_HEAP_SIZE ? heap_size / 8 : DEFAULT_BLOCK_SIZE;
+}
+
+static void
+insert_free_range(struct GfxBlock *block, uint32_t const index, struct GfxFreeRange const range)
+{
+    if (block->free_range_count == block->free_range_capacity) {
+        block->free_range_capacity = block->free_range_capacity ? 2 * block->free_range_capacity : 8;
+        block->free_ranges = realloc(block->free_ranges, block->free_range_capacity * sizeof *block->free_ranges);
+        assert(block->free_ranges);
+    }
+
+    memmove(
+        &block->free_ranges[index + 1],
+        &block->free_ranges[index],
+        (block->free_range_count - index) * sizeof *block->free_ranges
+    );
+    block->free_ranges[index] = range;
+    block->free_range_count += 1;
+}
+
+static void
+remove_free_range(struct GfxBlock *block, uint32_t const index)
+{
+    block->free_range_count -= 1;
+    memmove(
+        &block->free_ranges[index],
+        &block->free_ranges[index + 1],
+        (block->free_range_count - index) * sizeof *block->free_ranges
+    );
+}
+
+static struct GfxBlock *
+create_block(uint32_t const memory_type, int const is_linear, VkDeviceSize const size)
+{
+    assert(block_count < max_block_count);
+
+    struct GfxBlock *block = calloc(1, sizeof *block);
+    assert(block);
+
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+    result = vkAllocateMemory(device, &alloc_info, 0, &block->memory);
+    assert(result == VK_SUCCESS);
+
+    if (memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+        assert(result == VK_SUCCESS);
+    }
+
+    block->size = size;
+    block->memory_type = memory_type;
+    block->is_linear = is_linear;
+    insert_free_range(block, 0, (struct GfxFreeRange){ .offset = 0, .size = size });
+
+    if (block_count == block_capacity) {
+        block_capacity = block_capacity ? 2 * block_capacity : 8;
+        blocks = realloc(blocks, block_capacity * sizeof *blocks);
+        assert(blocks);
+    }
+    blocks[block_count++] = block;
+
+    return block;
+}
+
+static void
+destroy_block(struct GfxBlock *block)
+{
+    for (uint32_t i = 0; i < block_count; i++) {
+        if (blocks[i] == block) {
+            blocks[i] = blocks[--block_count];
+            break;
+        }
+    }
+
+    if (block->mapped) {
+        vkUnmapMemory(device, block->memory);
+    }
+    vkFreeMemory(device, block->memory, 0);
+    free(block->free_ranges);
+    free(block);
+}
+
+// first fit, the space skipped for alignment stays in the free list
+static int
+allocate_from_block(
+    struct GfxBlock *block,
+    VkDeviceSize const size,
+    VkDeviceSize const alignment,
+    struct GfxAllocation *allocation)
+{
+    for (uint32_t i = 0; i < block->free_range_count; i++) {
+        struct GfxFreeRange range = block->free_ranges[i];
+        VkDeviceSize offset = align_up(range.offset, alignment);
+        VkDeviceSize padding = offset - range.offset;
+        if (padding + size > range.size) {
+            continue;
+        }
+
+        VkDeviceSize tail = range.size - padding - size;
+        if (padding) {
+            block->free_ranges[i].size = padding;
+            i += 1;
+        } else {
+            remove_free_range(block, i);
+        }
+        if (tail) {
+            insert_free_range(block, i, (struct GfxFreeRange){ .offset = offset + size, .size = tail });
+        }
+
+        block->used_size += size;
+        block->allocation_count += 1;
+
+        allocation->block = block;
+        allocation->memory = block->memory;
+        allocation->offset = offset;
+        allocation->size = size;
+        allocation->mapped = block->mapped ? (char *)block->mapped + offset : 0;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+allocate(
+    VkMemoryRequirements const *requirements,
+    VkMemoryPropertyFlags const flags,
+    int const is_linear,
+    struct GfxAllocation *allocation)
+{
+    uint32_t memory_type = gfx_get_memory_type(requirements->memoryTypeBits, flags);
+    // with a granularity of 1 buffers and images can share pages freely
+    int kind = buffer_image_granularity > 1 ? is_linear : 1;
+
+    for (uint32_t i = 0; i < block_count; i++) {
+        if (blocks[i]->memory_type != memory_type || blocks[i]->is_linear != kind) {
+            continue;
+        }
+        if (allocate_from_block(blocks[i], requirements->size, requirements->alignment, allocation)) {
+            return;
+        }
+    }
+
+    // resources larger than a block get a block of their own
+    VkDeviceSize size = get_block_size(memory_type);
+    if (requirements->size > size) {
+        size = requirements->size;
+    }
+
+    struct GfxBlock *block = create_block(memory_type, kind, size);
+    int is_allocated = allocate_from_block(block, requirements->size, requirements->alignment, allocation);
+    assert(is_allocated);
+}
+
+void
+gfx_allocator_init(VkPhysicalDevice physical_device, VkDevice logical_device)
+{
+    device = logical_device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    buffer_image_granularity = properties.limits.bufferImageGranularity;
+    max_block_count = properties.limits.maxMemoryAllocationCount;
+}
+
+void
+gfx_allocator_deinit(void)
+{
+    while (block_count) {
+        destroy_block(blocks[block_count - 1]);
+    }
+    free(blocks);
+    blocks = 0;
+    block_capacity = 0;
+}
+
+uint32_t
+gfx_get_memory_type(uint32_t type_filter, VkMemoryPropertyFlags flags)
+{
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+    {
+        uint32_t is_type_filter_present = type_filter & (1 << i);
+        uint32_t is_flags_present = (memory_properties.memoryTypes[i].propertyFlags & flags) == flags;
+        if (is_type_filter_present && is_flags_present)
+        {
+            return i;
+        }
+    }
+
+    assert(0);
+    return UINT32_MAX;
+}
+
+void
+gfx_allocate_buffer_memory(VkBuffer buffer, VkMemoryPropertyFlags flags, struct GfxAllocation *allocation)
+{
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer, &requirements);
+    allocate(&requirements, flags, 1, allocation);
+
+    result = vkBindBufferMemory(device, buffer, allocation->memory, allocation->offset);
+    assert(result == VK_SUCCESS);
+}
+
+void
+gfx_allocate_image_memory(VkImage image, VkMemoryPropertyFlags flags, struct GfxAllocation *allocation)
+{
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image, &requirements);
+    allocate(&requirements, flags, 0, allocation);
+
+    result = vkBindImageMemory(device, image, allocation->memory, allocation->offset);
+    assert(result == VK_SUCCESS);
+}
+
+void
+gfx_free(struct GfxAllocation *allocation)
+{
+    struct GfxBlock *block = allocation->block;
+    if (!block) {
+        return;
+    }
+
+    VkDeviceSize begin = allocation->offset;
+    VkDeviceSize end = allocation->offset + allocation->size;
+
+    uint32_t i = 0;
+    while (i < block->free_range_count && block->free_ranges[i].offset < begin) {
+        i += 1;
+    }
+
+    // coalesce with the neighbouring free ranges
+    int is_prev_adjacent = i > 0 && block->free_ranges[i - 1].offset + block->free_ranges[i - 1].size == begin;
+    int is_next_adjacent = i < block->free_range_count && block->free_ranges[i].offset == end;
+    if (is_prev_adjacent && is_next_adjacent) {
+        block->free_ranges[i - 1].size += allocation->size + block->free_ranges[i].size;
+        remove_free_range(block, i);
+    } else if (is_prev_adjacent) {
+        block->free_ranges[i - 1].size += allocation->size;
+    } else if (is_next_adjacent) {
+        block->free_ranges[i].offset = begin;
+        block->free_ranges[i].size += allocation->size;
+    } else {
+        insert_free_range(block, i, (struct GfxFreeRange){ .offset = begin, .size = allocation->size });
+    }
+
+    block->used_size -= allocation->size;
+    block->allocation_count -= 1;
+    memset(allocation, 0, sizeof *allocation);
+
+    // empty blocks are released unless they are the last block of their
+    // memory type, which is kept around to avoid allocation churn
+    if (block->allocation_count == 0) {
+        for (uint32_t j = 0; j < block_count; j++) {
+            if (blocks[j] != block && blocks[j]->memory_type == block->memory_type && blocks[j]->is_linear == block->is_linear) {
+                destroy_block(block);
+                break;
+            }
+        }
+    }
+}
+
+void
+gfx_allocator_get_stats(struct GfxAllocatorStats *stats)
+{
+    memset(stats, 0, sizeof *stats);
+    stats->block_count = block_count;
+    stats->max_block_count = max_block_count;
+
+    for (uint32_t i = 0; i < block_count; i++) {
+        stats->allocation_count += blocks[i]->allocation_count;
+        stats->block_size += blocks[i]->size;
+        stats->used_size += blocks[i]->used_size;
+        for (uint32_t j = 0; j < blocks[i]->free_range_count; j++) {
+            if (blocks[i]->free_ranges[j].size > stats->largest_free_size) {
+                stats->largest_free_size = blocks[i]->free_ranges[j].size;
+            }
+        }
+    }
+}
@@ -0,0 +1,219 @@
+#include "graphics/cull.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_KERNEL_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_KERNEL_SSE
+#endif
+
+// A box is outside when it lies entirely behind one plane: its center's
+// distance to the plane plus its extent projected onto the plane normal is
+// negative.
+
+#define CULL_ALIGNMENT 32
+
+void
+gfx_init_cull_boxes(uint32_t const count, struct GfxCullBoxes *boxes)
+{
+    uint32_t capacity = (count + GFX_CULL_BOX_PADDING - 1) / GFX_CULL_BOX_PADDING * GFX_CULL_BOX_PADDING;
+    if (!capacity) {
+        capacity = GFX_CULL_BOX_PADDING;
+    }
+    // 6 arrays of a multiple of 8 floats keep each array 32 byte aligned
+    size_t size = 6 * (size_t)capacity * sizeof(float);
+#ifdef _WIN32
+    float *storage = _aligned_malloc(size, CULL_ALIGNMENT);
+#else
+    float *storage = aligned_alloc(CULL_ALIGNMENT, size);
+#endif
+    assert(storage);
+    memset(storage, 0, size);
+
+    boxes->count = count;
+    boxes->capacity = capacity;
+    for (int i = 0; i < 3; i++) {
+        boxes->center[i] = storage + i * capacity;
+        boxes->extent[i] = storage + (3 + i) * capacity;
+    }
+}
+
+void
+gfx_free_cull_boxes(struct GfxCullBoxes *boxes)
+{
+#ifdef _WIN32
+    _aligned_free(boxes->center[0]);
+#else
+    free(boxes->center[0]);
+#endif
+    memset(boxes, 0, sizeof *boxes);
+}
+
+void
+gfx_set_cull_box(struct GfxCullBoxes *boxes, uint32_t const index, float const min[3], float const max[3])
+{
+    assert(index < boxes->count);
+    for (int i = 0; i < 3; i++) {
+        boxes->center[i][index] = 0.5f * (min[i] + max[i]);
+        boxes->extent[i][index] = 0.5f * (max[i] - min[i]);
+    }
+}
+
+uint32_t
+gfx_cull_boxes_scalar(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible)
+{
+    uint32_t visible_count = 0;
+    for (uint32_t i = 0; i < boxes->count; i++) {
+        int is_inside = 1;
+        for (int p = 0; p < 6 && is_inside; p++) {
+            float distance = planes[p][0] * boxes->center[0][i]
+                + planes[p][1] * boxes->center[1][i]
+                + planes[p][2] * boxes->center[2][i]
+                + planes[p][3];
+            float radius = fabsf(planes[p][0]) * boxes->extent[0][i]
+                + fabsf(planes[p][1]) * boxes->extent[1][i]
+                + fabsf(planes[p][2]) * boxes->extent[2][i];
+            is_inside = distance >= -radius;
+        }
+        visible[visible_count] = i;
+        visible_count += is_inside;
+    }
+
+    return visible_count;
+}
+
+#if defined(CULL_KERNEL_AVX)
+uint32_t
+gfx_cull_boxes(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible)
+{
+    __m256 normals[6][3];
+    __m256 abs_normals[6][3];
+    __m256 distances[6];
+    for (int p = 0; p < 6; p++) {
+        for (int i = 0; i < 3; i++) {
+            normals[p][i] = _mm256_set1_ps(planes[p][i]);
+            abs_normals[p][i] = _mm256_set1_ps(fabsf(planes[p][i]));
+        }
+        distances[p] = _mm256_set1_ps(planes[p][3]);
+    }
+
+    uint32_t visible_count = 0;
+    for (uint32_t i = 0; i < boxes->count; i += 8) {
+        __m256 cx = _mm256_load_ps(&boxes->center[0][i]);
+        __m256 cy = _mm256_load_ps(&boxes->center[1][i]);
+        __m256 cz = _mm256_load_ps(&boxes->center[2][i]);
+        __m256 ex = _mm256_load_ps(&boxes->extent[0][i]);
+        __m256 ey = _mm256_load_ps(&boxes->extent[1][i]);
+        __m256 ez = _mm256_load_ps(&boxes->extent[2][i]);
+
+        __m256 is_inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(normals[p][0], cx), _mm256_mul_ps(normals[p][1], cy)),
+                _mm256_add_ps(_mm256_mul_ps(normals[p][2], cz), distances[p])
+            );
+            __m256 radius = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(abs_normals[p][0], ex), _mm256_mul_ps(abs_normals[p][1], ey)),
+                _mm256_mul_ps(abs_normals[p][2], ez)
+            );
+            // distance >= -radius
+            is_inside = _mm256_and_ps(is_inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        uint32_t mask = _mm256_movemask_ps(is_inside);
+        uint32_t remaining = boxes->count - i;
+        if (remaining < 8) {
+            mask &= (1u << remaining) - 1;
+        }
+        for (uint32_t j = 0; j < 8; j++) {
+            visible[visible_count] = i + j;
+            visible_count += (mask >> j) & 1;
+        }
+    }
+
+    return visible_count;
+}
+
+char const *
+gfx_cull_kernel_name(void)
+{
+    return "avx";
+}
+#elif defined(CULL_KERNEL_SSE)
+uint32_t
+gfx_cull_boxes(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible)
+{
+    __m128 normals[6][3];
+    __m128 abs_normals[6][3];
+    __m128 distances[6];
+    for (int p = 0; p < 6; p++) {
+        for (int i = 0; i < 3; i++) {
+            normals[p][i] = _mm_set1_ps(planes[p][i]);
+            abs_normals[p][i] = _mm_set1_ps(fabsf(planes[p][i]));
+        }
+        distances[p] = _mm_set1_ps(planes[p][3]);
+    }
+
+    uint32_t visible_count = 0;
+    for (uint32_t i = 0; i < boxes->count; i += 4) {
+        __m128 cx = _mm_load_ps(&boxes->center[0][i]);
+        __m128 cy = _mm_load_ps(&boxes->center[1][i]);
+        __m128 cz = _mm_load_ps(&boxes->center[2][i]);
+        __m128 ex = _mm_load_ps(&boxes->extent[0][i]);
+        __m128 ey = _mm_load_ps(&boxes->extent[1][i]);
+        __m128 ez = _mm_load_ps(&boxes->extent[2][i]);
+
+        __m128 is_inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(normals[p][0], cx), _mm_mul_ps(normals[p][1], cy)),
+                _mm_add_ps(_mm_mul_ps(normals[p][2], cz), distances[p])
+            );
+            __m128 radius = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(abs_normals[p][0], ex), _mm_mul_ps(abs_normals[p][1], ey)),
+                _mm_mul_ps(abs_normals[p][2], ez)
+            );
+            // distance >= -radius
+            is_inside = _mm_and_ps(is_inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+
+        uint32_t mask = _mm_movemask_ps(is_inside);
+        uint32_t remaining = boxes->count - i;
+        if (remaining < 4) {
+            mask &= (1u << remaining) - 1;
+        }
+        for (uint32_t j = 0; j < 4; j++) {
+            visible[visible_count] = i + j;
+            visible_count += (mask >> j) & 1;
+        }
+    }
+
+    return visible_count;
+}
+
+char const *
+gfx_cull_kernel_name(void)
+{
+    return "sse";
+}
+#else
+uint32_t
+gfx_cull_boxes(float const planes[6][4], struct GfxCullBoxes const *boxes, uint32_t *visible)
+{
+    return gfx_cull_boxes_scalar(planes, boxes, visible);
+}
+
+char const *
+gfx_cull_kernel_name(void)
+{
+    return "scalar";
+}
+#endif
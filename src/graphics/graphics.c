@@ -1,66 +1,402 @@
 #include <volk/volk.h>
 
 #include <assert.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "common/bvh.h"
+#include "common/linmath.h"
+#include "graphics/allocator.h"
+#include "graphics/cull.h"
 #include "graphics/graphics.h"
 #include "graphics/io.h"
+#include "graphics/pack.h"
+#include "graphics/recorder.h"
+#include "graphics/resource.h"
 #include "graphics/triangles.h"
 #include "graphics/vertex.h"
 #include "platform/platform.h"
 
-#define MAX_FRAMES_IN_FLIGHT 2
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 3
+// written next to the compiled shaders
+#define PIPELINE_CACHE_PATH "./build/pipeline.cache"
+// built with the shaders, which are read from it when it is there
+#define ASSET_PACK_PATH "./build/assets.pack"
+// vertices per draw item when the config does not set it, a multiple of 3
+#define DEFAULT_DRAW_ITEM_VERTEX_COUNT (3 * 1024)
+#define DEFAULT_MESH_ARENA_SIZE (64ull * 1024 * 1024)
+#define DEFAULT_MAX_OBJECT_COUNT (16 * 1024)
+// one per vertex format and index type, unindexed meshes included
+#define DRAW_STATE_COUNT (VERTEX_FORMAT_COUNT * 3)
+// local_size_x of the cull shader
+#define CULL_GROUP_SIZE 64
+// local_size_x and local_size_y of the depth pyramid shader
+#define DEPTH_PYRAMID_GROUP_SIZE 8
+// levels halving a 65536 pixel framebuffer down to one texel
+#define MAX_DEPTH_PYRAMID_LEVEL_COUNT 16
+
+// elements (indices, or vertices for unindexed meshes) per chunk culled on
+// the cpu, the chunks mesh BVHs are built over
+#define CULL_CHUNK_ELEMENT_COUNT (3 * BVH_CHUNK_TRIANGLE_COUNT)
+// five words, so indexed and plain indirect commands share a stride
+#define INDIRECT_COMMAND_STRIDE (5 * sizeof(uint32_t))
+
+// present fences came after the bundled headers
+#ifndef VK_EXT_swapchain_maintenance1
+#define VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME "VK_EXT_surface_maintenance1"
+#define VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME "VK_EXT_swapchain_maintenance1"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT ((VkStructureType)1000275000)
+#define VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT ((VkStructureType)1000275001)
+
+typedef struct VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT {
+    VkStructureType sType;
+    void *pNext;
+    VkBool32 swapchainMaintenance1;
+} VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT;
+
+typedef struct VkSwapchainPresentFenceInfoEXT {
+    VkStructureType sType;
+    void const *pNext;
+    uint32_t swapchainCount;
+    VkFence const *pFences;
+} VkSwapchainPresentFenceInfoEXT;
+#endif
 
 /* Private Structures */
 struct GfxPhysicalDevice {
     VkPhysicalDevice gpu;
     uint32_t graphics_family_index;
     VkQueueFamilyProperties graphics_family_properties;
+    // a transfer only family when the device has one, else the graphics family
+    uint32_t transfer_family_index;
+    float timestamp_period;
+    VkDeviceSize min_uniform_buffer_offset_alignment;
+    VkDeviceSize min_storage_buffer_offset_alignment;
+    int is_timeline_semaphore_supported;
+    // multi draw indirect with a first instance, and compute on the graphics
+    // family for the cull pass
+    int is_indirect_draw_supported;
+    int is_draw_indirect_count_supported;
+    uint32_t max_draw_indirect_count;
+    // a fence per present, signaled once the presentation engine is done
+    // with the image and the swapchain
+    int is_present_fence_supported;
+    // identify the driver a pipeline cache was written by
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+};
+
+enum GfxRetiredType {
+    GFX_RETIRED_RESOURCE,
+    GFX_RETIRED_IMAGE,
+    GFX_RETIRED_IMAGE_VIEW,
+    GFX_RETIRED_FRAMEBUFFER,
+    GFX_RETIRED_SWAPCHAIN,
+    GFX_RETIRED_DESCRIPTOR_POOL,
+};
+
+// an object destroyed once the gpu timeline passes value
+struct GfxRetired {
+    uint64_t value;
+    enum GfxRetiredType type;
+    union {
+        struct GfxResource resource;
+        struct {
+            VkImage handle;
+            struct GfxAllocation allocation;
+        } image;
+        VkImageView image_view;
+        VkFramebuffer framebuffer;
+        VkSwapchainKHR swapchain;
+        VkDescriptorPool descriptor_pool;
+    };
+};
+
+// a swapchain replaced by a newer one, images may still be presented from it
+struct GfxOldSwapchain {
+    VkSwapchainKHR handle;
+    // the last present to it
+    uint64_t present_value;
+};
+
+// A frame is one render pass, or with occlusion culling the early pass and
+// the late pass continuing it after the depth pyramid is built.
+enum GfxRenderPassType {
+    GFX_RENDER_PASS_FULL,
+    GFX_RENDER_PASS_EARLY,
+    GFX_RENDER_PASS_LATE,
+};
+
+// matches the PHASE_ constants of the cull shader
+enum GfxCullPhase {
+    // frustum culling only
+    GFX_CULL_PHASE_FRUSTUM,
+    // draws the objects visible in the last late phase
+    GFX_CULL_PHASE_EARLY,
+    // tests every object against the depth pyramid, records which are
+    // visible and draws those the early phase did not
+    GFX_CULL_PHASE_LATE,
+};
+
+// Maps the stored attributes back to model space as value * scale + offset.
+// Float vertices use the identity.
+struct GfxDequantize {
+    float pos_scale[4];
+    float pos_offset[4];
+    float centroid_scale[4];
+    float centroid_offset[4];
+};
+
+// std430 layout of the shaders' Object. Everything but the model matrix is
+// the same for all objects of a mesh, but repeating it keeps a draw down to
+// its instance index and the cull pass down to one record per object.
+struct GfxObjectRecord {
+    float model[4][4];
+    struct GfxDequantize dequantize;
+    // the mesh bounds in model space
+    float bounds_center[4];
+    float bounds_extent[4];
+    // the mesh's draw, as in struct GfxDrawItem
+    uint32_t count;
+    uint32_t first;
+    int32_t vertex_offset;
+    uint32_t is_indexed;
+    uint32_t state;
+    // first indirect command of the state's range
+    uint32_t first_command;
+    // the object's slot, its visibility survives rebuilding the draw list
+    uint32_t slot;
+    uint32_t padding[1];
 };
 
-struct GfxResource {
-    VkBuffer buffer;
-    VkDeviceMemory memory;
+// the uniform block as the cull shader sees it, the vertex shader reads the
+// leading struct UBO only
+struct GfxUniforms {
+    struct UBO ubo;
+    float frustum_planes[6][4];
+};
+
+struct GfxCullConstants {
+    uint32_t object_count;
+    uint32_t is_compacting;
+    // in words into the indirect buffer
+    uint32_t count_base;
+    uint32_t command_base;
+    uint32_t phase;
+    // in words into the indirect buffer
+    uint32_t visibility_base;
+    uint32_t pyramid_level_count;
+    // of the framebuffer
+    uint32_t width;
+    uint32_t height;
+};
+
+// What the cull pass recorded ahead of the render pass needs.
+struct GfxCullInfo {
+    VkPipeline pipeline;
+    VkPipelineLayout pipeline_layout;
+    VkDescriptorSet descriptor_set;
+    VkDescriptorSet depth_pyramid_set;
+    uint32_t uniform_offset;
+    uint32_t object_offset;
+    VkBuffer indirect_buffer;
+    VkDeviceSize count_offset;
+    // cleared before the first early phase, no object was visible before it
+    int is_visibility_reset;
+    VkDeviceSize visibility_offset;
+    VkDeviceSize visibility_size;
+    struct GfxCullConstants constants;
+};
+
+// The farthest depth of the early phase's draws, level 0 at half the
+// framebuffer size and every level half the one below, rounded down like
+// mip levels, down to a single texel. Rebuilt every frame, so it only lives as long as the extent.
+struct GfxDepthPyramid {
+    VkImage image;
+    struct GfxAllocation allocation;
+    uint32_t level_count;
+    VkExtent2D level_extents[MAX_DEPTH_PYRAMID_LEVEL_COUNT];
+    // every level, read by the cull pass
+    VkImageView view;
+    VkImageView level_views[MAX_DEPTH_PYRAMID_LEVEL_COUNT];
+    // holds the sets below
+    VkDescriptorPool descriptor_pool;
+    // per level, reads the level below, or the depth attachment for level 0,
+    // and writes the level
+    VkDescriptorSet level_sets[MAX_DEPTH_PYRAMID_LEVEL_COUNT];
+    VkDescriptorSet cull_set;
+};
+
+// A registered mesh, its vertices and indices live in the mesh arena.
+struct GfxMesh {
+    // set once the upload has finished
+    int is_ready;
+    enum VertexFormat vertex_format;
+    // every object record of the mesh starts as a copy of this one
+    struct GfxObjectRecord record;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    VkIndexType index_type;
+    // of the first vertex and index in the arena, in elements
+    int32_t vertex_offset;
+    uint32_t first_index;
+    // objects drawing the mesh, drawn as instances first_instance onwards
+    uint32_t object_count;
+    uint32_t first_instance;
+    // model space bounds of every CULL_CHUNK_ELEMENT_COUNT elements
+    struct GfxCullBoxes chunks;
+    // copied from the registered mesh, 0 nodes tests the chunks one by one
+    uint32_t bvh_node_count;
+    struct BvhNode *bvh_nodes;
+    uint32_t *bvh_primitives;
+};
+
+struct GfxObject {
+    int is_alive;
+    uint32_t mesh;
+    // next free slot while the object is not alive
+    uint32_t next_free;
+    float transform[4][4];
+};
+
+struct GfxUpload {
+    uint32_t mesh;
+    struct GfxResource staging;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
 };
 
 /* Private Data */
 static VkResult result;
+static int is_headless;
 static VkInstance instance;
 static VkSurfaceKHR surface;
 static struct GfxPhysicalDevice physical_device;
 static VkDevice device;
 static VkQueue graphics_queue;
+static VkQueue transfer_queue;
 static VkSurfaceFormatKHR surface_format;
 static VkExtent2D extent;
 static VkSwapchainKHR swapchain;
 static uint32_t swapchain_length;
 static VkImage *swapchain_images;
 static VkImageView *swapchain_image_views;
+static struct GfxAllocation *offscreen_image_allocations;
 static VkCommandPool graphics_command_pool;
+static VkCommandPool transfer_command_pool;
 static VkDescriptorPool descriptor_pool;
 static VkSemaphore *is_image_available_semaphore;
 static VkSemaphore *is_present_ready_semaphore;
 static VkFence *is_main_render_done;
+// timeline value of the last submission rendering to each swapchain image
+static uint64_t *images_in_flight;
+static uint32_t frames_in_flight;
+// Every graphics submission signals the next value of one monotonically
+// increasing timeline. With timeline semaphores it is a real semaphore,
+// otherwise the per frame fences stand in for it.
+static int is_timeline_enabled;
+static VkSemaphore timeline;
+static uint64_t submit_value;
+// value signaled by the last submission of each frame slot
+static uint64_t *frame_values;
+static uint32_t retired_count;
+static uint32_t retired_capacity;
+static struct GfxRetired *retired;
+// Presents are counted like submissions. With present fences every frame
+// slot fences its present, else old swapchains wait for a present from the
+// new one instead.
+static int is_present_fence_enabled;
+static VkFence *is_present_done;
+static uint64_t present_value;
+// present value of the last present of each frame slot
+static uint64_t *present_values;
+static uint32_t old_swapchain_count;
+static uint32_t old_swapchain_capacity;
+static struct GfxOldSwapchain *old_swapchains;
 static VkDescriptorSetLayout descriptor_layout;
 static VkPipelineLayout pipeline_layout;
 static VkRenderPass render_pass;
-static VkBuffer vertex_buffer;
-static VkDeviceMemory vertex_memory;
-static struct GfxResource *uniform_resources;
-static VkDescriptorSet *descriptor_sets;
+// vertices and indices of every mesh, allocated front to back
+static struct GfxResource mesh_arena;
+static VkDeviceSize mesh_arena_size;
+static VkDeviceSize mesh_arena_used;
+static uint32_t mesh_count;
+static uint32_t mesh_capacity;
+static struct GfxMesh *meshes;
+// per mesh, where its next object record goes
+static uint32_t *mesh_cursors;
+static uint32_t upload_count;
+static uint32_t upload_capacity;
+static struct GfxUpload *uploads;
+static uint32_t max_object_count;
+// slots ever used, alive or on the free list
+static uint32_t object_slot_count;
+static uint32_t free_object;
+static struct GfxObject *objects;
+// set when the draw items no longer match the objects and ready meshes
+static int is_draw_list_dirty;
+static struct GfxDrawState draw_states[DRAW_STATE_COUNT];
+static uint32_t draw_item_vertex_count;
+static uint32_t draw_item_count;
+static uint32_t draw_item_capacity;
+static struct GfxDrawItem *draw_items;
+// object slot drawn by each instance, filled in by update_objects
+static uint32_t *instance_objects;
+// per frame scratch of the cpu chunk culling
+static uint32_t cull_visible_capacity;
+static uint32_t *cull_visible;
+static uint32_t cull_mark_capacity;
+static uint8_t *cull_marks;
+// object records drawn, the ready meshes' objects
+static uint32_t draw_instance_count;
+static int is_indirect_enabled;
+static enum GfxDrawMode draw_mode;
+static VkPipelineLayout cull_pipeline_layout;
+static VkPipeline cull_pipeline;
+// two phase occlusion culling on top of the cull pass
+static int is_occlusion_enabled;
+// set once the first early phase has cleared the visibility
+static int is_visibility_cleared;
+static VkRenderPass late_render_pass;
+// created with the cull pass, whose shader reads the pyramid in either case
+static VkSampler depth_pyramid_sampler;
+static VkDescriptorSetLayout depth_pyramid_layout;
+static VkPipelineLayout depth_pyramid_pipeline_layout;
+static VkPipeline depth_pyramid_pipeline;
+static struct GfxDepthPyramid depth_pyramid;
+// per frame in flight a draw count per state, then a command per object,
+// followed by the visibility of every object slot
+static struct GfxResource indirect_resource;
+static VkDeviceSize indirect_stride;
+static struct GfxResource uniform_resource;
+static VkDeviceSize uniform_stride;
+// a slot of object records per frame in flight
+static struct GfxResource object_resource;
+static VkDeviceSize object_stride;
+static VkDescriptorSet descriptor_set;
 static VkImage depth_image;
-static VkDeviceMemory depth_image_memory;
+static struct GfxAllocation depth_image_allocation;
 static VkImageView depth_image_view;
-static VkPipeline pipeline;
+// one per vertex format
+static VkPipeline pipelines[VERTEX_FORMAT_COUNT];
+static VkPipelineCache pipeline_cache;
 static VkFramebuffer *framebuffers;
 static VkCommandBuffer *command_buffers;
+static VkQueryPool timestamp_query_pool;
+static uint8_t *is_timestamp_written;
+static struct GraphicsFrameStats frame_stats;
 
 /* Private Function Declarations */
+static int
+has_instance_extension(char const *name);
+
 static void
-init_instance(VkInstance *instance);
+init_instance(int const is_headless, VkInstance *instance, int *is_surface_maintenance_enabled);
 
 static void
 init_physical_device(
@@ -72,8 +408,25 @@ init_surface(
     VkInstance const instance,
     VkSurfaceKHR *surface);
 
+static int
+has_device_extension(VkPhysicalDevice const physical_device, char const *name);
+
+static int
+get_timeline_semaphore_support(VkPhysicalDevice const physical_device);
+
+static int
+get_indirect_draw_support(VkPhysicalDevice const physical_device, VkQueueFamilyProperties const *family_properties);
+
+static int
+get_present_fence_support(VkPhysicalDevice const physical_device);
+
 static void
 init_device(
+    int const is_headless,
+    int const is_timeline_enabled,
+    int const is_indirect_enabled,
+    int const is_indirect_count_enabled,
+    int const is_present_fence_enabled,
     struct GfxPhysicalDevice const *physical_device,
     VkDevice *device);
 
@@ -96,6 +449,7 @@ init_swapchain(
     VkSurfaceKHR const surface,
     struct VkSurfaceFormatKHR const surface_format,
     struct VkExtent2D const extent,
+    VkSwapchainKHR const old_swapchain,
     VkSwapchainKHR *swapchain);
 
 static void
@@ -107,10 +461,31 @@ init_swapchain_image_views(
     VkImageView swapchain_image_views[static const length]);
 
 static void
-init_descriptor_pool(
+init_offscreen_images(
+    VkDevice const device,
+    VkFormat const format,
+    VkExtent2D const extent,
+    uint32_t const length,
+    VkImage images[static const length],
+    struct GfxAllocation allocations[static const length]);
+
+static void
+init_timestamp_query_pool(
+    VkDevice const device,
+    struct GfxPhysicalDevice const *physical_device,
+    uint32_t const length,
+    VkQueryPool *query_pool);
+
+static void
+read_frame_timestamps(
     VkDevice const device,
-    uint32_t const swapchain_length,
-    VkDescriptorPool *descriptor_pool);
+    VkQueryPool const query_pool,
+    float const timestamp_period,
+    uint32_t const query_index,
+    struct GraphicsFrameStats *stats);
+
+static void
+init_descriptor_pool(VkDevice const device, VkDescriptorPool *descriptor_pool);
 
 static void
 init_descriptor_layout(VkDevice const device, VkDescriptorSetLayout *descriptor_layout);
@@ -121,35 +496,91 @@ init_pipeline_layout(
     VkDescriptorSetLayout const descriptor_layout,
     VkPipelineLayout *pipeline_layout);
 
+static void
+init_cull_pipeline_layout(
+    VkDevice const device,
+    VkDescriptorSetLayout const descriptor_layout,
+    VkDescriptorSetLayout const depth_pyramid_layout,
+    VkPipelineLayout *pipeline_layout);
+
+static void
+init_depth_pyramid_layout(VkDevice const device, VkDescriptorSetLayout *descriptor_layout);
+
+static void
+init_depth_pyramid_sampler(VkDevice const device, VkSampler *sampler);
+
+static void
+init_depth_pyramid(
+    VkDevice const device,
+    VkExtent2D const extent,
+    VkImageView const depth_image_view,
+    VkDescriptorSetLayout const descriptor_layout,
+    VkSampler const sampler,
+    struct GfxDepthPyramid *pyramid);
+
 static void
 init_render_pass(
     VkPhysicalDevice const physical_device,
     VkDevice const device,
     VkFormat const format,
+    VkImageLayout const final_layout,
+    enum GfxRenderPassType const type,
     VkRenderPass *render_pass);
 
-static uint32_t
-get_memory_type(
-    VkPhysicalDevice const physical_device,
-    uint32_t const type_filter,
-    VkMemoryPropertyFlags const flags);
-
 static void
-init_uniform_resources(
+init_resource(
     VkDevice const device,
-    VkPhysicalDevice const physical_device,
     VkDeviceSize const size,
+    VkBufferUsageFlags const usage,
+    VkMemoryPropertyFlags const memory_flags,
+    uint32_t const queue_family_index_count,
+    uint32_t const queue_family_indices[static const queue_family_index_count],
+    struct GfxResource *resource);
+
+static void
+destroy_resource(VkDevice const device, struct GfxResource *resource);
+
+static void
+init_uniform_resource(
+    VkDevice const device,
+    VkDeviceSize const stride,
     uint32_t const length,
-    struct GfxResource resources[static const length]);
+    struct GfxResource *resource);
 
 static void
-init_descriptor_sets(
+init_descriptor_set(
     VkDevice const device,
     VkDescriptorSetLayout descriptor_layout,
     VkDescriptorPool descriptor_pool,
-    uint32_t const length,
-    struct GfxResource const uniform_resources[static const length],
-    VkDescriptorSet descriptor_sets[static const length]);
+    struct GfxResource const *uniform_resource,
+    struct GfxResource const *object_resource,
+    VkDeviceSize const object_range,
+    struct GfxResource const *indirect_resource,
+    VkDescriptorSet *descriptor_set);
+
+static uint64_t
+get_completed_value(void);
+
+static void
+wait_for_value(uint64_t const value);
+
+static void
+retire(struct GfxRetired const *object);
+
+static void
+destroy_retired(struct GfxRetired *object);
+
+static void
+collect_retired(uint64_t const completed_value);
+
+static uint64_t
+get_presented_value(void);
+
+static void
+retire_old_swapchains(void);
+
+static void
+collect_old_swapchains(uint64_t const presented_value);
 
 static void
 init_with_extent(void);
@@ -160,14 +591,55 @@ deinit_with_extent(void);
 static void
 reinit_swapchain(void);
 
+static int
+is_pipeline_cache_compatible(
+    struct GfxPhysicalDevice const *physical_device,
+    size_t const size,
+    uint8_t const *data);
+
+static int
+init_pipeline_cache(
+    VkDevice const device,
+    struct GfxPhysicalDevice const *physical_device,
+    char const *path,
+    VkPipelineCache *pipeline_cache);
+
+static void
+save_pipeline_cache(VkDevice const device, VkPipelineCache const pipeline_cache, char const *path);
+
+static uint32_t const *
+read_shader(struct IoPack const *pack, char const *name, char const *path, uint32_t *size, uint32_t **allocation);
+
 static void
 init_pipeline(
     VkDevice const device,
-    struct VkExtent2D extent,
+    VkPipelineCache const pipeline_cache,
     VkPipelineLayout const pipeline_layout,
     VkRenderPass const render_pass,
+    struct IoPack const *pack,
+    enum VertexFormat const vertex_format,
+    VkPipeline *pipeline);
+
+static void
+init_compute_pipeline(
+    VkDevice const device,
+    VkPipelineCache const pipeline_cache,
+    VkPipelineLayout const pipeline_layout,
+    struct IoPack const *pack,
+    char const *name,
+    char const *path,
     VkPipeline *pipeline);
 
+static void
+record_cull_pass(VkCommandBuffer const command_buffer, struct GfxCullInfo const *cull);
+
+static void
+record_depth_pyramid(
+    VkCommandBuffer const command_buffer,
+    VkPipeline const pipeline,
+    VkPipelineLayout const pipeline_layout,
+    struct GfxDepthPyramid const *pyramid);
+
 static void
 init_shader_module(
     VkDevice const device,
@@ -193,29 +665,97 @@ init_command_buffers(
     VkCommandBuffer command_buffers[static const length]);
 
 static void
-record_command_buffers(
-    uint32_t const length,
-    VkCommandBuffer const command_buffers[static const length],
-    VkFramebuffer const framebuffers[static const length],
-    VkDescriptorSet const descriptor_sets[static const length],
+record_command_buffer(
+    VkCommandBuffer const command_buffer,
+    VkFramebuffer const framebuffer,
     VkRenderPass const render_pass,
-    VkPipeline const pipeline,
-    VkPipelineLayout const pipeline_layout,
-    uint32_t const vertex_count,
-    VkBuffer const vertex_buffer,
-    VkExtent2D const extent);
+    VkRenderPass const late_render_pass,
+    VkQueryPool const query_pool,
+    uint32_t const query_index,
+    VkExtent2D const extent,
+    struct GfxCullInfo const *cull,
+    uint32_t const secondary_count,
+    VkCommandBuffer const *secondaries);
 
 static void
 update_uniform_buffers(
-    VkDevice const device,
-    VkDeviceMemory const memory,
-    struct UBO const *ubo);
+    struct GfxResource const *resource,
+    VkDeviceSize const stride,
+    uint32_t const slot,
+    struct UBO const *ubo,
+    float frustum_planes[6][4]);
+
+static void
+record_frame(uint32_t const frame, uint32_t const image_index, float const frustum_planes[6][4]);
+
+static uint32_t
+get_draw_state(struct GfxMesh const *mesh);
+
+static void
+push_draw_item(struct GfxDrawItem const *item);
+
+static void
+build_draw_items(void);
+
+static void
+push_chunk_draw_item(struct GfxMesh const *mesh, uint32_t const chunk, uint32_t const first_instance, uint32_t const instance_count);
+
+static void
+cull_draw_items(float const frustum_planes[6][4]);
+
+static void
+update_objects(uint32_t const slot);
+
+static uint32_t
+get_vertex_size(enum VertexFormat const vertex_format);
+
+static void
+get_dequantize(struct GraphicsMesh const *mesh, struct GfxDequantize *dequantize);
+
+static void
+init_chunks(struct GraphicsMesh const *mesh, struct GfxDequantize const *dequantize, struct GfxCullBoxes *chunks);
+
+static void
+init_object_record(struct GraphicsMesh const *mesh, struct GfxMesh const *gfx_mesh, struct GfxObjectRecord *record);
+
+static VkDeviceSize
+align_arena(VkDeviceSize const offset, VkDeviceSize const alignment);
+
+static void
+begin_mesh_upload(uint32_t const mesh_index, struct GraphicsMesh const *mesh, VkDeviceSize const vertex_offset, VkDeviceSize const index_offset);
+
+static void
+poll_mesh_uploads(int const is_waiting);
 
 /* Private Functions */
+static int
+has_instance_extension(char const *name)
+{
+    int is_extension_present = 0;
+    uint32_t extension_count = 0;
+    result = vkEnumerateInstanceExtensionProperties(0, &extension_count, 0);
+    assert(result == VK_SUCCESS);
+    VkExtensionProperties *extensions = malloc(extension_count * sizeof *extensions);
+    if (!extensions) {
+        return 0;
+    }
+    result = vkEnumerateInstanceExtensionProperties(0, &extension_count, extensions);
+    assert(result == VK_SUCCESS);
+    for (uint32_t i = 0; i < extension_count; i++) {
+        if (!strcmp(extensions[i].extensionName, name)) {
+            is_extension_present = 1;
+            break;
+        }
+    }
+    free(extensions);
+
+    return is_extension_present;
+}
+
 static void
-init_instance(VkInstance *instance)
+init_instance(int const is_headless, VkInstance *instance, int *is_surface_maintenance_enabled)
 {
-    char const *extensions[] = {
+    char const *extensions[4] = {
         VK_KHR_SURFACE_EXTENSION_NAME,
 #ifdef _WIN32
         VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
@@ -225,6 +765,15 @@ init_instance(VkInstance *instance)
 #error Unsupported system
 #endif
     };
+    uint32_t extension_count = 2;
+    // swapchain_maintenance1 on the device needs these
+    *is_surface_maintenance_enabled = !is_headless
+        && has_instance_extension(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME)
+        && has_instance_extension(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME);
+    if (*is_surface_maintenance_enabled) {
+        extensions[extension_count++] = VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME;
+        extensions[extension_count++] = VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME;
+    }
 
     VkApplicationInfo app_info = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -235,10 +784,12 @@ init_instance(VkInstance *instance)
         .apiVersion = VK_API_VERSION_1_1,
     };
 
+    // headless rendering never creates a surface so the window system
+    // extensions are not needed (and may be missing on display-less machines)
     VkInstanceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
         .pApplicationInfo = &app_info,
-        .enabledExtensionCount = sizeof extensions / sizeof *extensions,
+        .enabledExtensionCount = is_headless ? 0 : extension_count,
         .ppEnabledExtensionNames = extensions,
     };
 
@@ -291,9 +842,11 @@ init_physical_device(
 
         for (size_t j = 0; j < property_counts[i + 1]; j++) {
             if (queue_family_properties[property_counts[i] + j].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                VkBool32 is_surface_supported = VK_FALSE;
-                result = vkGetPhysicalDeviceSurfaceSupportKHR(physical_devices[i], j, surface, &is_surface_supported);
-                assert(result == VK_SUCCESS);
+                VkBool32 is_surface_supported = VK_TRUE;
+                if (surface) {
+                    result = vkGetPhysicalDeviceSurfaceSupportKHR(physical_devices[i], j, surface, &is_surface_supported);
+                    assert(result == VK_SUCCESS);
+                }
 
                 if (is_surface_supported == VK_TRUE) {
                     memcpy(&physical_device->gpu, &physical_devices[i], sizeof physical_device->gpu);
@@ -303,6 +856,36 @@ init_physical_device(
                         &queue_family_properties[property_counts[i] + j],
                         sizeof *queue_family_properties
                     );
+                    VkPhysicalDeviceProperties properties;
+                    vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
+                    physical_device->timestamp_period = properties.limits.timestampPeriod;
+                    physical_device->vendor_id = properties.vendorID;
+                    physical_device->device_id = properties.deviceID;
+                    memcpy(physical_device->pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+                    physical_device->min_uniform_buffer_offset_alignment = properties.limits.minUniformBufferOffsetAlignment;
+                    physical_device->min_storage_buffer_offset_alignment = properties.limits.minStorageBufferOffsetAlignment;
+                    physical_device->max_draw_indirect_count = properties.limits.maxDrawIndirectCount;
+                    physical_device->is_timeline_semaphore_supported = get_timeline_semaphore_support(physical_devices[i]);
+                    physical_device->is_indirect_draw_supported = get_indirect_draw_support(
+                        physical_devices[i],
+                        &physical_device->graphics_family_properties
+                    );
+                    physical_device->is_draw_indirect_count_supported = has_device_extension(
+                        physical_devices[i],
+                        VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+                    );
+                    physical_device->is_present_fence_supported = get_present_fence_support(physical_devices[i]);
+
+                    // prefer a dedicated transfer (dma) family so uploads do
+                    // not compete with rendering on the graphics queue
+                    physical_device->transfer_family_index = j;
+                    for (size_t k = 0; k < property_counts[i + 1]; k++) {
+                        VkQueueFlags flags = queue_family_properties[property_counts[i] + k].queueFlags;
+                        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                            physical_device->transfer_family_index = k;
+                            break;
+                        }
+                    }
                     goto break_physical_device_found;
                 }
             }
@@ -329,8 +912,102 @@ init_surface(
     assert(result == VK_SUCCESS);
 }
 
+static int
+has_device_extension(VkPhysicalDevice const physical_device, char const *name)
+{
+    int is_extension_present = 0;
+    uint32_t extension_count = 0;
+    result = vkEnumerateDeviceExtensionProperties(physical_device, 0, &extension_count, 0);
+    assert(result == VK_SUCCESS);
+    VkExtensionProperties *extensions = malloc(extension_count * sizeof *extensions);
+    if (!extensions) {
+        return 0;
+    }
+    result = vkEnumerateDeviceExtensionProperties(physical_device, 0, &extension_count, extensions);
+    assert(result == VK_SUCCESS);
+    for (uint32_t i = 0; i < extension_count; i++) {
+        if (!strcmp(extensions[i].extensionName, name)) {
+            is_extension_present = 1;
+            break;
+        }
+    }
+    free(extensions);
+
+    return is_extension_present;
+}
+
+static int
+get_timeline_semaphore_support(VkPhysicalDevice const physical_device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    // vkGetPhysicalDeviceFeatures2 needs a 1.1 device
+    if (properties.apiVersion < VK_API_VERSION_1_1) {
+        return 0;
+    }
+
+    if (!has_device_extension(physical_device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        return 0;
+    }
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &timeline_features,
+    };
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+
+    return timeline_features.timelineSemaphore == VK_TRUE;
+}
+
+// the cull pass runs on the graphics queue ahead of the render pass, and its
+// commands draw each object as the instance of its record
+static int
+get_indirect_draw_support(VkPhysicalDevice const physical_device, VkQueueFamilyProperties const *family_properties)
+{
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(physical_device, &features);
+
+    return features.multiDrawIndirect == VK_TRUE
+        && features.drawIndirectFirstInstance == VK_TRUE
+        && (family_properties->queueFlags & VK_QUEUE_COMPUTE_BIT);
+}
+
+static int
+get_present_fence_support(VkPhysicalDevice const physical_device)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    // vkGetPhysicalDeviceFeatures2 needs a 1.1 device
+    if (properties.apiVersion < VK_API_VERSION_1_1) {
+        return 0;
+    }
+
+    if (!has_device_extension(physical_device, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME)) {
+        return 0;
+    }
+
+    VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT maintenance_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &maintenance_features,
+    };
+    vkGetPhysicalDeviceFeatures2(physical_device, &features);
+
+    return maintenance_features.swapchainMaintenance1 == VK_TRUE;
+}
+
 static void
 init_device(
+    int const is_headless,
+    int const is_timeline_enabled,
+    int const is_indirect_enabled,
+    int const is_indirect_count_enabled,
+    int const is_present_fence_enabled,
     struct GfxPhysicalDevice const *physical_device,
     VkDevice *device)
 {
@@ -339,25 +1016,63 @@ init_device(
         // TODO: malloc fails
     }
 
+    float transfer_queue_priority = 0.0f;
+
     VkDeviceQueueCreateInfo queue_create_info[] = {
         {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
             .queueFamilyIndex = physical_device->graphics_family_index,
             .queueCount = physical_device->graphics_family_properties.queueCount,
             .pQueuePriorities = queue_priorities,
-        }
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = physical_device->transfer_family_index,
+            .queueCount = 1,
+            .pQueuePriorities = &transfer_queue_priority,
+        },
+    };
+    int is_transfer_family_separate = physical_device->transfer_family_index != physical_device->graphics_family_index;
+
+    char const *extensions[4];
+    uint32_t extension_count = 0;
+    if (!is_headless) {
+        extensions[extension_count++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    }
+    if (is_timeline_enabled) {
+        extensions[extension_count++] = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+    }
+    if (is_indirect_count_enabled) {
+        extensions[extension_count++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+    }
+    if (is_present_fence_enabled) {
+        extensions[extension_count++] = VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME;
+    }
+
+    VkPhysicalDeviceFeatures features = {
+        .multiDrawIndirect = is_indirect_enabled ? VK_TRUE : VK_FALSE,
+        .drawIndirectFirstInstance = is_indirect_enabled ? VK_TRUE : VK_FALSE,
     };
 
-    char const *extensions[] = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME
+    VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT maintenance_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT,
+        .swapchainMaintenance1 = VK_TRUE,
+    };
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        .pNext = is_present_fence_enabled ? &maintenance_features : 0,
+        .timelineSemaphore = VK_TRUE,
     };
+    void *features_next = is_present_fence_enabled ? (void *)&maintenance_features : 0;
 
     VkDeviceCreateInfo device_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = sizeof queue_create_info / sizeof *queue_create_info,
+        .pNext = is_timeline_enabled ? &timeline_features : features_next,
+        .queueCreateInfoCount = is_transfer_family_separate ? 2 : 1,
         .pQueueCreateInfos = queue_create_info,
-        .enabledExtensionCount = sizeof extensions / sizeof *extensions,
+        .enabledExtensionCount = extension_count,
         .ppEnabledExtensionNames = extensions,
+        .pEnabledFeatures = &features,
     };
 
     result = vkCreateDevice(physical_device->gpu, &device_create_info, 0, device);
@@ -453,6 +1168,7 @@ init_swapchain(
     VkSurfaceKHR const surface,
     struct VkSurfaceFormatKHR const surface_format,
     struct VkExtent2D const extent,
+    VkSwapchainKHR const old_swapchain,
     VkSwapchainKHR *swapchain)
 {
     uint32_t present_modes_count = 0;
@@ -493,6 +1209,9 @@ init_swapchain(
         .compositeAlpha = composite_alpha,
         .presentMode = swapchain_present_mode,
         .clipped = VK_TRUE,
+        // lets the driver hand over resources and keep presenting the old
+        // images until the new ones are ready
+        .oldSwapchain = old_swapchain,
     };
 
     result = vkCreateSwapchainKHR(device, &create_info, 0, swapchain);
@@ -558,72 +1277,442 @@ init_swapchain_image_views(
 }
 
 static void
-init_descriptor_pool(
+init_offscreen_images(
     VkDevice const device,
-    uint32_t const swapchain_length,
-    VkDescriptorPool *descriptor_pool)
+    VkFormat const format,
+    VkExtent2D const extent,
+    uint32_t const length,
+    VkImage images[static const length],
+    struct GfxAllocation allocations[static const length])
 {
-    VkDescriptorPoolSize descriptor_pool_sizes[] = {
-        {
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = swapchain_length,
-        }
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = extent.width,
+        .extent.height = extent.height,
+        .extent.depth = 1,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
 
-    VkDescriptorPoolCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets = swapchain_length,
-        .poolSizeCount = sizeof descriptor_pool_sizes / sizeof descriptor_pool_sizes[0],
-        .pPoolSizes = &descriptor_pool_sizes[0],
-    };
+    for (size_t i = 0; i < length; i++) {
+        result = vkCreateImage(device, &create_info, 0, &images[i]);
+        assert(result == VK_SUCCESS);
 
-    result = vkCreateDescriptorPool(device, &create_info, 0, descriptor_pool);
-    assert(result == VK_SUCCESS);
+        gfx_allocate_image_memory(images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &allocations[i]);
+    }
 }
 
 static void
-init_descriptor_layout(VkDevice const device, VkDescriptorSetLayout *descriptor_layout)
+init_timestamp_query_pool(
+    VkDevice const device,
+    struct GfxPhysicalDevice const *physical_device,
+    uint32_t const length,
+    VkQueryPool *query_pool)
 {
-    VkDescriptorSetLayoutBinding ubo_layout_binding = {
-        .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = 1,
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-    };
+    // timestamps are optional, a zero timestampValidBits means the queue
+    // cannot write them and the gpu frame time is reported as invalid
+    if (!physical_device->graphics_family_properties.timestampValidBits) {
+        *query_pool = VK_NULL_HANDLE;
+        return;
+    }
 
-    VkDescriptorSetLayoutCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = 1,
-        .pBindings = &ubo_layout_binding,
+    // two timestamps (begin, end) per command buffer
+    VkQueryPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * length,
     };
-    result = vkCreateDescriptorSetLayout(device, &create_info, 0, descriptor_layout);
+
+    result = vkCreateQueryPool(device, &create_info, 0, query_pool);
     assert(result == VK_SUCCESS);
 }
 
 static void
-init_pipeline_layout(
+read_frame_timestamps(
     VkDevice const device,
-    VkDescriptorSetLayout const descriptor_layout,
-    VkPipelineLayout *pipeline_layout)
+    VkQueryPool const query_pool,
+    float const timestamp_period,
+    uint32_t const query_index,
+    struct GraphicsFrameStats *stats)
 {
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &descriptor_layout,
-        .pushConstantRangeCount = 0,
-    };
+    if (!query_pool) {
+        return;
+    }
 
-    result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, 0, pipeline_layout);
-    assert(result == VK_SUCCESS);
+    // { begin, begin available, end, end available }
+    uint64_t timestamps[4];
+    result = vkGetQueryPoolResults(
+        device,
+        query_pool,
+        2 * query_index,
+        2,
+        sizeof timestamps,
+        timestamps,
+        2 * sizeof *timestamps,
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+    );
+    if (result != VK_SUCCESS || !timestamps[1] || !timestamps[3]) {
+        return;
+    }
+
+    stats->is_gpu_time_valid = 1;
+    stats->gpu_time_ms = (timestamps[2] - timestamps[0]) * (double)timestamp_period / 1000000.0;
+    stats->gpu_sample_count += 1;
 }
 
+static void
+init_descriptor_pool(VkDevice const device, VkDescriptorPool *descriptor_pool)
+{
+    VkDescriptorPoolSize descriptor_pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+        },
+    };
+
+    VkDescriptorPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = sizeof descriptor_pool_sizes / sizeof descriptor_pool_sizes[0],
+        .pPoolSizes = &descriptor_pool_sizes[0],
+    };
+
+    result = vkCreateDescriptorPool(device, &create_info, 0, descriptor_pool);
+    assert(result == VK_SUCCESS);
+}
+
+static void
+init_descriptor_layout(VkDevice const device, VkDescriptorSetLayout *descriptor_layout)
+{
+    VkDescriptorSetLayoutBinding layout_bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        // covers every frame in flight, the cull pass picks its slot with
+        // push constants
+        {
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = sizeof layout_bindings / sizeof *layout_bindings,
+        .pBindings = layout_bindings,
+    };
+    result = vkCreateDescriptorSetLayout(device, &create_info, 0, descriptor_layout);
+    assert(result == VK_SUCCESS);
+}
+
+static void
+init_pipeline_layout(
+    VkDevice const device,
+    VkDescriptorSetLayout const descriptor_layout,
+    VkPipelineLayout *pipeline_layout)
+{
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &descriptor_layout,
+    };
+
+    result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, 0, pipeline_layout);
+    assert(result == VK_SUCCESS);
+}
+
+// set 1 is the depth pyramid, read from the cull set's binding 0
+static void
+init_cull_pipeline_layout(
+    VkDevice const device,
+    VkDescriptorSetLayout const descriptor_layout,
+    VkDescriptorSetLayout const depth_pyramid_layout,
+    VkPipelineLayout *pipeline_layout)
+{
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(struct GfxCullConstants),
+    };
+
+    // the frustum only shader has no pyramid set
+    VkDescriptorSetLayout set_layouts[] = {
+        descriptor_layout,
+        depth_pyramid_layout,
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = depth_pyramid_layout ? 2 : 1,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+
+    result = vkCreatePipelineLayout(device, &pipeline_layout_create_info, 0, pipeline_layout);
+    assert(result == VK_SUCCESS);
+}
+
+// The source level and the level written by one pyramid dispatch. The cull
+// pass binds the same layout with only the source, which is every level.
+static void
+init_depth_pyramid_layout(VkDevice const device, VkDescriptorSetLayout *descriptor_layout)
+{
+    VkDescriptorSetLayoutBinding layout_bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    VkDescriptorSetLayoutCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = sizeof layout_bindings / sizeof *layout_bindings,
+        .pBindings = layout_bindings,
+    };
+    result = vkCreateDescriptorSetLayout(device, &create_info, 0, descriptor_layout);
+    assert(result == VK_SUCCESS);
+}
+
+// the shaders only use texelFetch, the sampler just has to exist
+static void
+init_depth_pyramid_sampler(VkDevice const device, VkSampler *sampler)
+{
+    VkSamplerCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .minLod = 0.0f,
+        .maxLod = MAX_DEPTH_PYRAMID_LEVEL_COUNT,
+    };
+
+    result = vkCreateSampler(device, &create_info, 0, sampler);
+    assert(result == VK_SUCCESS);
+}
+
+// The pyramid stays in the general layout, where one level is read while the
+// next is written. The depth attachment is read in the layout the early pass
+// leaves it in.
+static void
+init_depth_pyramid(
+    VkDevice const device,
+    VkExtent2D const extent,
+    VkImageView const depth_image_view,
+    VkDescriptorSetLayout const descriptor_layout,
+    VkSampler const sampler,
+    struct GfxDepthPyramid *pyramid)
+{
+    // the image's own mip chain, so the level count stays within the valid
+    // one; odd sources fold their last row and column into the level's last
+    VkExtent2D level_extent = {
+        .width = extent.width > 1 ? extent.width / 2 : 1,
+        .height = extent.height > 1 ? extent.height / 2 : 1,
+    };
+    pyramid->level_count = 0;
+    for (;;) {
+        assert(pyramid->level_count < MAX_DEPTH_PYRAMID_LEVEL_COUNT);
+        pyramid->level_extents[pyramid->level_count++] = level_extent;
+        if (level_extent.width == 1 && level_extent.height == 1) {
+            break;
+        }
+        level_extent.width = level_extent.width > 1 ? level_extent.width / 2 : 1;
+        level_extent.height = level_extent.height > 1 ? level_extent.height / 2 : 1;
+    }
+
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = pyramid->level_extents[0].width,
+        .extent.height = pyramid->level_extents[0].height,
+        .extent.depth = 1,
+        .mipLevels = pyramid->level_count,
+        .arrayLayers = 1,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    result = vkCreateImage(device, &create_info, 0, &pyramid->image);
+    assert(result == VK_SUCCESS);
+
+    gfx_allocate_image_memory(pyramid->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pyramid->allocation);
+
+    VkImageViewCreateInfo view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = pyramid->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = pyramid->level_count,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    result = vkCreateImageView(device, &view_create_info, 0, &pyramid->view);
+    assert(result == VK_SUCCESS);
+
+    view_create_info.subresourceRange.levelCount = 1;
+    for (uint32_t i = 0; i < pyramid->level_count; i++) {
+        view_create_info.subresourceRange.baseMipLevel = i;
+        result = vkCreateImageView(device, &view_create_info, 0, &pyramid->level_views[i]);
+        assert(result == VK_SUCCESS);
+    }
+
+    // a pool per extent, retired with the views its sets point at
+    VkDescriptorPoolSize descriptor_pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = pyramid->level_count + 1,
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = pyramid->level_count,
+        },
+    };
+
+    VkDescriptorPoolCreateInfo pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = pyramid->level_count + 1,
+        .poolSizeCount = sizeof descriptor_pool_sizes / sizeof *descriptor_pool_sizes,
+        .pPoolSizes = descriptor_pool_sizes,
+    };
+
+    result = vkCreateDescriptorPool(device, &pool_create_info, 0, &pyramid->descriptor_pool);
+    assert(result == VK_SUCCESS);
+
+    VkDescriptorSetLayout set_layouts[MAX_DEPTH_PYRAMID_LEVEL_COUNT + 1];
+    VkDescriptorSet sets[MAX_DEPTH_PYRAMID_LEVEL_COUNT + 1];
+    for (uint32_t i = 0; i <= pyramid->level_count; i++) {
+        set_layouts[i] = descriptor_layout;
+    }
+
+    VkDescriptorSetAllocateInfo descriptor_alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pyramid->descriptor_pool,
+        .descriptorSetCount = pyramid->level_count + 1,
+        .pSetLayouts = set_layouts,
+    };
+
+    result = vkAllocateDescriptorSets(device, &descriptor_alloc_info, sets);
+    assert(result == VK_SUCCESS);
+    memcpy(pyramid->level_sets, sets, pyramid->level_count * sizeof *sets);
+    pyramid->cull_set = sets[pyramid->level_count];
+
+    VkDescriptorImageInfo image_infos[2 * MAX_DEPTH_PYRAMID_LEVEL_COUNT + 1];
+    VkWriteDescriptorSet descriptor_writes[2 * MAX_DEPTH_PYRAMID_LEVEL_COUNT + 1];
+    uint32_t write_count = 0;
+    for (uint32_t i = 0; i < pyramid->level_count; i++) {
+        image_infos[write_count] = (VkDescriptorImageInfo){
+            .sampler = sampler,
+            .imageView = i ? pyramid->level_views[i - 1] : depth_image_view,
+            .imageLayout = i ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+        };
+        descriptor_writes[write_count] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pyramid->level_sets[i],
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &image_infos[write_count],
+        };
+        write_count += 1;
+
+        image_infos[write_count] = (VkDescriptorImageInfo){
+            .imageView = pyramid->level_views[i],
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        };
+        descriptor_writes[write_count] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = pyramid->level_sets[i],
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &image_infos[write_count],
+        };
+        write_count += 1;
+    }
+
+    // the cull shader does not write, its storage image is left unwritten
+    image_infos[write_count] = (VkDescriptorImageInfo){
+        .sampler = sampler,
+        .imageView = pyramid->view,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    descriptor_writes[write_count] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pyramid->cull_set,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &image_infos[write_count],
+    };
+    write_count += 1;
+
+    vkUpdateDescriptorSets(device, write_count, descriptor_writes, 0, 0);
+}
+
+// The early pass keeps the color for the late pass and leaves the depth to
+// the pyramid build, the late pass loads both. All three are compatible, so
+// they share the framebuffers and secondary command buffers.
 static void
 init_render_pass(
     VkPhysicalDevice const physical_device,
     VkDevice const device,
     VkFormat const format,
+    VkImageLayout const final_layout,
+    enum GfxRenderPassType const type,
     VkRenderPass *render_pass)
 {
+    int is_early = type == GFX_RENDER_PASS_EARLY;
+    int is_late = type == GFX_RENDER_PASS_LATE;
+
     VkFormat depth_formats[3] = {VK_FORMAT_D16_UNORM};
     VkFormat depth_format = VK_FORMAT_UNDEFINED;
     for (size_t i = 0; i < 3; i++) {
@@ -641,22 +1730,22 @@ init_render_pass(
         {
             .format = format,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .loadOp = is_late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+            .initialLayout = is_late ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = is_early ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : final_layout,
         },
         {
             .format = depth_format,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .loadOp = is_late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = is_early ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .initialLayout = is_late ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = is_early ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
         }
     };
 
@@ -681,11 +1770,17 @@ init_render_pass(
         },
     };
 
+    // the late pass waits for the pyramid build to finish reading the depth,
+    // and the build waits for the early pass to finish writing it; the late
+    // pass reuses the early pass's framebuffers, pipelines and secondaries,
+    // which needs compatible passes, so every type shares all dependencies
+    // and only the load and store ops and layouts differ
     VkSubpassDependency dependencies[] = {
         {
             .srcSubpass = VK_SUBPASS_EXTERNAL,
             .dstSubpass = 0,
-            .srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+                | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
             .dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
             .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
             .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
@@ -696,10 +1791,19 @@ init_render_pass(
             .dstSubpass = 0,
             .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
             .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = 0,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
             .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
             .dependencyFlags = 0,
         },
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dependencyFlags = 0,
+        },
     };
 
     VkRenderPassCreateInfo create_info =  {
@@ -716,132 +1820,261 @@ init_render_pass(
     assert(result == VK_SUCCESS);
 }
 
-static uint32_t
-get_memory_type(
-    VkPhysicalDevice const physical_device,
-    uint32_t const type_filter,
-    VkMemoryPropertyFlags const flags)
+static void
+init_resource(
+    VkDevice const device,
+    VkDeviceSize const size,
+    VkBufferUsageFlags const usage,
+    VkMemoryPropertyFlags const memory_flags,
+    uint32_t const queue_family_index_count,
+    uint32_t const queue_family_indices[static const queue_family_index_count],
+    struct GfxResource *resource)
 {
-    VkPhysicalDeviceMemoryProperties memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    // buffers shared between the graphics and transfer families are created
+    // concurrent so no queue family ownership transfer is needed
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = queue_family_index_count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = queue_family_index_count > 1 ? queue_family_index_count : 0,
+        .pQueueFamilyIndices = queue_family_indices,
+    };
 
-    for (size_t i = 0; i < memory_properties.memoryTypeCount; i++)
-    {
-        uint32_t is_type_filter_present = type_filter & (1 << i);
-        uint32_t is_flags_present = (memory_properties.memoryTypes[i].propertyFlags & flags) == flags;
-        if (is_type_filter_present && is_flags_present)
-        {
-            return i;
-        }
-    }
+    result = vkCreateBuffer(device, &create_info, 0, &resource->buffer);
+    assert(result == VK_SUCCESS);
+
+    gfx_allocate_buffer_memory(resource->buffer, memory_flags, &resource->allocation);
+}
 
-    assert(0);
+static void
+destroy_resource(VkDevice const device, struct GfxResource *resource)
+{
+    vkDestroyBuffer(device, resource->buffer, 0);
+    gfx_free(&resource->allocation);
+    resource->buffer = VK_NULL_HANDLE;
 }
 
+// One buffer holds a UBO slot per command buffer. It stays mapped for the
+// lifetime of the renderer and slots are selected with dynamic offsets.
 static void
-init_uniform_resources(
+init_uniform_resource(
     VkDevice const device,
-    VkPhysicalDevice const physical_device,
-    VkDeviceSize const size,
+    VkDeviceSize const stride,
     uint32_t const length,
-    struct GfxResource resources[static const length])
+    struct GfxResource *resource)
 {
-    for (size_t i = 0; i < length; i++) {
-        VkBufferCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-            .size = size,
-            .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        };
-
-        result = vkCreateBuffer(device, &create_info, 0, &resources[i].buffer);
-        assert(result == VK_SUCCESS);
-
-        VkMemoryRequirements memory_requirements;
-        vkGetBufferMemoryRequirements(device, resources[i].buffer, &memory_requirements);
-        VkMemoryAllocateInfo buffer_alloc_info = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .allocationSize = memory_requirements.size,
-            .memoryTypeIndex = get_memory_type(
-                physical_device,
-                memory_requirements.memoryTypeBits,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-            ),
-        };
-
-        result = vkAllocateMemory(device, &buffer_alloc_info, 0, &resources[i].memory);
-        assert(result == VK_SUCCESS);
-
-        vkBindBufferMemory(device, resources[i].buffer, resources[i].memory, 0);
-    }
+    init_resource(
+        device,
+        stride * length,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        1,
+        &physical_device.graphics_family_index,
+        resource
+    );
 }
 
 static void
-init_descriptor_sets(
+init_descriptor_set(
     VkDevice const device,
     VkDescriptorSetLayout descriptor_layout,
     VkDescriptorPool descriptor_pool,
-    uint32_t const length,
-    struct GfxResource const uniform_resources[static const length],
-    VkDescriptorSet descriptor_sets[static const length])
+    struct GfxResource const *uniform_resource,
+    struct GfxResource const *object_resource,
+    VkDeviceSize const object_range,
+    struct GfxResource const *indirect_resource,
+    VkDescriptorSet *descriptor_set)
 {
-    VkDescriptorSetLayout *layouts = malloc(length * sizeof *layouts);
-    if (!layouts) {
-        goto fail_layouts_alloc;
-    }
-    for (size_t i = 0; i < length; i++) {
-        layouts[i] = descriptor_layout;
-    }
-
     VkDescriptorSetAllocateInfo descriptor_alloc_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         .descriptorPool = descriptor_pool,
-        .descriptorSetCount = length,
-        .pSetLayouts = layouts,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &descriptor_layout,
     };
 
-    result = vkAllocateDescriptorSets(device, &descriptor_alloc_info, descriptor_sets);
+    result = vkAllocateDescriptorSets(device, &descriptor_alloc_info, descriptor_set);
     assert(result == VK_SUCCESS);
 
-    for (size_t i = 0; i < length; i++) {
-        VkDescriptorBufferInfo buffer_info = {
-            .buffer = uniform_resources[i].buffer,
+    // ranges cover a single slot, the slot is picked by the dynamic offset
+    VkDescriptorBufferInfo buffer_infos[] = {
+        {
+            .buffer = uniform_resource->buffer,
+            .offset = 0,
+            .range = sizeof(struct GfxUniforms),
+        },
+        {
+            .buffer = object_resource->buffer,
+            .offset = 0,
+            .range = object_range,
+        },
+        {
+            .buffer = indirect_resource ? indirect_resource->buffer : VK_NULL_HANDLE,
             .offset = 0,
             .range = VK_WHOLE_SIZE,
-        };
+        },
+    };
 
-        VkWriteDescriptorSet descriptor_write = {
+    VkWriteDescriptorSet descriptor_writes[] = {
+        {
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = descriptor_sets[i],
+            .dstSet = *descriptor_set,
             .dstBinding = 0,
             .dstArrayElement = 0,
             .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .pBufferInfo = &buffer_info,
-        };
-
-        vkUpdateDescriptorSets(device, 1, &descriptor_write, 0, 0);
-    }
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .pBufferInfo = &buffer_infos[0],
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = *descriptor_set,
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .pBufferInfo = &buffer_infos[1],
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = *descriptor_set,
+            .dstBinding = 2,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &buffer_infos[2],
+        },
+    };
 
-    free(layouts);
-  fail_layouts_alloc:;
+    // without the cull pass nothing reads the indirect binding, it is left
+    // unwritten
+    uint32_t write_count = sizeof descriptor_writes / sizeof *descriptor_writes;
+    vkUpdateDescriptorSets(device, indirect_resource ? write_count : write_count - 1, descriptor_writes, 0, 0);
+}
+
+// The header layout is VkPipelineCacheHeaderVersionOne. Drivers reject
+// foreign data themselves, but checking first avoids feeding them another
+// gpu's or driver version's cache at all.
+static int
+is_pipeline_cache_compatible(
+    struct GfxPhysicalDevice const *physical_device,
+    size_t const size,
+    uint8_t const *data)
+{
+    uint32_t header[4];
+    if (size < sizeof header + VK_UUID_SIZE) {
+        return 0;
+    }
+    memcpy(header, data, sizeof header);
+
+    return header[0] >= sizeof header + VK_UUID_SIZE
+        && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header[2] == physical_device->vendor_id
+        && header[3] == physical_device->device_id
+        && !memcmp(data + sizeof header, physical_device->pipeline_cache_uuid, VK_UUID_SIZE);
+}
+
+// Returns 1 when a compatible cache was loaded from path, a missing or stale
+// file starts an empty cache.
+static int
+init_pipeline_cache(
+    VkDevice const device,
+    struct GfxPhysicalDevice const *physical_device,
+    char const *path,
+    VkPipelineCache *pipeline_cache)
+{
+    size_t size;
+    void *data;
+    enum IoResult io_result = io_read_file(path, &size, &data);
+    // there is none before the first run
+    if (io_result != IO_RESULT_OK && io_result != IO_RESULT_NOT_FOUND) {
+        fprintf(stderr, "failed to read pipeline cache %s: %s\n", path, io_result_string(io_result));
+    }
+    int is_loaded = io_result == IO_RESULT_OK && is_pipeline_cache_compatible(physical_device, size, data);
+
+    VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = is_loaded ? size : 0,
+        .pInitialData = is_loaded ? data : 0,
+    };
+
+    result = vkCreatePipelineCache(device, &create_info, 0, pipeline_cache);
+    assert(result == VK_SUCCESS);
+    free(data);
+
+    return is_loaded;
+}
+
+static void
+save_pipeline_cache(VkDevice const device, VkPipelineCache const pipeline_cache, char const *path)
+{
+    size_t size = 0;
+    result = vkGetPipelineCacheData(device, pipeline_cache, &size, 0);
+    assert(result == VK_SUCCESS);
+    void *data = malloc(size);
+    if (!data) {
+        return;
+    }
+    result = vkGetPipelineCacheData(device, pipeline_cache, &size, data);
+    assert(result == VK_SUCCESS || result == VK_INCOMPLETE);
+
+    enum IoResult io_result = io_write_file(path, size, data);
+    if (io_result != IO_RESULT_OK) {
+        fprintf(stderr, "failed to write pipeline cache %s: %s\n", path, io_result_string(io_result));
+    }
+    free(data);
+}
+
+// Points into the pack when it has the shader, else reads the loose file
+// into *allocation, which the caller frees.
+static uint32_t const *
+read_shader(struct IoPack const *pack, char const *name, char const *path, uint32_t *size, uint32_t **allocation)
+{
+    *allocation = 0;
+    uint64_t offset;
+    uint64_t pack_size;
+    if (pack && io_find_pack_entry(pack, name, &offset, &pack_size)) {
+        *size = pack_size;
+        return (uint32_t const *)((char const *)pack->base + offset);
+    }
+
+    enum IoResult io_result = io_read_spirv(path, size, allocation);
+    if (io_result != IO_RESULT_OK) {
+        fprintf(stderr, "failed to read shader %s: %s\n", path, io_result_string(io_result));
+    }
+    assert(io_result == IO_RESULT_OK);
+
+    return *allocation;
 }
 
 static void
 init_pipeline(
     VkDevice const device,
-    struct VkExtent2D extent,
+    VkPipelineCache const pipeline_cache,
     VkPipelineLayout const pipeline_layout,
     VkRenderPass const render_pass,
+    struct IoPack const *pack,
+    enum VertexFormat const vertex_format,
     VkPipeline *pipeline)
 {
     // TODO change cwd() to install path
     uint32_t vert_shader_code_size = 0;
-    uint32_t *vert_shader_code = 0;
-    io_read_spirv("./build/vert.spv", &vert_shader_code_size, &vert_shader_code);
+    uint32_t *vert_shader_allocation;
+    uint32_t const *vert_shader_code = read_shader(
+        pack,
+        "vert.spv",
+        "./build/vert.spv",
+        &vert_shader_code_size,
+        &vert_shader_allocation
+    );
     uint32_t frag_shader_code_size = 0;
-    uint32_t *frag_shader_code = 0;
-    io_read_spirv("./build/frag.spv", &frag_shader_code_size, &frag_shader_code);
+    uint32_t *frag_shader_allocation;
+    uint32_t const *frag_shader_code = read_shader(
+        pack,
+        "frag.spv",
+        "./build/frag.spv",
+        &frag_shader_code_size,
+        &frag_shader_allocation
+    );
     VkShaderModule vert_shader_module;
     init_shader_module(device, vert_shader_code_size, vert_shader_code, &vert_shader_module);
     VkShaderModule frag_shader_module;
@@ -863,9 +2096,12 @@ init_pipeline(
 
     VkPipelineShaderStageCreateInfo shader_stages[] = { vert_shader_stage_info, frag_shader_stage_info };
 
+    // both quantized formats are mandatory for vertex buffers, the shader
+    // dequantizes with the object parameters either way
+    int is_quantized = vertex_format == VERTEX_FORMAT_QUANTIZED;
     VkVertexInputBindingDescription binding_description = {
         .binding = 0,
-        .stride = sizeof(struct Vertex),
+        .stride = get_vertex_size(vertex_format),
         .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
     };
 
@@ -873,14 +2109,14 @@ init_pipeline(
          {
             .binding = 0,
             .location = 0,
-            .format = VK_FORMAT_R32G32B32_SFLOAT,
-            .offset = offsetof(struct Vertex, pos),
+            .format = is_quantized ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT,
+            .offset = is_quantized ? offsetof(struct VertexQuantized, pos) : offsetof(struct Vertex, pos),
          },
          {
              .binding = 0,
              .location = 1,
-             .format = VK_FORMAT_R32G32B32_SFLOAT,
-             .offset = offsetof(struct Vertex, centroid),
+             .format = is_quantized ? VK_FORMAT_A2B10G10R10_UNORM_PACK32 : VK_FORMAT_R32G32B32_SFLOAT,
+             .offset = is_quantized ? offsetof(struct VertexQuantized, centroid) : offsetof(struct Vertex, centroid),
          },
     };
 
@@ -898,31 +2134,23 @@ init_pipeline(
         .primitiveRestartEnable = VK_FALSE,
     };
 
-    VkViewport viewports[] = {
-        {
-            .x = 0.0,
-            .y = 0.0,
-            .width = extent.width,
-            .height = extent.height,
-            .minDepth = 0.0,
-            .maxDepth = 1.0,
-        },
+    // viewport and scissor are set when recording so the pipeline does not
+    // depend on the swapchain extent and survives resizes
+    VkPipelineViewportStateCreateInfo viewport = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
     };
 
-    VkRect2D scissors[] = {
-        {
-            .offset.x = 0.0,
-            .offset.y = 0.0,
-            .extent = extent,
-        },
+    VkDynamicState dynamic_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
     };
 
-    VkPipelineViewportStateCreateInfo viewport = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-        .viewportCount = sizeof viewports / sizeof viewports[0],
-        .pViewports = &viewports[0],
-        .scissorCount = sizeof scissors / sizeof scissors[0],
-        .pScissors = &scissors[0],
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = sizeof dynamic_states / sizeof dynamic_states[0],
+        .pDynamicStates = dynamic_states,
     };
 
     VkPipelineRasterizationStateCreateInfo rasterization = {
@@ -981,8 +2209,6 @@ init_pipeline(
         .blendConstants = { 0.0, 0.0, 0.0, 0.0 },
     };
 
-    // TODO: dynamic state
-
     VkGraphicsPipelineCreateInfo graphics_pipeline_create_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .stageCount = sizeof shader_stages / sizeof shader_stages[0],
@@ -995,7 +2221,7 @@ init_pipeline(
         .pMultisampleState = &multisample,
         .pDepthStencilState = &depth_stencil,
         .pColorBlendState = &color_blend,
-        .pDynamicState = 0,
+        .pDynamicState = &dynamic_state,
         .layout = pipeline_layout,
         .renderPass = render_pass,
         .subpass = 0,
@@ -1003,20 +2229,67 @@ init_pipeline(
         .basePipelineIndex = -1,
     };
 
-    result = vkCreateGraphicsPipelines(device, 0, 1, &graphics_pipeline_create_info, 0, pipeline);
+    result = vkCreateGraphicsPipelines(device, pipeline_cache, 1, &graphics_pipeline_create_info, 0, pipeline);
     assert(result == VK_SUCCESS);
 
 #ifdef _WIN32
-    _aligned_free(vert_shader_code);
-    _aligned_free(frag_shader_code);
+    _aligned_free(vert_shader_allocation);
+    _aligned_free(frag_shader_allocation);
 #else
-    free(vert_shader_code);
-    free(frag_shader_code);
+    free(vert_shader_allocation);
+    free(frag_shader_allocation);
 #endif
     vkDestroyShaderModule(device, vert_shader_module, 0);
     vkDestroyShaderModule(device, frag_shader_module, 0);
 }
 
+// name is the shader's name in the pack, path the loose file
+static void
+init_compute_pipeline(
+    VkDevice const device,
+    VkPipelineCache const pipeline_cache,
+    VkPipelineLayout const pipeline_layout,
+    struct IoPack const *pack,
+    char const *name,
+    char const *path,
+    VkPipeline *pipeline)
+{
+    uint32_t comp_shader_code_size = 0;
+    uint32_t *comp_shader_allocation;
+    uint32_t const *comp_shader_code = read_shader(
+        pack,
+        name,
+        path,
+        &comp_shader_code_size,
+        &comp_shader_allocation
+    );
+    VkShaderModule comp_shader_module;
+    init_shader_module(device, comp_shader_code_size, comp_shader_code, &comp_shader_module);
+
+    VkComputePipelineCreateInfo compute_pipeline_create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = comp_shader_module,
+            .pName = "main",
+        },
+        .layout = pipeline_layout,
+        .basePipelineHandle = 0,
+        .basePipelineIndex = -1,
+    };
+
+    result = vkCreateComputePipelines(device, pipeline_cache, 1, &compute_pipeline_create_info, 0, pipeline);
+    assert(result == VK_SUCCESS);
+
+#ifdef _WIN32
+    _aligned_free(comp_shader_allocation);
+#else
+    free(comp_shader_allocation);
+#endif
+    vkDestroyShaderModule(device, comp_shader_module, 0);
+}
+
 static void
 init_shader_module(
     VkDevice const device,
@@ -1085,20 +2358,21 @@ init_command_buffers(
 }
 
 static void
-record_command_buffers(
-    uint32_t const length,
-    VkCommandBuffer const command_buffers[static const length],
-    VkFramebuffer const framebuffers[static const length],
-    VkDescriptorSet const descriptor_sets[static const length],
+record_command_buffer(
+    VkCommandBuffer const command_buffer,
+    VkFramebuffer const framebuffer,
     VkRenderPass const render_pass,
-    VkPipeline const pipeline,
-    VkPipelineLayout const pipeline_layout,
-    uint32_t const vertex_count,
-    VkBuffer const vertex_buffer,
-    VkExtent2D const extent)
+    VkRenderPass const late_render_pass,
+    VkQueryPool const query_pool,
+    uint32_t const query_index,
+    VkExtent2D const extent,
+    struct GfxCullInfo const *cull,
+    uint32_t const secondary_count,
+    VkCommandBuffer const *secondaries)
 {
     VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
     VkClearValue clear_color[2] = {
@@ -1112,198 +2386,1164 @@ record_command_buffers(
         }
     };
 
-    for (size_t i = 0; i < length; i++)
-    {
-        result = vkBeginCommandBuffer(command_buffers[i], &begin_info);
-        assert(result == VK_SUCCESS);
+    result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    assert(result == VK_SUCCESS);
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = render_pass,
+        .framebuffer = framebuffer,
+        .renderArea = {
+            .offset = { 0.0f, 0.0f },
+            .extent = extent,
+        },
+        .clearValueCount = sizeof clear_color / sizeof clear_color[0],
+        .pClearValues = clear_color,
+    };
+
+    if (query_pool) {
+        vkCmdResetQueryPool(command_buffer, query_pool, query_index, 2);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, query_index);
+    }
+    if (cull) {
+        record_cull_pass(command_buffer, cull);
+    }
+    // the scene itself is recorded into secondary command buffers by the
+    // recorder workers, nothing is drawn until a mesh with objects is ready
+    vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (secondary_count) {
+        vkCmdExecuteCommands(command_buffer, secondary_count, secondaries);
+    }
+    vkCmdEndRenderPass(command_buffer);
+
+    // the late phase rewrites the same commands, so the secondaries draw
+    // again what the early phase missed
+    if (late_render_pass) {
+        if (cull) {
+            record_depth_pyramid(command_buffer, depth_pyramid_pipeline, depth_pyramid_pipeline_layout, &depth_pyramid);
+            struct GfxCullInfo late_cull = *cull;
+            late_cull.is_visibility_reset = 0;
+            late_cull.constants.phase = GFX_CULL_PHASE_LATE;
+            record_cull_pass(command_buffer, &late_cull);
+        }
+        render_pass_begin_info.renderPass = late_render_pass;
+        vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        if (secondary_count) {
+            vkCmdExecuteCommands(command_buffer, secondary_count, secondaries);
+        }
+        vkCmdEndRenderPass(command_buffer);
+    }
+    if (query_pool) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, query_index + 1);
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    assert(result == VK_SUCCESS);
+}
+
+// Writes the frame's indirect commands. The slot was last read by this
+// frame's previous submission, which has finished, so only the writes here
+// need ordering. The two occlusion phases also wait for each other: the late
+// phase rewrites the commands the early draws read, and the early phase reads
+// the visibility the last late phase wrote.
+static void
+record_cull_pass(VkCommandBuffer const command_buffer, struct GfxCullInfo const *cull)
+{
+    if (cull->constants.phase != GFX_CULL_PHASE_FRUSTUM) {
+        VkMemoryBarrier phase_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &phase_barrier,
+            0,
+            0,
+            0,
+            0
+        );
+    }
+
+    if (cull->is_visibility_reset) {
+        vkCmdFillBuffer(command_buffer, cull->indirect_buffer, cull->visibility_offset, cull->visibility_size, 0);
+    }
+    if (cull->constants.is_compacting) {
+        vkCmdFillBuffer(command_buffer, cull->indirect_buffer, cull->count_offset, DRAW_STATE_COUNT * sizeof(uint32_t), 0);
+    }
+    if (cull->is_visibility_reset || cull->constants.is_compacting) {
+        VkMemoryBarrier fill_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &fill_barrier,
+            0,
+            0,
+            0,
+            0
+        );
+    }
+
+    uint32_t dynamic_offsets[] = { cull->uniform_offset, cull->object_offset };
+    VkDescriptorSet descriptor_sets[] = { cull->descriptor_set, cull->depth_pyramid_set };
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cull->pipeline);
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        cull->pipeline_layout,
+        0,
+        cull->depth_pyramid_set ? 2 : 1,
+        descriptor_sets,
+        sizeof dynamic_offsets / sizeof *dynamic_offsets,
+        dynamic_offsets
+    );
+    vkCmdPushConstants(
+        command_buffer,
+        cull->pipeline_layout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof cull->constants,
+        &cull->constants
+    );
+    vkCmdDispatch(command_buffer, (cull->constants.object_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier draw_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0,
+        1,
+        &draw_barrier,
+        0,
+        0,
+        0,
+        0
+    );
+}
+
+// Reduces the depth the early pass left behind level by level. The levels the
+// last frame's cull pass read are discarded.
+static void
+record_depth_pyramid(
+    VkCommandBuffer const command_buffer,
+    VkPipeline const pipeline,
+    VkPipelineLayout const pipeline_layout,
+    struct GfxDepthPyramid const *pyramid)
+{
+    VkImageMemoryBarrier begin_barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = pyramid->image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = pyramid->level_count,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+    vkCmdPipelineBarrier(
+        command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0,
+        0,
+        0,
+        0,
+        1,
+        &begin_barrier
+    );
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    // each level is read by the next one, the last by the cull pass
+    VkMemoryBarrier level_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    };
+    for (uint32_t i = 0; i < pyramid->level_count; i++) {
+        vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            pipeline_layout,
+            0,
+            1,
+            &pyramid->level_sets[i],
+            0,
+            0
+        );
+        vkCmdDispatch(
+            command_buffer,
+            (pyramid->level_extents[i].width + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE,
+            (pyramid->level_extents[i].height + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE,
+            1
+        );
+        vkCmdPipelineBarrier(
+            command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            1,
+            &level_barrier,
+            0,
+            0,
+            0,
+            0
+        );
+    }
+}
+
+static uint64_t
+get_completed_value(void)
+{
+    if (is_timeline_enabled) {
+        uint64_t value;
+        result = vkGetSemaphoreCounterValueKHR(device, timeline, &value);
+        assert(result == VK_SUCCESS);
+        return value;
+    }
+
+    // a slot whose fence is still pending has not reached its value, which
+    // bounds how far the timeline can be
+    uint64_t completed = submit_value;
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
+        if (frame_values[i] && frame_values[i] <= completed && vkGetFenceStatus(device, is_main_render_done[i]) != VK_SUCCESS) {
+            completed = frame_values[i] - 1;
+        }
+    }
+
+    return completed;
+}
+
+static void
+wait_for_value(uint64_t const value)
+{
+    if (!value) {
+        return;
+    }
+
+    if (is_timeline_enabled) {
+        VkSemaphoreWaitInfoKHR wait_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+            .semaphoreCount = 1,
+            .pSemaphores = &timeline,
+            .pValues = &value,
+        };
+        result = vkWaitSemaphoresKHR(device, &wait_info, UINT64_MAX);
+        assert(result == VK_SUCCESS);
+        return;
+    }
+
+    // slots holding a value at or below the target cover every submission
+    // up to it that may still be pending, older ones were waited on reuse
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
+        if (frame_values[i] && frame_values[i] <= value) {
+            result = vkWaitForFences(device, 1, &is_main_render_done[i], VK_TRUE, UINT64_MAX);
+            assert(result == VK_SUCCESS);
+        }
+    }
+}
+
+// object->value is the timeline value after which nothing uses the object
+static void
+retire(struct GfxRetired const *object)
+{
+    if (retired_count == retired_capacity) {
+        retired_capacity = retired_capacity ? 2 * retired_capacity : 8;
+        retired = realloc(retired, retired_capacity * sizeof *retired);
+        assert(retired);
+    }
+
+    retired[retired_count++] = *object;
+}
+
+static void
+destroy_retired(struct GfxRetired *object)
+{
+    switch (object->type) {
+    case GFX_RETIRED_RESOURCE:
+        destroy_resource(device, &object->resource);
+        break;
+    case GFX_RETIRED_IMAGE:
+        vkDestroyImage(device, object->image.handle, 0);
+        gfx_free(&object->image.allocation);
+        break;
+    case GFX_RETIRED_IMAGE_VIEW:
+        vkDestroyImageView(device, object->image_view, 0);
+        break;
+    case GFX_RETIRED_FRAMEBUFFER:
+        vkDestroyFramebuffer(device, object->framebuffer, 0);
+        break;
+    case GFX_RETIRED_SWAPCHAIN:
+        vkDestroySwapchainKHR(device, object->swapchain, 0);
+        break;
+    case GFX_RETIRED_DESCRIPTOR_POOL:
+        vkDestroyDescriptorPool(device, object->descriptor_pool, 0);
+        break;
+    }
+}
+
+// retired objects are destroyed in the order they were retired
+static void
+collect_retired(uint64_t const completed_value)
+{
+    uint32_t kept_count = 0;
+    for (uint32_t i = 0; i < retired_count; i++) {
+        if (retired[i].value <= completed_value) {
+            destroy_retired(&retired[i]);
+        } else {
+            retired[kept_count++] = retired[i];
+        }
+    }
+    retired_count = kept_count;
+}
+
+// like get_completed_value, for the presents
+static uint64_t
+get_presented_value(void)
+{
+    uint64_t presented = present_value;
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
+        if (present_values[i] && present_values[i] <= presented && vkGetFenceStatus(device, is_present_done[i]) != VK_SUCCESS) {
+            presented = present_values[i] - 1;
+        }
+    }
+
+    return presented;
+}
+
+// Without present fences nothing tells when the presentation engine is done
+// with an old swapchain. Once an image acquired from a newer swapchain has
+// been presented, the engine has moved on to it, so the old ones are retired
+// with the frame that rendered that image.
+static void
+retire_old_swapchains(void)
+{
+    for (uint32_t i = 0; i < old_swapchain_count; i++) {
+        retire(&(struct GfxRetired){
+            .value = submit_value,
+            .type = GFX_RETIRED_SWAPCHAIN,
+            .swapchain = old_swapchains[i].handle,
+        });
+    }
+    old_swapchain_count = 0;
+}
+
+// with present fences, old swapchains go once their last present is done
+static void
+collect_old_swapchains(uint64_t const presented_value)
+{
+    uint32_t kept_count = 0;
+    for (uint32_t i = 0; i < old_swapchain_count; i++) {
+        if (old_swapchains[i].present_value <= presented_value) {
+            vkDestroySwapchainKHR(device, old_swapchains[i].handle, 0);
+        } else {
+            old_swapchains[kept_count++] = old_swapchains[i];
+        }
+    }
+    old_swapchain_count = kept_count;
+}
+
+// Nothing waits for the gpu here: every object built on the old swapchain
+// is retired and destroyed once the frames that used it have finished, the
+// old swapchain itself once presentation from it is known to be over.
+static void
+reinit_swapchain(void)
+{
+    VkExtent2D new_extent;
+    get_extent(physical_device.gpu, surface, &new_extent);
+    // a minimized window has no area to present to, try again next frame
+    if (new_extent.width == 0 || new_extent.height == 0) {
+        return;
+    }
+
+    deinit_with_extent();
+    for (size_t i = 0; i < swapchain_length; i++)
+    {
+        retire(&(struct GfxRetired){
+            .value = submit_value,
+            .type = GFX_RETIRED_IMAGE_VIEW,
+            .image_view = swapchain_image_views[i],
+        });
+    }
+
+    VkSwapchainKHR old_swapchain = swapchain;
+    extent = new_extent;
+    init_swapchain(device, physical_device.gpu, surface, surface_format, extent, old_swapchain, &swapchain);
+    // presentation is not on the gpu timeline, see collect_old_swapchains
+    // and retire_old_swapchains
+    if (old_swapchain_count == old_swapchain_capacity) {
+        old_swapchain_capacity = old_swapchain_capacity ? 2 * old_swapchain_capacity : 4;
+        old_swapchains = realloc(old_swapchains, old_swapchain_capacity * sizeof *old_swapchains);
+        assert(old_swapchains);
+    }
+    old_swapchains[old_swapchain_count++] = (struct GfxOldSwapchain){
+        .handle = old_swapchain,
+        .present_value = present_value,
+    };
+
+    free(swapchain_images);
+    init_swapchain_images(device, swapchain, &swapchain_length, &swapchain_images);
+    // the new swapchain may have a different number of images
+    swapchain_image_views = realloc(swapchain_image_views, swapchain_length * sizeof *swapchain_image_views);
+    init_swapchain_image_views(device, &surface_format, swapchain_length, swapchain_images, swapchain_image_views);
+    // none of the new images has been rendered to yet
+    free(images_in_flight);
+    images_in_flight = calloc(swapchain_length, sizeof *images_in_flight);
+
+    init_with_extent();
+}
+
+static void
+init_with_extent(void)
+{
+    VkFormat depth_formats[3] = {VK_FORMAT_D16_UNORM};
+    VkFormat depth_format = VK_FORMAT_UNDEFINED;
+    for (size_t i = 0; i < 3; i++)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physical_device.gpu, depth_formats[i], &props);
+
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        {
+            depth_format = depth_formats[i];
+            break;
+        }
+    }
+    assert(depth_format != VK_FORMAT_UNDEFINED);
+
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = extent.width,
+        .extent.height = extent.height,
+        .extent.depth = 1,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = depth_format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        // the depth pyramid is built from it
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (is_occlusion_enabled ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    result = vkCreateImage(device, &create_info, 0, &depth_image);
+    assert(result == VK_SUCCESS);
+
+    gfx_allocate_image_memory(depth_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depth_image_allocation);
+
+    VkImageViewCreateInfo view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = depth_image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = depth_format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+
+    result = vkCreateImageView(device, &view_create_info, 0, &depth_image_view);
+    assert(result == VK_SUCCESS);
+
+    if (is_occlusion_enabled) {
+        init_depth_pyramid(device, extent, depth_image_view, depth_pyramid_layout, depth_pyramid_sampler, &depth_pyramid);
+    }
+
+    framebuffers = malloc(swapchain_length * sizeof *framebuffers);
+    init_framebuffers(
+        device,
+        extent,
+        depth_image_view,
+        render_pass,
+        swapchain_length,
+        swapchain_image_views,
+        framebuffers
+    );
+}
+
+// frames already submitted may still use these, they are only retired
+static void
+deinit_with_extent(void)
+{
+    for (size_t i = 0; i < swapchain_length; i++) {
+        retire(&(struct GfxRetired){
+            .value = submit_value,
+            .type = GFX_RETIRED_FRAMEBUFFER,
+            .framebuffer = framebuffers[i],
+        });
+    }
+    free(framebuffers);
+    retire(&(struct GfxRetired){
+        .value = submit_value,
+        .type = GFX_RETIRED_IMAGE_VIEW,
+        .image_view = depth_image_view,
+    });
+    retire(&(struct GfxRetired){
+        .value = submit_value,
+        .type = GFX_RETIRED_IMAGE,
+        .image = {
+            .handle = depth_image,
+            .allocation = depth_image_allocation,
+        },
+    });
+    if (!is_occlusion_enabled) {
+        return;
+    }
+
+    retire(&(struct GfxRetired){
+        .value = submit_value,
+        .type = GFX_RETIRED_DESCRIPTOR_POOL,
+        .descriptor_pool = depth_pyramid.descriptor_pool,
+    });
+    for (uint32_t i = 0; i < depth_pyramid.level_count; i++) {
+        retire(&(struct GfxRetired){
+            .value = submit_value,
+            .type = GFX_RETIRED_IMAGE_VIEW,
+            .image_view = depth_pyramid.level_views[i],
+        });
+    }
+    retire(&(struct GfxRetired){
+        .value = submit_value,
+        .type = GFX_RETIRED_IMAGE_VIEW,
+        .image_view = depth_pyramid.view,
+    });
+    retire(&(struct GfxRetired){
+        .value = submit_value,
+        .type = GFX_RETIRED_IMAGE,
+        .image = {
+            .handle = depth_pyramid.image,
+            .allocation = depth_pyramid.allocation,
+        },
+    });
+}
+
+static void
+update_uniform_buffers(
+    struct GfxResource const *resource,
+    VkDeviceSize const stride,
+    uint32_t const slot,
+    struct UBO const *ubo,
+    float frustum_planes[6][4])
+{
+    struct GfxUniforms uniforms = { .ubo = *ubo };
+    float view_proj[4][4];
+    mat4_mul(view_proj, uniforms.ubo.view, uniforms.ubo.proj);
+    mat4_frustum_planes(uniforms.frustum_planes, view_proj);
+
+    memcpy((char *)resource->allocation.mapped + slot * stride, &uniforms, sizeof uniforms);
+    memcpy(frustum_planes, uniforms.frustum_planes, sizeof uniforms.frustum_planes);
+}
+
+// Re-recorded every frame: the worker threads record the draw items into
+// secondary command buffers which the primary executes inside the render pass.
+static void
+record_frame(uint32_t const frame, uint32_t const image_index, float const frustum_planes[6][4])
+{
+    long begin_time;
+    platform.get_timestamp(&begin_time);
+
+    update_objects(frame);
+    if (!is_indirect_enabled) {
+        cull_draw_items(frustum_planes);
+    }
+
+    struct GfxRecordInfo record_info = {
+        .render_pass = render_pass,
+        .framebuffer = framebuffers[image_index],
+        .pipeline_layout = pipeline_layout,
+        .extent = extent,
+        .descriptor_set = descriptor_set,
+        .uniform_offset = frame * uniform_stride,
+        .object_offset = frame * object_stride,
+        .vertex_buffer = mesh_arena.buffer,
+        .states = draw_states,
+        .draw_count = draw_item_count,
+        .draws = draw_items,
+        .draw_mode = draw_mode,
+        .indirect_buffer = indirect_resource.buffer,
+        .command_offset = frame * indirect_stride + DRAW_STATE_COUNT * sizeof(uint32_t),
+        .command_stride = INDIRECT_COMMAND_STRIDE,
+        .count_offset = frame * indirect_stride,
+        .is_executed_twice = is_occlusion_enabled,
+    };
+
+    // with nothing to draw the commands are not read either
+    VkDeviceSize visibility_offset = frames_in_flight * indirect_stride;
+    struct GfxCullInfo cull_info = {
+        .pipeline = cull_pipeline,
+        .pipeline_layout = cull_pipeline_layout,
+        .descriptor_set = descriptor_set,
+        .depth_pyramid_set = depth_pyramid.cull_set,
+        .uniform_offset = record_info.uniform_offset,
+        .object_offset = record_info.object_offset,
+        .indirect_buffer = indirect_resource.buffer,
+        .count_offset = record_info.count_offset,
+        .is_visibility_reset = is_occlusion_enabled && !is_visibility_cleared,
+        .visibility_offset = visibility_offset,
+        .visibility_size = max_object_count * sizeof(uint32_t),
+        .constants = {
+            .object_count = draw_instance_count,
+            .is_compacting = draw_mode == GFX_DRAW_MODE_INDIRECT_COUNT,
+            .count_base = record_info.count_offset / sizeof(uint32_t),
+            .command_base = record_info.command_offset / sizeof(uint32_t),
+            .phase = is_occlusion_enabled ? GFX_CULL_PHASE_EARLY : GFX_CULL_PHASE_FRUSTUM,
+            .visibility_base = visibility_offset / sizeof(uint32_t),
+            .pyramid_level_count = depth_pyramid.level_count,
+            .width = extent.width,
+            .height = extent.height,
+        },
+    };
+    int is_culling = is_indirect_enabled && draw_instance_count;
+    is_visibility_cleared |= is_culling && is_occlusion_enabled;
+
+    uint32_t secondary_count;
+    VkCommandBuffer const *secondaries = gfx_recorder_record(frame, &record_info, &secondary_count);
+
+    record_command_buffer(
+        command_buffers[frame],
+        framebuffers[image_index],
+        render_pass,
+        is_occlusion_enabled ? late_render_pass : VK_NULL_HANDLE,
+        timestamp_query_pool,
+        2 * frame,
+        extent,
+        is_culling ? &cull_info : 0,
+        secondary_count,
+        secondaries
+    );
+
+    long end_time;
+    platform.get_timestamp(&end_time);
+    frame_stats.record_time_ms = (end_time - begin_time) / 1000000.0;
+}
+
+// draw states are laid out per vertex format as unindexed, 16 bit, 32 bit
+static uint32_t
+get_draw_state(struct GfxMesh const *mesh)
+{
+    uint32_t index_state = 0;
+    if (mesh->index_count) {
+        index_state = mesh->index_type == VK_INDEX_TYPE_UINT16 ? 1 : 2;
+    }
+
+    return mesh->vertex_format * 3 + index_state;
+}
+
+static void
+push_draw_item(struct GfxDrawItem const *item)
+{
+    if (draw_item_count == draw_item_capacity) {
+        draw_item_capacity = draw_item_capacity ? 2 * draw_item_capacity : 64;
+        draw_items = realloc(draw_items, draw_item_capacity * sizeof *draw_items);
+        assert(draw_items);
+    }
+
+    draw_items[draw_item_count++] = *item;
+}
+
+// Packs each ready mesh's object records from its first_instance on, sorted
+// by state. Indirect draws get one item per state, covering a command per
+// object record of the state, so the recorded work no longer grows with the
+// scene. Direct draws are built every frame by cull_draw_items instead.
+static void
+build_draw_items(void)
+{
+    draw_item_count = 0;
+    uint32_t instance_count = 0;
+
+    for (uint32_t state = 0; state < DRAW_STATE_COUNT; state++) {
+        uint32_t first_command = instance_count;
+        for (uint32_t i = 0; i < mesh_count; i++) {
+            struct GfxMesh *mesh = &meshes[i];
+            if (!mesh->is_ready || !mesh->object_count || get_draw_state(mesh) != state) {
+                continue;
+            }
+            mesh->first_instance = instance_count;
+            mesh->record.first_command = first_command;
+            instance_count += mesh->object_count;
+        }
+
+        if (is_indirect_enabled && instance_count > first_command) {
+            push_draw_item(&(struct GfxDrawItem){
+                .first = first_command,
+                .count = instance_count - first_command,
+                .state = state,
+            });
+        }
+    }
+
+    draw_instance_count = instance_count;
+    is_draw_list_dirty = 0;
+}
+
+// Draws one chunk for a run of instances, growing the last item instead when
+// it draws the chunk before for the same instances.
+static void
+push_chunk_draw_item(struct GfxMesh const *mesh, uint32_t const chunk, uint32_t const first_instance, uint32_t const instance_count)
+{
+    uint32_t element_count = mesh->index_count ? mesh->index_count : mesh->vertex_count;
+    uint32_t offset = chunk * CULL_CHUNK_ELEMENT_COUNT;
+    uint32_t count = element_count - offset < CULL_CHUNK_ELEMENT_COUNT ? element_count - offset : CULL_CHUNK_ELEMENT_COUNT;
+    struct GfxDrawItem item = {
+        .count = count,
+        .first_instance = first_instance,
+        .instance_count = instance_count,
+        .state = get_draw_state(mesh),
+    };
+    if (mesh->index_count) {
+        item.first = mesh->first_index + offset;
+        item.vertex_offset = mesh->vertex_offset;
+    } else {
+        item.first = mesh->vertex_offset + offset;
+    }
+
+    if (draw_item_count) {
+        struct GfxDrawItem *last = &draw_items[draw_item_count - 1];
+        if (last->state == item.state
+            && last->first_instance == item.first_instance
+            && last->instance_count == item.instance_count
+            && last->vertex_offset == item.vertex_offset
+            && last->first + last->count == item.first
+            && last->count + item.count <= draw_item_vertex_count) {
+            last->count += item.count;
+            return;
+        }
+    }
+
+    push_draw_item(&item);
+}
+
+// Tests every chunk of every drawn object against the frustum, moved into the
+// object's model space so the chunk bounds are used as they are, through the
+// mesh's BVH when it has one. The visible chunks are drawn as runs of
+// consecutive instances seeing them. Items keep the state order and hold at
+// most draw_item_vertex_count elements, so recording still spreads over the
+// recorder workers.
+static void
+cull_draw_items(float const frustum_planes[6][4])
+{
+    draw_item_count = 0;
+    frame_stats.chunk_count = 0;
+    frame_stats.visible_chunk_count = 0;
+
+    for (uint32_t state = 0; state < DRAW_STATE_COUNT; state++) {
+        for (uint32_t i = 0; i < mesh_count; i++) {
+            struct GfxMesh const *mesh = &meshes[i];
+            if (!mesh->is_ready || !mesh->object_count || get_draw_state(mesh) != state) {
+                continue;
+            }
+            struct GfxCullBoxes const *chunks = &mesh->chunks;
+
+            if (chunks->capacity > cull_visible_capacity) {
+                cull_visible_capacity = chunks->capacity;
+                cull_visible = realloc(cull_visible, cull_visible_capacity * sizeof *cull_visible);
+                assert(cull_visible);
+            }
+            // chunk major, one mark per instance
+            uint32_t mark_count = chunks->count * mesh->object_count;
+            if (mark_count > cull_mark_capacity) {
+                cull_mark_capacity = mark_count;
+                cull_marks = realloc(cull_marks, cull_mark_capacity);
+                assert(cull_marks);
+            }
+            memset(cull_marks, 0, mark_count);
+
+            for (uint32_t instance = 0; instance < mesh->object_count; instance++) {
+                struct GfxObject const *object = &objects[instance_objects[mesh->first_instance + instance]];
+                // a world space plane p tests the model space point x as
+                // dot(p, transform * x), which is dot(p * transform, x)
+                float planes[6][4];
+                for (int p = 0; p < 6; p++) {
+                    for (int j = 0; j < 4; j++) {
+                        planes[p][j] = frustum_planes[p][0] * object->transform[j][0]
+                            + frustum_planes[p][1] * object->transform[j][1]
+                            + frustum_planes[p][2] * object->transform[j][2]
+                            + frustum_planes[p][3] * object->transform[j][3];
+                    }
+                }
+
+                uint32_t visible_count = mesh->bvh_node_count
+                    ? bvh_cull(mesh->bvh_node_count, mesh->bvh_nodes, mesh->bvh_primitives, planes, cull_visible)
+                    : gfx_cull_boxes(planes, chunks, cull_visible);
+                for (uint32_t j = 0; j < visible_count; j++) {
+                    cull_marks[cull_visible[j] * mesh->object_count + instance] = 1;
+                }
+                frame_stats.chunk_count += chunks->count;
+                frame_stats.visible_chunk_count += visible_count;
+            }
+
+            for (uint32_t chunk = 0; chunk < chunks->count; chunk++) {
+                uint8_t const *marks = &cull_marks[chunk * mesh->object_count];
+                for (uint32_t instance = 0; instance < mesh->object_count;) {
+                    if (!marks[instance]) {
+                        instance++;
+                        continue;
+                    }
+                    uint32_t first = instance;
+                    while (instance < mesh->object_count && marks[instance]) {
+                        instance++;
+                    }
+                    push_chunk_draw_item(mesh, chunk, mesh->first_instance + first, instance - first);
+                }
+            }
+        }
+    }
+}
+
+// The slot belongs to the frame being recorded, whose previous submission
+// has finished, so it is rewritten in full every frame.
+static void
+update_objects(uint32_t const slot)
+{
+    if (is_draw_list_dirty) {
+        build_draw_items();
+    }
+
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        mesh_cursors[i] = meshes[i].first_instance;
+    }
+
+    struct GfxObjectRecord *records = (struct GfxObjectRecord *)((char *)object_resource.allocation.mapped + slot * object_stride);
+    for (uint32_t i = 0; i < object_slot_count; i++) {
+        struct GfxObject const *object = &objects[i];
+        if (!object->is_alive) {
+            continue;
+        }
+        struct GfxMesh const *mesh = &meshes[object->mesh];
+        // objects of meshes still uploading are not drawn yet
+        if (!mesh->is_ready) {
+            continue;
+        }
+        instance_objects[mesh_cursors[object->mesh]] = i;
+        struct GfxObjectRecord *record = &records[mesh_cursors[object->mesh]++];
+        *record = mesh->record;
+        memcpy(record->model, object->transform, sizeof record->model);
+        record->slot = i;
+    }
+}
+
+static uint32_t
+get_vertex_size(enum VertexFormat const vertex_format)
+{
+    return vertex_format == VERTEX_FORMAT_QUANTIZED ? sizeof(struct VertexQuantized) : sizeof(struct Vertex);
+}
 
-        VkRenderPassBeginInfo render_pass_begin_info = {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass = render_pass,
-            .framebuffer = framebuffers[i],
-            .renderArea = {
-                .offset = { 0.0f, 0.0f },
-                .extent = extent,
-            },
-            .clearValueCount = sizeof clear_color / sizeof clear_color[0],
-            .pClearValues = clear_color,
-        };
+static void
+get_dequantize(struct GraphicsMesh const *mesh, struct GfxDequantize *dequantize)
+{
+    memset(dequantize, 0, sizeof *dequantize);
+    for (int i = 0; i < 3; i++) {
+        if (mesh->vertex_format == VERTEX_FORMAT_QUANTIZED) {
+            float extent = mesh->bounds_max[i] - mesh->bounds_min[i];
+            // snorm spans the bounds from -1 to 1, unorm from 0 to 1
+            dequantize->pos_scale[i] = 0.5f * extent;
+            dequantize->pos_offset[i] = 0.5f * (mesh->bounds_min[i] + mesh->bounds_max[i]);
+            dequantize->centroid_scale[i] = extent;
+            dequantize->centroid_offset[i] = mesh->bounds_min[i];
+        } else {
+            dequantize->pos_scale[i] = 1.0f;
+            dequantize->centroid_scale[i] = 1.0f;
+        }
+    }
+}
 
-        VkDeviceSize offsets[1] = {0};
+// The chunk bounds are gathered from the vertices each chunk's elements
+// refer to, dequantized like the vertex shader does.
+static void
+init_chunks(struct GraphicsMesh const *mesh, struct GfxDequantize const *dequantize, struct GfxCullBoxes *chunks)
+{
+    uint32_t element_count = mesh->index_count ? mesh->index_count : mesh->vertex_count;
+    gfx_init_cull_boxes((element_count + CULL_CHUNK_ELEMENT_COUNT - 1) / CULL_CHUNK_ELEMENT_COUNT, chunks);
+
+    for (uint32_t chunk = 0; chunk < chunks->count; chunk++) {
+        float min[3] = {INFINITY, INFINITY, INFINITY};
+        float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+        uint32_t first = chunk * CULL_CHUNK_ELEMENT_COUNT;
+        uint32_t last = element_count - first < CULL_CHUNK_ELEMENT_COUNT ? element_count : first + CULL_CHUNK_ELEMENT_COUNT;
+        for (uint32_t element = first; element < last; element++) {
+            uint32_t vertex = element;
+            if (mesh->index_size == 2 && mesh->index_count) {
+                vertex = ((uint16_t const *)mesh->indices)[element];
+            } else if (mesh->index_count) {
+                vertex = ((uint32_t const *)mesh->indices)[element];
+            }
 
-        vkCmdBeginRenderPass(command_buffers[i], &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdBindVertexBuffers(command_buffers[i], 0, 1, &vertex_buffer, offsets);
-        vkCmdBindDescriptorSets(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_sets[i], 0, 0);
-        vkCmdDraw(command_buffers[i], vertex_count, 1, 0, 0);
-        vkCmdEndRenderPass(command_buffers[i]);
+            float pos[3];
+            if (mesh->vertex_format == VERTEX_FORMAT_QUANTIZED) {
+                struct VertexQuantizedPos const *stored = &((struct VertexQuantized const *)mesh->vertices)[vertex].pos;
+                int16_t const values[3] = {stored->x, stored->y, stored->z};
+                for (int i = 0; i < 3; i++) {
+                    // snorm clamps -32768 to -1 like the vertex fetch does
+                    pos[i] = fmaxf(values[i] / 32767.0f, -1.0f) * dequantize->pos_scale[i] + dequantize->pos_offset[i];
+                }
+            } else {
+                struct VertexPos const *stored = &((struct Vertex const *)mesh->vertices)[vertex].pos;
+                pos[0] = stored->x;
+                pos[1] = stored->y;
+                pos[2] = stored->z;
+            }
 
-        result = vkEndCommandBuffer(command_buffers[i]);
-        assert(result == VK_SUCCESS);
+            for (int i = 0; i < 3; i++) {
+                min[i] = fminf(min[i], pos[i]);
+                max[i] = fmaxf(max[i], pos[i]);
+            }
+        }
+        gfx_set_cull_box(chunks, chunk, min, max);
     }
 }
 
+// first_command is filled in by build_draw_items and the model matrix per
+// object
 static void
-reinit_swapchain(void)
+init_object_record(struct GraphicsMesh const *mesh, struct GfxMesh const *gfx_mesh, struct GfxObjectRecord *record)
 {
-    vkDeviceWaitIdle(device);
+    memset(record, 0, sizeof *record);
+    get_dequantize(mesh, &record->dequantize);
+    for (int i = 0; i < 3; i++) {
+        record->bounds_center[i] = 0.5f * (mesh->bounds_min[i] + mesh->bounds_max[i]);
+        record->bounds_extent[i] = 0.5f * (mesh->bounds_max[i] - mesh->bounds_min[i]);
+    }
 
-    for (size_t i = 0; i < swapchain_length; i++)
-    {
-        vkDestroyImageView(device, swapchain_image_views[i], 0);
+    record->is_indexed = gfx_mesh->index_count != 0;
+    record->state = get_draw_state(gfx_mesh);
+    if (gfx_mesh->index_count) {
+        record->count = gfx_mesh->index_count;
+        record->first = gfx_mesh->first_index;
+        record->vertex_offset = gfx_mesh->vertex_offset;
+    } else {
+        record->count = gfx_mesh->vertex_count;
+        record->first = gfx_mesh->vertex_offset;
     }
-    vkDestroySwapchainKHR(device, swapchain, 0);
-    get_extent(physical_device.gpu, surface, &extent);
-    init_swapchain(device, physical_device.gpu, surface, surface_format, extent, &swapchain);
-    init_swapchain_images(device, swapchain, &swapchain_length, &swapchain_images);
-    init_swapchain_image_views(device, &surface_format, swapchain_length, swapchain_images, swapchain_image_views);
+}
 
-    deinit_with_extent();
-    init_with_extent();
+// vertex strides are not always a power of two
+static VkDeviceSize
+align_arena(VkDeviceSize const offset, VkDeviceSize const alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
 }
 
+// vertices and indices are staged together and copied into the arena with
+// a single submission
 static void
-init_with_extent(void)
+begin_mesh_upload(uint32_t const mesh_index, struct GraphicsMesh const *mesh, VkDeviceSize const vertex_offset, VkDeviceSize const index_offset)
 {
-    VkFormat depth_formats[3] = {VK_FORMAT_D16_UNORM};
-    VkFormat depth_format = VK_FORMAT_UNDEFINED;
-    for (size_t i = 0; i < 3; i++)
-    {
-        VkFormatProperties props;
-        vkGetPhysicalDeviceFormatProperties(physical_device.gpu, depth_formats[i], &props);
+    VkDeviceSize vertex_size = (VkDeviceSize)mesh->vertex_count * get_vertex_size(mesh->vertex_format);
+    VkDeviceSize index_size = (VkDeviceSize)mesh->index_count * mesh->index_size;
 
-        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
-        {
-            depth_format = depth_formats[i];
-            break;
-        }
+    if (upload_count == upload_capacity) {
+        upload_capacity = upload_capacity ? 2 * upload_capacity : 8;
+        uploads = realloc(uploads, upload_capacity * sizeof *uploads);
+        assert(uploads);
     }
-    assert(depth_format != VK_FORMAT_UNDEFINED);
+    struct GfxUpload *upload = &uploads[upload_count++];
+    upload->mesh = mesh_index;
 
-    VkImageCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .extent.width = extent.width,
-        .extent.height = extent.height,
-        .extent.depth = 1,
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .format = depth_format,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+    init_resource(
+        device,
+        vertex_size + index_size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        1,
+        &physical_device.transfer_family_index,
+        &upload->staging
+    );
+    memcpy(upload->staging.allocation.mapped, mesh->vertices, vertex_size);
+    if (index_size) {
+        memcpy((char *)upload->staging.allocation.mapped + vertex_size, mesh->indices, index_size);
+    }
 
-    result = vkCreateImage(device, &create_info, 0, &depth_image);
+    VkCommandBufferAllocateInfo command_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = transfer_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    result = vkAllocateCommandBuffers(device, &command_buffer_info, &upload->command_buffer);
     assert(result == VK_SUCCESS);
 
-    VkMemoryRequirements memory_requirements;
-    vkGetImageMemoryRequirements(device, depth_image, &memory_requirements);
-
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memory_requirements.size,
-        .memoryTypeIndex = get_memory_type(
-            physical_device.gpu,
-            memory_requirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        ),
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-
-    result = vkAllocateMemory(device, &alloc_info, 0, &depth_image_memory);
+    result = vkBeginCommandBuffer(upload->command_buffer, &begin_info);
     assert(result == VK_SUCCESS);
 
-    vkBindImageMemory(device, depth_image, depth_image_memory, 0);
-
-    VkImageViewCreateInfo view_create_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = depth_image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = depth_format,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
+    VkBufferCopy regions[] = {
+        {
+            .srcOffset = 0,
+            .dstOffset = vertex_offset,
+            .size = vertex_size,
+        },
+        {
+            .srcOffset = vertex_size,
+            .dstOffset = index_offset,
+            .size = index_size,
         },
     };
+    vkCmdCopyBuffer(upload->command_buffer, upload->staging.buffer, mesh_arena.buffer, index_size ? 2 : 1, regions);
 
-    result = vkCreateImageView(device, &view_create_info, 0, &depth_image_view);
+    result = vkEndCommandBuffer(upload->command_buffer);
     assert(result == VK_SUCCESS);
 
-    init_pipeline(device, extent, pipeline_layout, render_pass, &pipeline);
-    framebuffers = malloc(swapchain_length * sizeof *framebuffers);
-    init_framebuffers(
-        device,
-        extent,
-        depth_image_view,
-        render_pass,
-        swapchain_length,
-        swapchain_image_views,
-        framebuffers
-    );
-    command_buffers = malloc(swapchain_length * sizeof *command_buffers);
-    init_command_buffers(device, graphics_command_pool, swapchain_length, command_buffers);
-}
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    result = vkCreateFence(device, &fence_info, 0, &upload->fence);
+    assert(result == VK_SUCCESS);
 
-static void
-deinit_with_extent(void)
-{
-    vkFreeCommandBuffers(device, graphics_command_pool, swapchain_length, command_buffers);
-    free(command_buffers);
-    for (size_t i = 0; i < swapchain_length; i++) {
-        vkDestroyFramebuffer(device, framebuffers[i], 0);
-    }
-    free(framebuffers);
-    vkDestroyPipeline(device, pipeline, 0);
-    vkDestroyImageView(device, depth_image_view, 0);
-    vkFreeMemory(device, depth_image_memory, 0);
-    vkDestroyImage(device, depth_image, 0);
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &upload->command_buffer,
+    };
+    result = vkQueueSubmit(transfer_queue, 1, &submit_info, upload->fence);
+    assert(result == VK_SUCCESS);
 }
 
+// Marks meshes whose copy has finished as ready. Frames only read the arena
+// ranges of ready meshes, so uploads never wait for or stall a frame.
 static void
-update_uniform_buffers(
-    VkDevice const device,
-    VkDeviceMemory const memory,
-    struct UBO const *ubo)
+poll_mesh_uploads(int const is_waiting)
 {
-    void *data;
-    vkMapMemory(device, memory, 0, sizeof *ubo, 0, &data);
-    memcpy(data, ubo, sizeof *ubo);
-    vkUnmapMemory(device, memory);
-}
+    uint32_t pending_count = 0;
+    for (uint32_t i = 0; i < upload_count; i++) {
+        struct GfxUpload *upload = &uploads[i];
+        if (is_waiting) {
+            result = vkWaitForFences(device, 1, &upload->fence, VK_TRUE, UINT64_MAX);
+            assert(result == VK_SUCCESS);
+        } else if (vkGetFenceStatus(device, upload->fence) != VK_SUCCESS) {
+            uploads[pending_count++] = *upload;
+            continue;
+        }
 
+        meshes[upload->mesh].is_ready = 1;
+        is_draw_list_dirty = 1;
+        vkFreeCommandBuffers(device, transfer_command_pool, 1, &upload->command_buffer);
+        vkDestroyFence(device, upload->fence, 0);
+        destroy_resource(device, &upload->staging);
+    }
+    upload_count = pending_count;
+}
 
 /* Public Functions */
 static void
-init(void)
+init(struct GraphicsConfig const *config)
 {
+    is_headless = config->is_headless;
+    frames_in_flight = config->frames_in_flight ? config->frames_in_flight : DEFAULT_FRAMES_IN_FLIGHT;
+    if (frames_in_flight > MAX_FRAMES_IN_FLIGHT) {
+        frames_in_flight = MAX_FRAMES_IN_FLIGHT;
+    }
+    draw_item_vertex_count = config->draw_item_vertex_count ? config->draw_item_vertex_count : DEFAULT_DRAW_ITEM_VERTEX_COUNT;
+    mesh_arena_size = config->mesh_arena_size ? config->mesh_arena_size : DEFAULT_MESH_ARENA_SIZE;
+    max_object_count = config->max_object_count ? config->max_object_count : DEFAULT_MAX_OBJECT_COUNT;
+
     result = volkInitialize();
     assert(result == VK_SUCCESS);
 
-    init_instance(&instance);
+    int is_surface_maintenance_enabled;
+    init_instance(is_headless, &instance, &is_surface_maintenance_enabled);
     volkLoadInstance(instance);
 
-    init_surface(instance, &surface);
+    if (!is_headless) {
+        init_surface(instance, &surface);
+    }
     init_physical_device(instance, &physical_device);
-    init_device(&physical_device, &device);
+    is_timeline_enabled = config->use_timeline_semaphore && physical_device.is_timeline_semaphore_supported;
+    // a state's commands are drawn with a single call
+    is_indirect_enabled = config->use_indirect_draws
+        && physical_device.is_indirect_draw_supported
+        && max_object_count <= physical_device.max_draw_indirect_count;
+    int is_indirect_count_enabled = is_indirect_enabled && physical_device.is_draw_indirect_count_supported;
+    is_occlusion_enabled = is_indirect_enabled && config->use_occlusion_culling;
+    draw_mode = GFX_DRAW_MODE_DIRECT;
+    if (is_indirect_enabled) {
+        draw_mode = is_indirect_count_enabled ? GFX_DRAW_MODE_INDIRECT_COUNT : GFX_DRAW_MODE_INDIRECT;
+    }
+    is_present_fence_enabled = is_surface_maintenance_enabled && physical_device.is_present_fence_supported;
+    init_device(
+        is_headless,
+        is_timeline_enabled,
+        is_indirect_enabled,
+        is_indirect_count_enabled,
+        is_present_fence_enabled,
+        &physical_device,
+        &device
+    );
+    frame_stats.is_timeline_enabled = is_timeline_enabled;
+    frame_stats.is_indirect_enabled = is_indirect_enabled;
+    frame_stats.is_indirect_count_enabled = is_indirect_count_enabled;
+    frame_stats.is_occlusion_enabled = is_occlusion_enabled;
     volkLoadDevice(device);
+    gfx_allocator_init(physical_device.gpu, device);
 
     vkGetDeviceQueue(device, physical_device.graphics_family_index, 0, &graphics_queue);
-    get_surface_format(physical_device.gpu, surface, &surface_format);
-    get_extent(physical_device.gpu, surface, &extent);
+    vkGetDeviceQueue(device, physical_device.transfer_family_index, 0, &transfer_queue);
+
+    if (is_headless) {
+        // offscreen targets stand in for the swapchain images, one per frame
+        // in flight so image_index always matches current_frame
+        surface_format.format = VK_FORMAT_B8G8R8A8_UNORM;
+        surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+        extent.width = config->width;
+        extent.height = config->height;
+
+        swapchain_length = frames_in_flight;
+        swapchain_images = malloc(swapchain_length * sizeof *swapchain_images);
+        offscreen_image_allocations = malloc(swapchain_length * sizeof *offscreen_image_allocations);
+        init_offscreen_images(
+            device,
+            surface_format.format,
+            extent,
+            swapchain_length,
+            swapchain_images,
+            offscreen_image_allocations
+        );
+    } else {
+        get_surface_format(physical_device.gpu, surface, &surface_format);
+        get_extent(physical_device.gpu, surface, &extent);
 
-    init_swapchain(device, physical_device.gpu, surface, surface_format, extent, &swapchain);
-    result = vkGetSwapchainImagesKHR(device, swapchain, &swapchain_length, 0);
-    assert(result == VK_SUCCESS);
-    swapchain_images = malloc(swapchain_length * sizeof *swapchain_images);
-    result = vkGetSwapchainImagesKHR(device, swapchain, &swapchain_length, swapchain_images);
-    assert(result == VK_SUCCESS);
+        init_swapchain(device, physical_device.gpu, surface, surface_format, extent, VK_NULL_HANDLE, &swapchain);
+        result = vkGetSwapchainImagesKHR(device, swapchain, &swapchain_length, 0);
+        assert(result == VK_SUCCESS);
+        swapchain_images = malloc(swapchain_length * sizeof *swapchain_images);
+        result = vkGetSwapchainImagesKHR(device, swapchain, &swapchain_length, swapchain_images);
+        assert(result == VK_SUCCESS);
+    }
     swapchain_image_views = malloc(swapchain_length * sizeof *swapchain_image_views);
     init_swapchain_image_views(device, &surface_format, swapchain_length, swapchain_images, swapchain_image_views);
+    images_in_flight = calloc(swapchain_length, sizeof *images_in_flight);
+    init_timestamp_query_pool(device, &physical_device, frames_in_flight, &timestamp_query_pool);
+    is_timestamp_written = calloc(frames_in_flight, sizeof *is_timestamp_written);
 
     VkCommandPoolCreateInfo graphics_command_pool_info =  {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -1312,8 +3552,19 @@ init(void)
     };
     result = vkCreateCommandPool(device, &graphics_command_pool_info, 0, &graphics_command_pool);
     assert(result == VK_SUCCESS);
+    command_buffers = malloc(frames_in_flight * sizeof *command_buffers);
+    init_command_buffers(device, graphics_command_pool, frames_in_flight, command_buffers);
+    gfx_recorder_init(device, physical_device.graphics_family_index, config->record_thread_count, frames_in_flight);
+
+    VkCommandPoolCreateInfo transfer_command_pool_info =  {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = physical_device.transfer_family_index,
+    };
+    result = vkCreateCommandPool(device, &transfer_command_pool_info, 0, &transfer_command_pool);
+    assert(result == VK_SUCCESS);
 
-    init_descriptor_pool(device, swapchain_length, &descriptor_pool);
+    init_descriptor_pool(device, &descriptor_pool);
 
     VkSemaphoreCreateInfo semaphore_info = {
         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
@@ -1324,21 +3575,108 @@ init(void)
         .flags = VK_FENCE_CREATE_SIGNALED_BIT,
     };
 
-    is_image_available_semaphore = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *is_image_available_semaphore);
-    is_present_ready_semaphore = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *is_present_ready_semaphore);
-    is_main_render_done = malloc(MAX_FRAMES_IN_FLIGHT * sizeof *is_main_render_done);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    is_image_available_semaphore = malloc(frames_in_flight * sizeof *is_image_available_semaphore);
+    is_present_ready_semaphore = malloc(frames_in_flight * sizeof *is_present_ready_semaphore);
+    // left null when the timeline semaphore paces the frames
+    is_main_render_done = calloc(frames_in_flight, sizeof *is_main_render_done);
+    frame_values = calloc(frames_in_flight, sizeof *frame_values);
+    // left null without present fences
+    is_present_done = calloc(frames_in_flight, sizeof *is_present_done);
+    present_values = calloc(frames_in_flight, sizeof *present_values);
+    for (size_t i = 0; i < frames_in_flight; i++) {
         result = vkCreateSemaphore(device, &semaphore_info, 0, &is_image_available_semaphore[i]);
         assert(result == VK_SUCCESS);
         result = vkCreateSemaphore(device, &semaphore_info, 0, &is_present_ready_semaphore[i]);
         assert(result == VK_SUCCESS);
-        result = vkCreateFence(device, &fence_info, 0, &is_main_render_done[i]);
+        if (!is_timeline_enabled) {
+            result = vkCreateFence(device, &fence_info, 0, &is_main_render_done[i]);
+            assert(result == VK_SUCCESS);
+        }
+        if (is_present_fence_enabled) {
+            result = vkCreateFence(device, &fence_info, 0, &is_present_done[i]);
+            assert(result == VK_SUCCESS);
+        }
+    }
+
+    if (is_timeline_enabled) {
+        VkSemaphoreTypeCreateInfoKHR timeline_type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+            .initialValue = 0,
+        };
+        VkSemaphoreCreateInfo timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &timeline_type_info,
+        };
+        result = vkCreateSemaphore(device, &timeline_info, 0, &timeline);
         assert(result == VK_SUCCESS);
     }
 
     init_descriptor_layout(device, &descriptor_layout);
     init_pipeline_layout(device, descriptor_layout, &pipeline_layout);
-    init_render_pass(physical_device.gpu, device, surface_format.format, &render_pass);
+    if (is_occlusion_enabled) {
+        init_depth_pyramid_layout(device, &depth_pyramid_layout);
+        init_depth_pyramid_sampler(device, &depth_pyramid_sampler);
+        init_pipeline_layout(device, depth_pyramid_layout, &depth_pyramid_pipeline_layout);
+    }
+    if (is_indirect_enabled) {
+        init_cull_pipeline_layout(device, descriptor_layout, depth_pyramid_layout, &cull_pipeline_layout);
+    }
+    VkImageLayout final_layout = is_headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    init_render_pass(
+        physical_device.gpu,
+        device,
+        surface_format.format,
+        final_layout,
+        is_occlusion_enabled ? GFX_RENDER_PASS_EARLY : GFX_RENDER_PASS_FULL,
+        &render_pass
+    );
+    if (is_occlusion_enabled) {
+        init_render_pass(physical_device.gpu, device, surface_format.format, final_layout, GFX_RENDER_PASS_LATE, &late_render_pass);
+    }
+
+    long pipeline_begin_time;
+    platform.get_timestamp(&pipeline_begin_time);
+    int is_pipeline_cache_warm = init_pipeline_cache(device, &physical_device, PIPELINE_CACHE_PATH, &pipeline_cache);
+    struct IoPack pack;
+    int is_packed = io_map_pack(ASSET_PACK_PATH, &pack);
+    for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+        init_pipeline(device, pipeline_cache, pipeline_layout, render_pass, is_packed ? &pack : 0, i, &pipelines[i]);
+    }
+    if (is_indirect_enabled) {
+        init_compute_pipeline(
+            device,
+            pipeline_cache,
+            cull_pipeline_layout,
+            is_packed ? &pack : 0,
+            is_occlusion_enabled ? "comp.spv" : "comp_frustum.spv",
+            is_occlusion_enabled ? "./build/comp.spv" : "./build/comp_frustum.spv",
+            &cull_pipeline
+        );
+    }
+    if (is_occlusion_enabled) {
+        init_compute_pipeline(
+            device,
+            pipeline_cache,
+            depth_pyramid_pipeline_layout,
+            is_packed ? &pack : 0,
+            "depth_pyramid.spv",
+            "./build/depth_pyramid.spv",
+            &depth_pyramid_pipeline
+        );
+    }
+    io_unmap_pack(&pack);
+    for (uint32_t i = 0; i < DRAW_STATE_COUNT; i++) {
+        draw_states[i] = (struct GfxDrawState){
+            .pipeline = pipelines[i / 3],
+            .is_indexed = i % 3 != 0,
+            .index_type = i % 3 == 1 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+        };
+    }
+    long pipeline_end_time;
+    platform.get_timestamp(&pipeline_end_time);
+    frame_stats.is_pipeline_cache_warm = is_pipeline_cache_warm;
+    frame_stats.pipeline_time_ms = (pipeline_end_time - pipeline_begin_time) / 1000000.0;
 
 
 
@@ -1392,17 +3730,67 @@ init(void)
     // }
     // vkUnmapMemory(engine.device, engine.vertex_memory);
 
-    uniform_resources = malloc(swapchain_length * sizeof *uniform_resources);
-    init_uniform_resources(device, physical_device.gpu, sizeof(struct UBO), swapchain_length, uniform_resources);
-    descriptor_sets = malloc(swapchain_length * sizeof *descriptor_sets);
+    VkDeviceSize alignment = physical_device.min_uniform_buffer_offset_alignment;
+    uniform_stride = (sizeof(struct GfxUniforms) + alignment - 1) & ~(alignment - 1);
+    init_uniform_resource(device, uniform_stride, frames_in_flight, &uniform_resource);
+
+    // the transfer queue fills the arena while the graphics queue draws
+    uint32_t queue_family_indices[] = {
+        physical_device.graphics_family_index,
+        physical_device.transfer_family_index,
+    };
+    init_resource(
+        device,
+        mesh_arena_size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        queue_family_indices[0] != queue_family_indices[1] ? 2 : 1,
+        queue_family_indices,
+        &mesh_arena
+    );
+
+    VkDeviceSize object_range = (VkDeviceSize)max_object_count * sizeof(struct GfxObjectRecord);
+    alignment = physical_device.min_storage_buffer_offset_alignment;
+    object_stride = (object_range + alignment - 1) & ~(alignment - 1);
+    init_resource(
+        device,
+        object_stride * frames_in_flight,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        1,
+        &physical_device.graphics_family_index,
+        &object_resource
+    );
+    objects = malloc(max_object_count * sizeof *objects);
+    instance_objects = malloc(max_object_count * sizeof *instance_objects);
+    assert(objects && instance_objects);
+    free_object = UINT32_MAX;
+
+    // written and read by the gpu only, every object may need a command;
+    // the visibility is shared by the frames, as each early phase reads the
+    // one the previous frame's late phase wrote
+    if (is_indirect_enabled) {
+        indirect_stride = DRAW_STATE_COUNT * sizeof(uint32_t) + (VkDeviceSize)max_object_count * INDIRECT_COMMAND_STRIDE;
+        init_resource(
+            device,
+            indirect_stride * frames_in_flight + (VkDeviceSize)max_object_count * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            1,
+            &physical_device.graphics_family_index,
+            &indirect_resource
+        );
+    }
 
-    init_descriptor_sets(
+    init_descriptor_set(
         device,
         descriptor_layout,
         descriptor_pool,
-        swapchain_length,
-        uniform_resources,
-        descriptor_sets
+        &uniform_resource,
+        &object_resource,
+        object_range,
+        is_indirect_enabled ? &indirect_resource : 0,
+        &descriptor_set
     );
 
     init_with_extent();
@@ -1412,38 +3800,104 @@ static void
 deinit(void)
 {
     vkDeviceWaitIdle(device);
+    // idle does not cover presentation
+    for (uint32_t i = 0; i < frames_in_flight; i++) {
+        if (is_present_fence_enabled && present_values[i]) {
+            result = vkWaitForFences(device, 1, &is_present_done[i], VK_TRUE, UINT64_MAX);
+            assert(result == VK_SUCCESS);
+        }
+    }
 
+    poll_mesh_uploads(1);
     deinit_with_extent();
-
-    for (size_t i = 0; i < swapchain_length; i++)
-    {
-        vkFreeMemory(device, uniform_resources[i].memory, 0);
-        vkDestroyBuffer(device, uniform_resources[i].buffer, 0);
+    collect_retired(UINT64_MAX);
+    free(retired);
+    collect_old_swapchains(UINT64_MAX);
+    free(old_swapchains);
+
+    destroy_resource(device, &uniform_resource);
+    destroy_resource(device, &object_resource);
+    destroy_resource(device, &mesh_arena);
+    if (is_indirect_enabled) {
+        destroy_resource(device, &indirect_resource);
+        vkDestroyPipeline(device, cull_pipeline, 0);
+        vkDestroyPipelineLayout(device, cull_pipeline_layout, 0);
+    }
+    if (is_occlusion_enabled) {
+        vkDestroyPipeline(device, depth_pyramid_pipeline, 0);
+        vkDestroyPipelineLayout(device, depth_pyramid_pipeline_layout, 0);
+        vkDestroyDescriptorSetLayout(device, depth_pyramid_layout, 0);
+        vkDestroySampler(device, depth_pyramid_sampler, 0);
+        vkDestroyRenderPass(device, late_render_pass, 0);
+    }
+    free(uploads);
+    for (uint32_t i = 0; i < mesh_count; i++) {
+        gfx_free_cull_boxes(&meshes[i].chunks);
+        free(meshes[i].bvh_nodes);
+        free(meshes[i].bvh_primitives);
     }
-    free(uniform_resources);
-    vkFreeMemory(device, vertex_memory, 0);
-    vkDestroyBuffer(device, vertex_buffer, 0);
+    free(meshes);
+    free(mesh_cursors);
+    free(objects);
+    free(instance_objects);
+    free(cull_visible);
+    free(cull_marks);
+    for (uint32_t i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+        vkDestroyPipeline(device, pipelines[i], 0);
+    }
+    save_pipeline_cache(device, pipeline_cache, PIPELINE_CACHE_PATH);
+    vkDestroyPipelineCache(device, pipeline_cache, 0);
     vkDestroyRenderPass(device, render_pass, 0);
     vkDestroyPipelineLayout(device, pipeline_layout, 0);
     vkDestroyDescriptorSetLayout(device, descriptor_layout, 0);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (size_t i = 0; i < frames_in_flight; i++)
     {
         vkDestroySemaphore(device, is_image_available_semaphore[i], 0);
         vkDestroySemaphore(device, is_present_ready_semaphore[i], 0);
         vkDestroyFence(device, is_main_render_done[i], 0);
+        vkDestroyFence(device, is_present_done[i], 0);
+    }
+    free(is_image_available_semaphore);
+    free(is_present_ready_semaphore);
+    free(is_main_render_done);
+    free(frame_values);
+    free(is_present_done);
+    free(present_values);
+    if (timeline) {
+        vkDestroySemaphore(device, timeline, 0);
     }
     vkDestroyDescriptorPool(device, descriptor_pool, 0);
-    free(descriptor_sets);
+    gfx_recorder_deinit();
+    free(draw_items);
+    vkDestroyCommandPool(device, transfer_command_pool, 0);
     vkDestroyCommandPool(device, graphics_command_pool, 0);
+    free(command_buffers);
+    if (timestamp_query_pool) {
+        vkDestroyQueryPool(device, timestamp_query_pool, 0);
+    }
+    free(is_timestamp_written);
     for (size_t i = 0; i < swapchain_length; i++)
     {
         vkDestroyImageView(device, swapchain_image_views[i], 0);
     }
     free(swapchain_image_views);
-    vkDestroySwapchainKHR(device, swapchain, 0);
+    free(images_in_flight);
+    if (is_headless) {
+        for (size_t i = 0; i < swapchain_length; i++)
+        {
+            vkDestroyImage(device, swapchain_images[i], 0);
+            gfx_free(&offscreen_image_allocations[i]);
+        }
+        free(offscreen_image_allocations);
+    } else {
+        vkDestroySwapchainKHR(device, swapchain, 0);
+    }
     free(swapchain_images);
+    gfx_allocator_deinit();
     vkDestroyDevice(device, 0);
-    vkDestroySurfaceKHR(instance, surface, 0);
+    if (!is_headless) {
+        vkDestroySurfaceKHR(instance, surface, 0);
+    }
     vkDestroyInstance(instance, 0);
 }
 
@@ -1451,48 +3905,126 @@ static void
 draw_frame(struct UBO *ubo)
 {
     static uint32_t current_frame = 0;
+    // set when the swapchain still presents but no longer matches the surface
+    static int is_swapchain_suboptimal = 0;
 
-    result = vkWaitForFences(device, 1, &is_main_render_done[current_frame], VK_TRUE, UINT64_MAX);
-    assert(result == VK_SUCCESS);
+    poll_mesh_uploads(0);
 
-    result = vkResetFences(device, 1, &is_main_render_done[current_frame]);
-    assert(result == VK_SUCCESS);
+    // the cpu runs at most frames_in_flight submissions ahead of the gpu
+    wait_for_value(frame_values[current_frame]);
+    collect_retired(get_completed_value());
+    if (is_present_fence_enabled) {
+        collect_old_swapchains(get_presented_value());
+    }
 
-    uint32_t image_index;
-    result = vkAcquireNextImageKHR(
-        device,
-        swapchain,
-        UINT64_MAX,
-        is_image_available_semaphore[current_frame],
-        0,
-        &image_index
-    );
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-        reinit_swapchain();
+    uint32_t image_index = current_frame;
+    if (!is_headless) {
+        result = vkAcquireNextImageKHR(
+            device,
+            swapchain,
+            UINT64_MAX,
+            is_image_available_semaphore[current_frame],
+            0,
+            &image_index
+        );
+        // nothing was acquired and the semaphore stays unsignaled, so the
+        // frame is skipped and the slot reused next time
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            reinit_swapchain();
+            return;
+        }
+        assert(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        // a suboptimal image is still presentable, recreate after presenting
+        is_swapchain_suboptimal = result == VK_SUBOPTIMAL_KHR;
+    }
+
+    // the swapchain may hand out images out of order, so the image can still
+    // be in use by a frame other than the one just waited on
+    wait_for_value(images_in_flight[image_index]);
+    images_in_flight[image_index] = submit_value + 1;
+
+    // the wait above guarantees this frame's previous submission finished,
+    // so its queries, uniform slot and command buffers are free to reuse
+    if (is_timestamp_written[current_frame]) {
+        read_frame_timestamps(device, timestamp_query_pool, physical_device.timestamp_period, current_frame, &frame_stats);
     }
 
-    update_uniform_buffers(device, uniform_resources[current_frame].memory, ubo);
+    float frustum_planes[6][4];
+    update_uniform_buffers(&uniform_resource, uniform_stride, current_frame, ubo, frustum_planes);
+    record_frame(current_frame, image_index, frustum_planes);
 
     VkPipelineStageFlags wait_stages[] = {
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
     };
 
+    submit_value += 1;
+    frame_values[current_frame] = submit_value;
+
+    // binary semaphores ignore their entry in the value arrays
+    uint32_t signal_count = 0;
+    VkSemaphore signal_semaphores[2];
+    uint64_t signal_values[2] = {0, 0};
+    uint64_t wait_values[1] = {0};
+    if (!is_headless) {
+        signal_semaphores[signal_count++] = is_present_ready_semaphore[current_frame];
+    }
+    if (is_timeline_enabled) {
+        signal_values[signal_count] = submit_value;
+        signal_semaphores[signal_count++] = timeline;
+    }
+
+    VkTimelineSemaphoreSubmitInfoKHR timeline_submit_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .waitSemaphoreValueCount = is_headless ? 0 : 1,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = signal_count,
+        .pSignalSemaphoreValues = signal_values,
+    };
+
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
+        .pNext = is_timeline_enabled ? &timeline_submit_info : 0,
+        .waitSemaphoreCount = is_headless ? 0 : 1,
         .pWaitSemaphores = &is_image_available_semaphore[current_frame],
         .pWaitDstStageMask = wait_stages,
         .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffers[image_index],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &is_present_ready_semaphore[current_frame],
+        .pCommandBuffers = &command_buffers[current_frame],
+        .signalSemaphoreCount = signal_count,
+        .pSignalSemaphores = signal_semaphores,
     };
 
+    // reset as late as possible so an early return never leaves it unsignaled
+    if (!is_timeline_enabled) {
+        result = vkResetFences(device, 1, &is_main_render_done[current_frame]);
+        assert(result == VK_SUCCESS);
+    }
+
     result = vkQueueSubmit(graphics_queue, 1, &submit_info, is_main_render_done[current_frame]);
     assert(result == VK_SUCCESS);
+    is_timestamp_written[current_frame] = 1;
+
+    if (is_headless) {
+        current_frame = (current_frame + 1) % frames_in_flight;
+        return;
+    }
+
+    // the slot's last present is long done, it is only waited so the fence
+    // can be reused
+    if (is_present_fence_enabled && present_values[current_frame]) {
+        result = vkWaitForFences(device, 1, &is_present_done[current_frame], VK_TRUE, UINT64_MAX);
+        assert(result == VK_SUCCESS);
+        result = vkResetFences(device, 1, &is_present_done[current_frame]);
+        assert(result == VK_SUCCESS);
+    }
+    VkSwapchainPresentFenceInfoEXT present_fence_info = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT,
+        .swapchainCount = 1,
+        .pFences = &is_present_done[current_frame],
+    };
 
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .pNext = is_present_fence_enabled ? &present_fence_info : 0,
         .waitSemaphoreCount = 1,
         .pWaitSemaphores = &is_present_ready_semaphore[current_frame],
         .swapchainCount = 1,
@@ -1501,60 +4033,142 @@ draw_frame(struct UBO *ubo)
     };
 
     result = vkQueuePresentKHR(graphics_queue, &present_info);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    // an out of date present still runs its queue operations, the fence
+    // included
+    present_value += 1;
+    present_values[current_frame] = present_value;
+    if (!is_present_fence_enabled && (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)) {
+        retire_old_swapchains();
+    }
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || is_swapchain_suboptimal) {
         reinit_swapchain();
     }
 
-    current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    current_frame = (current_frame + 1) % frames_in_flight;
 }
 
-static void
-load_map(uint32_t const count, struct Vertex vertices[static const count])
+static uint32_t
+register_mesh(struct GraphicsMesh const *mesh)
 {
-    VkDeviceSize size = count * sizeof *vertices;
-    printf("size: %ld\n", size);
+    assert(!mesh->index_count || mesh->index_size == 2 || mesh->index_size == 4);
+    VkDeviceSize vertex_stride = get_vertex_size(mesh->vertex_format);
+    VkDeviceSize vertex_size = (VkDeviceSize)mesh->vertex_count * vertex_stride;
+    VkDeviceSize index_size = (VkDeviceSize)mesh->index_count * mesh->index_size;
+    // vertex offsets and first indices are counted in elements, so each
+    // range starts on a multiple of its element size
+    VkDeviceSize vertex_offset = align_arena(mesh_arena_used, vertex_stride);
+    VkDeviceSize index_offset = align_arena(vertex_offset + vertex_size, mesh->index_count ? mesh->index_size : 1);
+    if (index_offset + index_size > mesh_arena_size || vertex_offset / vertex_stride > INT32_MAX) {
+        fprintf(
+            stderr,
+            "mesh arena full: %llu of %llu bytes used\n",
+            (unsigned long long)mesh_arena_used,
+            (unsigned long long)mesh_arena_size
+        );
+        return 0;
+    }
+    mesh_arena_used = index_offset + index_size;
 
-    VkBufferCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    if (mesh_count == mesh_capacity) {
+        mesh_capacity = mesh_capacity ? 2 * mesh_capacity : 16;
+        meshes = realloc(meshes, mesh_capacity * sizeof *meshes);
+        mesh_cursors = realloc(mesh_cursors, mesh_capacity * sizeof *mesh_cursors);
+        assert(meshes && mesh_cursors);
+    }
+    uint32_t mesh_index = mesh_count++;
+    struct GfxMesh *gfx_mesh = &meshes[mesh_index];
+    *gfx_mesh = (struct GfxMesh){
+        .vertex_format = mesh->vertex_format,
+        .vertex_count = mesh->vertex_count,
+        .index_count = mesh->index_count,
+        .index_type = mesh->index_size == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+        .vertex_offset = vertex_offset / vertex_stride,
+        .first_index = mesh->index_count ? index_offset / mesh->index_size : 0,
     };
-    result = vkCreateBuffer(device, &create_info, 0, &vertex_buffer);
-    assert(result == VK_SUCCESS);
+    init_object_record(mesh, gfx_mesh, &gfx_mesh->record);
+    init_chunks(mesh, &gfx_mesh->record.dequantize, &gfx_mesh->chunks);
+    if (mesh->bvh_node_count && mesh->bvh_primitive_count == gfx_mesh->chunks.count) {
+        gfx_mesh->bvh_node_count = mesh->bvh_node_count;
+        gfx_mesh->bvh_nodes = malloc(mesh->bvh_node_count * sizeof *gfx_mesh->bvh_nodes);
+        gfx_mesh->bvh_primitives = malloc(mesh->bvh_primitive_count * sizeof *gfx_mesh->bvh_primitives);
+        assert(gfx_mesh->bvh_nodes && gfx_mesh->bvh_primitives);
+        memcpy(gfx_mesh->bvh_nodes, mesh->bvh_nodes, mesh->bvh_node_count * sizeof *gfx_mesh->bvh_nodes);
+        memcpy(gfx_mesh->bvh_primitives, mesh->bvh_primitives, mesh->bvh_primitive_count * sizeof *gfx_mesh->bvh_primitives);
+    }
 
-    VkMemoryRequirements memory_requirements;
-    vkGetBufferMemoryRequirements(device, vertex_buffer, &memory_requirements);
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memory_requirements.size,
-        .memoryTypeIndex = get_memory_type(
-            physical_device.gpu,
-            memory_requirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        ),
-    };
-    result = vkAllocateMemory(device, &alloc_info, 0, &vertex_memory);
-    assert(result == VK_SUCCESS);
+    if (vertex_size + index_size) {
+        begin_mesh_upload(mesh_index, mesh, vertex_offset, index_offset);
+    } else {
+        gfx_mesh->is_ready = 1;
+    }
 
-    void *data;
-    vkBindBufferMemory(device, vertex_buffer, vertex_memory, 0);
-    vkMapMemory(device, vertex_memory, 0, size, 0, &data);
-    memcpy(data, vertices, size);
-    vkUnmapMemory(device, vertex_memory);
+    return mesh_index + 1;
+}
 
-    record_command_buffers(
-        swapchain_length,
-        command_buffers,
-        framebuffers,
-        descriptor_sets,
-        render_pass,
-        pipeline,
-        pipeline_layout,
-        count,
-        vertex_buffer,
-        extent
-    );
+static uint32_t
+create_object(uint32_t const mesh, float const transform[4][4])
+{
+    assert(mesh && mesh <= mesh_count);
+
+    uint32_t slot = free_object;
+    if (slot != UINT32_MAX) {
+        free_object = objects[slot].next_free;
+    } else if (object_slot_count < max_object_count) {
+        slot = object_slot_count++;
+    } else {
+        return 0;
+    }
+
+    struct GfxObject *object = &objects[slot];
+    object->is_alive = 1;
+    object->mesh = mesh - 1;
+    memcpy(object->transform, transform, sizeof object->transform);
+    meshes[object->mesh].object_count += 1;
+    is_draw_list_dirty = 1;
+
+    return slot + 1;
+}
+
+// the record is rewritten with the rest at the start of the next frame
+static void
+set_object_transform(uint32_t const object, float const transform[4][4])
+{
+    assert(object && object <= object_slot_count && objects[object - 1].is_alive);
+
+    memcpy(objects[object - 1].transform, transform, sizeof objects[object - 1].transform);
+}
+
+static void
+destroy_object(uint32_t const object)
+{
+    assert(object && object <= object_slot_count && objects[object - 1].is_alive);
+
+    uint32_t slot = object - 1;
+    meshes[objects[slot].mesh].object_count -= 1;
+    objects[slot].is_alive = 0;
+    objects[slot].next_free = free_object;
+    free_object = slot;
+    is_draw_list_dirty = 1;
+}
+
+static void
+get_frame_stats(struct GraphicsFrameStats *stats)
+{
+    *stats = frame_stats;
+}
+
+static void
+get_memory_stats(struct GraphicsMemoryStats *stats)
+{
+    struct GfxAllocatorStats allocator_stats;
+    gfx_allocator_get_stats(&allocator_stats);
+
+    stats->block_count = allocator_stats.block_count;
+    stats->max_block_count = allocator_stats.max_block_count;
+    stats->allocation_count = allocator_stats.allocation_count;
+    stats->reserved_bytes = allocator_stats.block_size;
+    stats->used_bytes = allocator_stats.used_size;
+    stats->largest_free_bytes = allocator_stats.largest_free_size;
 }
 
 /* Export Graphics Library */
@@ -1562,5 +4176,10 @@ const struct graphics graphics = {
     .init = init,
     .deinit = deinit,
     .draw_frame = draw_frame,
-    .load_map = load_map,
+    .register_mesh = register_mesh,
+    .create_object = create_object,
+    .set_object_transform = set_object_transform,
+    .destroy_object = destroy_object,
+    .get_frame_stats = get_frame_stats,
+    .get_memory_stats = get_memory_stats,
 };
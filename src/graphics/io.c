@@ -8,58 +8,298 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "graphics/resource.h"
+#ifdef __linux__
+#include "graphics/io_uring.h"
+#endif
 
-// TODO: how to handle errors
-int
-io_read_spirv(char const *relative_path, uint32_t *size, uint32_t **spirv)
+#define FILE_ALIGNMENT 16
+#define DEFAULT_READER_BUFFER_SIZE (64 * 1024)
+#define SPIRV_MAGIC 0x07230203u
+
+static size_t
+align_file(size_t const size)
 {
-    FILE *file = fopen(relative_path, "rb");
-    if (!file) {
-        goto fail_fopen;
+    return (size + FILE_ALIGNMENT - 1) & ~(size_t)(FILE_ALIGNMENT - 1);
+}
+
+static long
+get_file_size(FILE *file)
+{
+    if (fseek(file, 0, SEEK_END)) {
+        return -1;
     }
+    long size = ftell(file);
+    if (fseek(file, 0, SEEK_SET)) {
+        return -1;
+    }
+
+    return size;
+}
 
-    fseek(file, 0, SEEK_END);
-    *size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    assert(*size);
+// every file is sized first so they all land in one allocation
+static void
+read_files_posix(uint32_t const count, char const *const paths[], struct IoFileBatch *batch)
+{
+    size_t storage_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        FILE *file = fopen(paths[i], "rb");
+        long size = file ? get_file_size(file) : -1;
+        if (file) {
+            fclose(file);
+        }
+        // data is only set once the file is read, size marks it sized
+        batch->files[i].size = size < 0 ? SIZE_MAX : (size_t)size;
+        if (size >= 0) {
+            storage_size += align_file(size);
+        }
+    }
 
 #ifdef _WIN32
-    *spirv = _aligned_malloc(*size, alignof(uint32_t));
+    batch->storage = _aligned_malloc(storage_size ? storage_size : FILE_ALIGNMENT, FILE_ALIGNMENT);
+#else
+    batch->storage = aligned_alloc(FILE_ALIGNMENT, storage_size ? storage_size : FILE_ALIGNMENT);
+#endif
+    assert(batch->storage);
+
+    char *data = batch->storage;
+    for (uint32_t i = 0; i < count; i++) {
+        struct IoFile *io_file = &batch->files[i];
+        if (io_file->size == SIZE_MAX) {
+            io_file->size = 0;
+            continue;
+        }
+        size_t slot_size = align_file(io_file->size);
+
+        FILE *file = fopen(paths[i], "rb");
+        int is_read = file && fread(data, 1, io_file->size, file) == io_file->size;
+        if (file) {
+            fclose(file);
+        }
+        if (is_read) {
+            io_file->data = data;
+            batch->read_count += 1;
+        } else {
+            io_file->size = 0;
+        }
+        data += slot_size;
+    }
+}
+
+static void
+free_aligned(void *data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+char const *
+io_result_string(enum IoResult const result)
+{
+    switch (result) {
+    case IO_RESULT_OK:
+        return "ok";
+    case IO_RESULT_NOT_FOUND:
+        return "not found";
+    case IO_RESULT_READ_FAILED:
+        return "read failed";
+    case IO_RESULT_SHORT_READ:
+        return "short read";
+    case IO_RESULT_OUT_OF_MEMORY:
+        return "out of memory";
+    case IO_RESULT_INVALID:
+        return "invalid contents";
+    case IO_RESULT_CORRUPT:
+        return "checksum mismatch";
+    case IO_RESULT_WRITE_FAILED:
+        return "write failed";
+    }
+
+    return "unknown";
+}
+
+enum IoResult
+io_open_reader(char const *relative_path, size_t const buffer_size, struct IoReader *reader)
+{
+    memset(reader, 0, sizeof *reader);
+
+    reader->file = fopen(relative_path, "rb");
+    if (!reader->file) {
+        reader->result = IO_RESULT_NOT_FOUND;
+        return reader->result;
+    }
+
+    // setvbuf has to come before any other operation on the file
+    size_t size = buffer_size ? buffer_size : DEFAULT_READER_BUFFER_SIZE;
+    reader->buffer = malloc(size);
+    if (!reader->buffer || setvbuf(reader->file, reader->buffer, _IOFBF, size)) {
+        reader->result = IO_RESULT_OUT_OF_MEMORY;
+        return reader->result;
+    }
+
+    long file_size = get_file_size(reader->file);
+    if (file_size < 0) {
+        reader->result = IO_RESULT_READ_FAILED;
+        return reader->result;
+    }
+    reader->size = file_size;
+
+    return reader->result;
+}
+
+enum IoResult
+io_read(struct IoReader *reader, size_t const size, void *data)
+{
+    if (reader->result != IO_RESULT_OK) {
+        return reader->result;
+    }
+
+    size_t read_size = fread(data, 1, size, reader->file);
+    reader->position += read_size;
+    if (read_size != size) {
+        reader->result = ferror(reader->file) ? IO_RESULT_READ_FAILED : IO_RESULT_SHORT_READ;
+    }
+
+    return reader->result;
+}
+
+enum IoResult
+io_close_reader(struct IoReader *reader)
+{
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = 0;
+    }
+    // the file owns the buffer until it is closed
+    free(reader->buffer);
+    reader->buffer = 0;
+
+    return reader->result;
+}
+
+enum IoResult
+io_read_spirv(char const *relative_path, uint32_t *size, uint32_t **spirv)
+{
+    *size = 0;
+    *spirv = 0;
+
+    struct IoReader reader;
+    enum IoResult result = io_open_reader(relative_path, 0, &reader);
+    if (result != IO_RESULT_OK) {
+        goto fail_open;
+    }
+    // a stream of words starting with the magic number
+    if (reader.size < sizeof **spirv || reader.size % sizeof **spirv || reader.size > UINT32_MAX) {
+        result = IO_RESULT_INVALID;
+        goto fail_open;
+    }
+
+#ifdef _WIN32
+    uint32_t *code = _aligned_malloc(reader.size, alignof(uint32_t));
 #elif __linux__
-    *spirv = aligned_alloc(alignof(uint32_t), *size);
+    uint32_t *code = aligned_alloc(alignof(uint32_t), reader.size);
 #else
 #error Unsupported OS
 #endif
+    if (!code) {
+        result = IO_RESULT_OUT_OF_MEMORY;
+        goto fail_open;
+    }
 
-    assert(spirv != 0);
-    size_t s = fread(*spirv, 1, *size, file);
-    assert(s != 0);
+    result = io_read(&reader, reader.size, code);
+    if (result == IO_RESULT_OK && code[0] != SPIRV_MAGIC) {
+        result = IO_RESULT_INVALID;
+    }
+    if (result != IO_RESULT_OK) {
+        free_aligned(code);
+        goto fail_open;
+    }
+    *size = reader.size;
+    *spirv = code;
 
-    fclose(file);
-  fail_fopen:
+  fail_open:
+    io_close_reader(&reader);
 
-    return 1;
+    return result;
 }
 
-int
-io_read_static_vertices(char const *relative_path, struct GfxResource *vertex) {
-    FILE *file = fopen(relative_path, "r");
-    if (!file) {
+enum IoResult
+io_read_file(char const *relative_path, size_t *size, void **data)
+{
+    *size = 0;
+    *data = 0;
+
+    struct IoReader reader;
+    enum IoResult result = io_open_reader(relative_path, 0, &reader);
+    if (result != IO_RESULT_OK) {
+        goto fail_open;
+    }
+    if (reader.size == 0 || reader.size > SIZE_MAX) {
+        result = IO_RESULT_INVALID;
         goto fail_open;
     }
 
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    assert(size != -1L);
-
-    char *buffer = malloc(size);
-    assert(buffer != 0);
-    size_t read_size = fread(buffer, 1, size, file);
-    assert(read_size == size);
+    void *contents = malloc(reader.size);
+    if (!contents) {
+        result = IO_RESULT_OUT_OF_MEMORY;
+        goto fail_open;
+    }
+    result = io_read(&reader, reader.size, contents);
+    if (result != IO_RESULT_OK) {
+        free(contents);
+        goto fail_open;
+    }
+    *size = reader.size;
+    *data = contents;
 
-    fclose(file);
   fail_open:
+    io_close_reader(&reader);
+
+    return result;
+}
+
+enum IoResult
+io_write_file(char const *relative_path, size_t size, void const *data)
+{
+    FILE *file = fopen(relative_path, "wb");
+    if (!file) {
+        return IO_RESULT_WRITE_FAILED;
+    }
 
-    return 1;
+    size_t written_size = fwrite(data, 1, size, file);
+    // buffered data is only written, and can only fail, when closing
+    int is_closed = fclose(file) == 0;
+
+    return written_size == size && is_closed ? IO_RESULT_OK : IO_RESULT_WRITE_FAILED;
+}
+
+uint32_t
+io_read_files(uint32_t count, char const *const paths[], enum IoBackend backend, struct IoFileBatch *batch)
+{
+    memset(batch, 0, sizeof *batch);
+    batch->count = count;
+    batch->files = calloc(count ? count : 1, sizeof *batch->files);
+    assert(batch->files);
+
+#ifdef __linux__
+    if (backend == IO_BACKEND_URING && io_read_files_uring(count, paths, batch)) {
+        batch->backend = IO_BACKEND_URING;
+        return batch->read_count;
+    }
+#endif
+
+    batch->backend = IO_BACKEND_POSIX;
+    read_files_posix(count, paths, batch);
+
+    return batch->read_count;
+}
+
+void
+io_free_files(struct IoFileBatch *batch)
+{
+    free_aligned(batch->storage);
+    free(batch->files);
+    memset(batch, 0, sizeof *batch);
 }
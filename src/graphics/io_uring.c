@@ -0,0 +1,454 @@
+#define _DEFAULT_SOURCE
+
+#include "graphics/io_uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Reads run in three batched phases: statx every path to size the shared
+// storage, then per group of files open them all and read them in chunks,
+// straight into the storage registered with the ring. The raw syscalls are
+// used so there is no dependency on liburing.
+
+// operations in flight, the completion queue is twice as large
+#define RING_ENTRY_COUNT 128
+// files open at once, keeps well below the descriptor limit
+#define GROUP_FILE_COUNT 64
+#define READ_CHUNK_SIZE (4u * 1024 * 1024)
+// a single registered buffer may not be larger
+#define MAX_REGISTERED_SIZE (1024ull * 1024 * 1024)
+#define STORAGE_ALIGNMENT 16
+
+struct IoRing {
+    int fd;
+    uint32_t entry_count;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+struct IoChunk {
+    uint32_t file;
+    uint32_t size;
+    uint64_t offset;
+};
+
+// state shared by the phases, operation i of a phase maps to a file or a
+// chunk through these
+struct IoRead {
+    char const *const *paths;
+    struct IoFileBatch *batch;
+    struct statx *stats;
+    // -1 until opened
+    int *fds;
+    uint8_t *is_failed;
+    uint8_t *is_registered;
+    uint32_t *group_files;
+    uint32_t chunk_capacity;
+    struct IoChunk *chunks;
+};
+
+typedef void (*IoPrepare)(struct IoRead *read, uint32_t index, struct io_uring_sqe *sqe);
+typedef void (*IoComplete)(struct IoRead *read, uint32_t index, int32_t result);
+
+/* Private Functions */
+
+static size_t
+align_storage(size_t const size)
+{
+    return (size + STORAGE_ALIGNMENT - 1) & ~(size_t)(STORAGE_ALIGNMENT - 1);
+}
+
+static int
+init_ring(struct IoRing *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    memset(ring, 0, sizeof *ring);
+
+    ring->fd = syscall(__NR_io_uring_setup, RING_ENTRY_COUNT, &params);
+    if (ring->fd < 0) {
+        goto fail_setup;
+    }
+    ring->entry_count = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // both rings share one mapping on kernels that support it
+    if (params.features & IORING_FEAT_SINGLE_MMAP && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sq_ring = mmap(
+        0, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING
+    );
+    if (ring->sq_ring == MAP_FAILED) {
+        goto fail_sq_ring;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(
+            0, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING
+        );
+        if (ring->cq_ring == MAP_FAILED) {
+            goto fail_cq_ring;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        goto fail_sqes;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    ring->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    ring->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 1;
+
+  fail_sqes:
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+  fail_cq_ring:
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  fail_sq_ring:
+    close(ring->fd);
+  fail_setup:
+
+    return 0;
+}
+
+// The opcodes used here came after io_uring itself (5.6), so a ring can be
+// set up where they complete with -EINVAL. Kernels without the probe do not
+// have them either.
+static int
+is_supporting_operations(struct IoRing const *ring)
+{
+    static uint8_t const operations[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED };
+    uint32_t const op_count = 256;
+    struct io_uring_probe *probe = calloc(1, sizeof *probe + op_count * sizeof *probe->ops);
+    assert(probe);
+
+    int is_supported = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, op_count) == 0;
+    for (size_t i = 0; is_supported && i < sizeof operations / sizeof *operations; i++) {
+        uint8_t operation = operations[i];
+        is_supported = operation <= probe->last_op && probe->ops[operation].flags & IO_URING_OP_SUPPORTED;
+    }
+    free(probe);
+
+    return is_supported;
+}
+
+static void
+deinit_ring(struct IoRing *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Hands every completion posted so far to complete and returns how many
+// there were.
+static uint32_t
+reap_completions(struct IoRing *ring, IoComplete complete, struct IoRead *read)
+{
+    uint32_t head = *ring->cq_head;
+    uint32_t cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    uint32_t count = cq_tail - head;
+    for (; head != cq_tail; head++) {
+        struct io_uring_cqe const *cqe = &ring->cqes[head & *ring->cq_mask];
+        complete(read, cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+// Keeps up to entry_count operations in flight until all op_count have
+// completed. Returns 0 when the ring itself fails, after every operation
+// the kernel took has completed, since the caller frees their buffers.
+static int
+run_operations(
+    struct IoRing *ring,
+    uint32_t const op_count,
+    IoPrepare prepare,
+    IoComplete complete,
+    struct IoRead *read)
+{
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+
+    while (completed < op_count) {
+        // only this thread produces, the kernel consumes up to the tail
+        uint32_t tail = *ring->sq_tail;
+        while (submitted < op_count && submitted - completed < ring->entry_count) {
+            uint32_t index = tail & *ring->sq_mask;
+            struct io_uring_sqe *sqe = &ring->sqes[index];
+            memset(sqe, 0, sizeof *sqe);
+            prepare(read, submitted, sqe);
+            sqe->user_data = submitted;
+            ring->sq_array[index] = index;
+            tail += 1;
+            submitted += 1;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // whatever an interrupted call left unconsumed is submitted again
+        uint32_t to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        long status = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        if (status < 0 && errno != EINTR) {
+            break;
+        }
+
+        completed += reap_completions(ring, complete, read);
+    }
+    if (completed == op_count) {
+        return 1;
+    }
+
+    // what the kernel has not taken yet is dropped, the rest is waited for;
+    // their completions still go through complete so opened files get closed
+    uint32_t sq_head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t taken = submitted - (*ring->sq_tail - sq_head);
+    __atomic_store_n(ring->sq_tail, sq_head, __ATOMIC_RELEASE);
+    completed += reap_completions(ring, complete, read);
+    while (completed < taken) {
+        long status = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        assert(status >= 0 || errno == EINTR || errno == EAGAIN || errno == EBUSY);
+        (void)status;
+        completed += reap_completions(ring, complete, read);
+    }
+
+    return 0;
+}
+
+static void
+prepare_statx(struct IoRead *read, uint32_t const index, struct io_uring_sqe *sqe)
+{
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)read->paths[index];
+    sqe->len = STATX_SIZE;
+    sqe->off = (uintptr_t)&read->stats[index];
+}
+
+static void
+complete_statx(struct IoRead *read, uint32_t const index, int32_t const result)
+{
+    if (result < 0 || !(read->stats[index].stx_mask & STATX_SIZE)) {
+        read->is_failed[index] = 1;
+    }
+}
+
+static void
+prepare_open(struct IoRead *read, uint32_t const index, struct io_uring_sqe *sqe)
+{
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)read->paths[read->group_files[index]];
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+static void
+complete_open(struct IoRead *read, uint32_t const index, int32_t const result)
+{
+    uint32_t file = read->group_files[index];
+    if (result < 0) {
+        read->is_failed[file] = 1;
+    } else {
+        read->fds[file] = result;
+    }
+}
+
+static void
+prepare_read(struct IoRead *read, uint32_t const index, struct io_uring_sqe *sqe)
+{
+    struct IoChunk const *chunk = &read->chunks[index];
+    char *data = read->batch->files[chunk->file].data;
+
+    sqe->opcode = *read->is_registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = read->fds[chunk->file];
+    sqe->addr = (uintptr_t)(data + chunk->offset);
+    sqe->len = chunk->size;
+    sqe->off = chunk->offset;
+    sqe->buf_index = 0;
+}
+
+static void
+complete_read(struct IoRead *read, uint32_t const index, int32_t const result)
+{
+    struct IoChunk const *chunk = &read->chunks[index];
+    // regular files only read short at the end, so the file has shrunk
+    if (result < 0 || (uint32_t)result != chunk->size) {
+        read->is_failed[chunk->file] = 1;
+    }
+}
+
+// opens and reads files [first, last), every file that is still fine
+static int
+read_group(struct IoRing *ring, struct IoRead *read, uint32_t const first, uint32_t const last)
+{
+    struct IoFile *files = read->batch->files;
+    uint32_t open_count = 0;
+    for (uint32_t i = first; i < last; i++) {
+        if (!read->is_failed[i] && files[i].size) {
+            read->group_files[open_count++] = i;
+        }
+    }
+    int is_run = run_operations(ring, open_count, prepare_open, complete_open, read);
+    if (!is_run) {
+        goto close_files;
+    }
+
+    uint32_t chunk_count = 0;
+    for (uint32_t i = 0; i < open_count; i++) {
+        uint32_t file = read->group_files[i];
+        if (read->fds[file] < 0) {
+            continue;
+        }
+        for (uint64_t offset = 0; offset < files[file].size; offset += READ_CHUNK_SIZE) {
+            uint64_t size = files[file].size - offset;
+            if (chunk_count == read->chunk_capacity) {
+                read->chunk_capacity = read->chunk_capacity ? 2 * read->chunk_capacity : 64;
+                read->chunks = realloc(read->chunks, read->chunk_capacity * sizeof *read->chunks);
+                assert(read->chunks);
+            }
+            read->chunks[chunk_count++] = (struct IoChunk){
+                .file = file,
+                .size = size < READ_CHUNK_SIZE ? size : READ_CHUNK_SIZE,
+                .offset = offset,
+            };
+        }
+    }
+    is_run = run_operations(ring, chunk_count, prepare_read, complete_read, read);
+
+  close_files:
+    for (uint32_t i = 0; i < open_count; i++) {
+        uint32_t file = read->group_files[i];
+        if (read->fds[file] >= 0) {
+            close(read->fds[file]);
+            read->fds[file] = -1;
+        }
+    }
+
+    return is_run;
+}
+
+int
+io_read_files_uring(uint32_t count, char const *const paths[], struct IoFileBatch *batch)
+{
+    struct IoRing ring;
+    if (!init_ring(&ring)) {
+        return 0;
+    }
+    if (!is_supporting_operations(&ring)) {
+        deinit_ring(&ring);
+        return 0;
+    }
+
+    uint8_t is_registered = 0;
+    struct IoRead read = {
+        .paths = paths,
+        .batch = batch,
+        .stats = calloc(count ? count : 1, sizeof *read.stats),
+        .fds = malloc((count ? count : 1) * sizeof *read.fds),
+        .is_failed = calloc(count ? count : 1, sizeof *read.is_failed),
+        .is_registered = &is_registered,
+        .group_files = malloc(GROUP_FILE_COUNT * sizeof *read.group_files),
+    };
+    assert(read.stats && read.fds && read.is_failed && read.group_files);
+    for (uint32_t i = 0; i < count; i++) {
+        read.fds[i] = -1;
+    }
+
+    int is_run = run_operations(&ring, count, prepare_statx, complete_statx, &read);
+
+    size_t storage_size = 0;
+    for (uint32_t i = 0; is_run && i < count; i++) {
+        if (!read.is_failed[i]) {
+            batch->files[i].size = read.stats[i].stx_size;
+            storage_size += align_storage(batch->files[i].size);
+        }
+    }
+    batch->storage = is_run ? aligned_alloc(STORAGE_ALIGNMENT, storage_size ? storage_size : STORAGE_ALIGNMENT) : 0;
+    assert(batch->storage || !is_run);
+
+    char *data = batch->storage;
+    for (uint32_t i = 0; is_run && i < count; i++) {
+        if (!read.is_failed[i]) {
+            batch->files[i].data = data;
+            data += align_storage(batch->files[i].size);
+        }
+    }
+
+    // fixed reads skip mapping the destination pages for every request,
+    // plain reads are used when the memory cannot be pinned
+    if (is_run && storage_size && storage_size <= MAX_REGISTERED_SIZE) {
+        struct iovec iov = { .iov_base = batch->storage, .iov_len = storage_size };
+        is_registered = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    }
+
+    for (uint32_t first = 0; is_run && first < count; first += GROUP_FILE_COUNT) {
+        uint32_t last = count - first < GROUP_FILE_COUNT ? count : first + GROUP_FILE_COUNT;
+        is_run = read_group(&ring, &read, first, last);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (read.is_failed[i]) {
+            batch->files[i].data = 0;
+            batch->files[i].size = 0;
+        } else {
+            batch->read_count += 1;
+        }
+    }
+
+    free(read.chunks);
+    free(read.group_files);
+    free(read.is_failed);
+    free(read.fds);
+    free(read.stats);
+    // unregisters the buffers
+    deinit_ring(&ring);
+
+    // the ring broke down half way, the caller starts over without it
+    if (!is_run) {
+        free(batch->storage);
+        batch->storage = 0;
+        batch->read_count = 0;
+        memset(batch->files, 0, count * sizeof *batch->files);
+    }
+
+    return is_run;
+}
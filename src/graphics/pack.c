@@ -0,0 +1,194 @@
+#ifdef __linux__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "graphics/pack.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error Unsupported OS
+#endif
+
+static int
+is_bucket_valid(struct IoPackEntry const *bucket, struct IoPackHeader const *header)
+{
+    if (!bucket->name_size) {
+        return 1;
+    }
+
+    return bucket->name_offset <= header->name_size
+        && bucket->name_size <= header->name_size - bucket->name_offset
+        && bucket->offset % IO_PACK_ALIGNMENT == 0
+        && bucket->offset <= header->file_size
+        && bucket->size <= header->file_size - bucket->offset;
+}
+
+static int
+parse_pack(struct IoPack *pack)
+{
+    struct IoPackHeader header;
+    if (pack->size < sizeof header) {
+        return 0;
+    }
+    memcpy(&header, pack->base, sizeof header);
+
+    if (memcmp(header.magic, IO_PACK_MAGIC, sizeof header.magic)
+        || header.endian_marker != IO_PACK_ENDIAN_MARKER
+        || header.version_major != IO_PACK_VERSION_MAJOR
+        || header.file_size != pack->size) {
+        return 0;
+    }
+
+    // a full table would never end a probe for a missing name
+    if (!header.bucket_count
+        || header.bucket_count & (header.bucket_count - 1)
+        || header.entry_count >= header.bucket_count) {
+        return 0;
+    }
+
+    uint64_t bucket_size = (uint64_t)header.bucket_count * sizeof *pack->buckets;
+    if (header.bucket_offset % sizeof(uint64_t)
+        || header.bucket_offset > pack->size
+        || bucket_size > pack->size - header.bucket_offset
+        || header.name_offset > pack->size
+        || header.name_size > pack->size - header.name_offset) {
+        return 0;
+    }
+    pack->entry_count = header.entry_count;
+    pack->bucket_count = header.bucket_count;
+    pack->buckets = (struct IoPackEntry const *)((char const *)pack->base + header.bucket_offset);
+    pack->names = (char const *)pack->base + header.name_offset;
+
+    uint32_t entry_count = 0;
+    for (uint32_t i = 0; i < pack->bucket_count; i++) {
+        if (!is_bucket_valid(&pack->buckets[i], &header)) {
+            return 0;
+        }
+        entry_count += pack->buckets[i].name_size != 0;
+    }
+
+    return entry_count == pack->entry_count;
+}
+
+uint64_t
+io_hash_pack_name(char const *name, size_t const size)
+{
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x100000001b3u;
+    }
+
+    return hash;
+}
+
+int
+io_map_pack(char const *path, struct IoPack *pack)
+{
+    memset(pack, 0, sizeof *pack);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        goto fail_open;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        goto fail_size;
+    }
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping) {
+        goto fail_size;
+    }
+    void *base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!base) {
+        CloseHandle(mapping);
+        goto fail_size;
+    }
+    pack->file_handle = file;
+    pack->mapping_handle = mapping;
+    pack->size = file_size.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file == -1) {
+        goto fail_open;
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) || file_stat.st_size == 0) {
+        goto fail_size;
+    }
+    void *base = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (base == MAP_FAILED) {
+        goto fail_size;
+    }
+    // the mapping keeps the file referenced
+    close(file);
+    pack->size = file_stat.st_size;
+#endif
+    pack->base = base;
+
+    if (!parse_pack(pack)) {
+        io_unmap_pack(pack);
+        return 0;
+    }
+
+    return 1;
+
+  fail_size:
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
+  fail_open:
+    return 0;
+}
+
+void
+io_unmap_pack(struct IoPack *pack)
+{
+    if (!pack->base) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(pack->base);
+    CloseHandle(pack->mapping_handle);
+    CloseHandle(pack->file_handle);
+#else
+    munmap(pack->base, pack->size);
+#endif
+    memset(pack, 0, sizeof *pack);
+}
+
+int
+io_find_pack_entry(struct IoPack const *pack, char const *name, uint64_t *offset, uint64_t *size)
+{
+    size_t name_size = strlen(name);
+    uint64_t hash = io_hash_pack_name(name, name_size);
+    uint32_t mask = pack->bucket_count - 1;
+
+    // the table is never full, so every probe ends at an empty bucket
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        struct IoPackEntry const *bucket = &pack->buckets[i];
+        if (!bucket->name_size) {
+            return 0;
+        }
+        if (bucket->hash == hash
+            && bucket->name_size == name_size
+            && !memcmp(pack->names + bucket->name_offset, name, name_size)) {
+            *offset = bucket->offset;
+            *size = bucket->size;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,313 @@
+#include "graphics/recorder.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+
+struct GfxWorker {
+    thrd_t thread;
+    uint32_t index;
+    // indexed by frame in flight
+    VkCommandPool *command_pools;
+    VkCommandBuffer *command_buffers;
+};
+
+static VkResult result;
+static VkDevice device;
+static uint32_t worker_count;
+static uint32_t frame_count;
+static struct GfxWorker *workers;
+static VkCommandBuffer *recorded;
+
+// job state, guarded by mutex
+static mtx_t mutex;
+static cnd_t job_ready;
+static cnd_t job_done;
+static int is_running;
+static uint64_t job_generation;
+static uint32_t job_pending;
+static uint32_t job_frame;
+static uint32_t job_slice_count;
+static struct GfxRecordInfo const *job_info;
+
+static void
+record_indirect_draw(
+    VkCommandBuffer const command_buffer,
+    struct GfxRecordInfo const *info,
+    struct GfxDrawItem const *draw,
+    int const is_indexed)
+{
+    VkDeviceSize offset = info->command_offset + (VkDeviceSize)draw->first * info->command_stride;
+    if (info->draw_mode == GFX_DRAW_MODE_INDIRECT_COUNT) {
+        VkDeviceSize count_offset = info->count_offset + draw->state * sizeof(uint32_t);
+        if (is_indexed) {
+            vkCmdDrawIndexedIndirectCountKHR(
+                command_buffer,
+                info->indirect_buffer,
+                offset,
+                info->indirect_buffer,
+                count_offset,
+                draw->count,
+                info->command_stride
+            );
+        } else {
+            vkCmdDrawIndirectCountKHR(
+                command_buffer,
+                info->indirect_buffer,
+                offset,
+                info->indirect_buffer,
+                count_offset,
+                draw->count,
+                info->command_stride
+            );
+        }
+    } else if (is_indexed) {
+        vkCmdDrawIndexedIndirect(command_buffer, info->indirect_buffer, offset, draw->count, info->command_stride);
+    } else {
+        vkCmdDrawIndirect(command_buffer, info->indirect_buffer, offset, draw->count, info->command_stride);
+    }
+}
+
+static void
+record_slice(struct GfxWorker *worker, uint32_t const frame, uint32_t const slice_count, struct GfxRecordInfo const *info)
+{
+    uint32_t first = (uint64_t)info->draw_count * worker->index / slice_count;
+    uint32_t last = (uint64_t)info->draw_count * (worker->index + 1) / slice_count;
+    VkCommandBuffer command_buffer = worker->command_buffers[frame];
+    // workers run concurrently so the module wide result is not used here
+    VkResult status;
+
+    // resetting the whole pool is cheaper than resetting single buffers
+    status = vkResetCommandPool(device, worker->command_pools[frame], 0);
+    assert(status == VK_SUCCESS);
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = info->render_pass,
+        .subpass = 0,
+        .framebuffer = info->framebuffer,
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+            | (info->is_executed_twice ? VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT : 0),
+        .pInheritanceInfo = &inheritance_info,
+    };
+
+    status = vkBeginCommandBuffer(command_buffer, &begin_info);
+    assert(status == VK_SUCCESS);
+
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = info->extent.width,
+        .height = info->extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    VkRect2D scissor = {
+        .offset = { 0, 0 },
+        .extent = info->extent,
+    };
+
+    VkDeviceSize offsets[1] = {0};
+    uint32_t dynamic_offsets[] = { info->uniform_offset, info->object_offset };
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &info->vertex_buffer, offsets);
+    // every pipeline shares the layout, so the set stays bound across them
+    vkCmdBindDescriptorSets(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        info->pipeline_layout,
+        0,
+        1,
+        &info->descriptor_set,
+        sizeof dynamic_offsets / sizeof *dynamic_offsets,
+        dynamic_offsets
+    );
+
+    uint32_t bound_state = UINT32_MAX;
+    for (uint32_t i = first; i < last; i++) {
+        struct GfxDrawItem const *draw = &info->draws[i];
+        struct GfxDrawState const *state = &info->states[draw->state];
+        if (draw->state != bound_state) {
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state->pipeline);
+            if (state->is_indexed) {
+                vkCmdBindIndexBuffer(command_buffer, info->vertex_buffer, 0, state->index_type);
+            }
+            bound_state = draw->state;
+        }
+
+        if (info->draw_mode != GFX_DRAW_MODE_DIRECT) {
+            record_indirect_draw(command_buffer, info, draw, state->is_indexed);
+        } else if (state->is_indexed) {
+            vkCmdDrawIndexed(
+                command_buffer,
+                draw->count,
+                draw->instance_count,
+                draw->first,
+                draw->vertex_offset,
+                draw->first_instance
+            );
+        } else {
+            vkCmdDraw(command_buffer, draw->count, draw->instance_count, draw->first, draw->first_instance);
+        }
+    }
+
+    status = vkEndCommandBuffer(command_buffer);
+    assert(status == VK_SUCCESS);
+    (void)status;
+}
+
+static int
+run_worker(void *arg)
+{
+    struct GfxWorker *worker = arg;
+    uint64_t generation = 0;
+
+    mtx_lock(&mutex);
+    for (;;) {
+        while (is_running && job_generation == generation) {
+            cnd_wait(&job_ready, &mutex);
+        }
+        if (!is_running) {
+            break;
+        }
+        generation = job_generation;
+
+        if (worker->index < job_slice_count) {
+            uint32_t frame = job_frame;
+            uint32_t slice_count = job_slice_count;
+            struct GfxRecordInfo const *info = job_info;
+            mtx_unlock(&mutex);
+            record_slice(worker, frame, slice_count, info);
+            mtx_lock(&mutex);
+        }
+
+        job_pending -= 1;
+        if (!job_pending) {
+            cnd_signal(&job_done);
+        }
+    }
+    mtx_unlock(&mutex);
+
+    return 0;
+}
+
+void
+gfx_recorder_init(VkDevice logical_device, uint32_t queue_family_index, uint32_t thread_count, uint32_t frames)
+{
+    device = logical_device;
+    worker_count = thread_count ? thread_count : 1;
+    frame_count = frames;
+    workers = calloc(worker_count, sizeof *workers);
+    recorded = malloc(worker_count * sizeof *recorded);
+    assert(workers && recorded);
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family_index,
+    };
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        workers[i].index = i;
+        workers[i].command_pools = malloc(frame_count * sizeof *workers[i].command_pools);
+        workers[i].command_buffers = malloc(frame_count * sizeof *workers[i].command_buffers);
+        assert(workers[i].command_pools && workers[i].command_buffers);
+
+        for (uint32_t j = 0; j < frame_count; j++) {
+            result = vkCreateCommandPool(device, &pool_info, 0, &workers[i].command_pools[j]);
+            assert(result == VK_SUCCESS);
+
+            VkCommandBufferAllocateInfo command_buffer_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = workers[i].command_pools[j],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+            result = vkAllocateCommandBuffers(device, &command_buffer_info, &workers[i].command_buffers[j]);
+            assert(result == VK_SUCCESS);
+        }
+    }
+
+    mtx_init(&mutex, mtx_plain);
+    cnd_init(&job_ready);
+    cnd_init(&job_done);
+    is_running = 1;
+    job_generation = 0;
+
+    // worker 0 is the thread calling gfx_recorder_record
+    for (uint32_t i = 1; i < worker_count; i++) {
+        int status = thrd_create(&workers[i].thread, run_worker, &workers[i]);
+        assert(status == thrd_success);
+    }
+}
+
+void
+gfx_recorder_deinit(void)
+{
+    mtx_lock(&mutex);
+    is_running = 0;
+    cnd_broadcast(&job_ready);
+    mtx_unlock(&mutex);
+
+    for (uint32_t i = 1; i < worker_count; i++) {
+        thrd_join(workers[i].thread, 0);
+    }
+
+    for (uint32_t i = 0; i < worker_count; i++) {
+        for (uint32_t j = 0; j < frame_count; j++) {
+            vkDestroyCommandPool(device, workers[i].command_pools[j], 0);
+        }
+        free(workers[i].command_pools);
+        free(workers[i].command_buffers);
+    }
+
+    cnd_destroy(&job_done);
+    cnd_destroy(&job_ready);
+    mtx_destroy(&mutex);
+    free(recorded);
+    free(workers);
+}
+
+VkCommandBuffer const *
+gfx_recorder_record(uint32_t frame, struct GfxRecordInfo const *info, uint32_t *count)
+{
+    uint32_t slice_count = info->draw_count < worker_count ? info->draw_count : worker_count;
+    if (slice_count == 0) {
+        *count = 0;
+        return recorded;
+    }
+
+    if (slice_count > 1) {
+        mtx_lock(&mutex);
+        job_frame = frame;
+        job_slice_count = slice_count;
+        job_info = info;
+        job_pending = worker_count - 1;
+        job_generation += 1;
+        cnd_broadcast(&job_ready);
+        mtx_unlock(&mutex);
+    }
+
+    record_slice(&workers[0], frame, slice_count, info);
+
+    if (slice_count > 1) {
+        mtx_lock(&mutex);
+        while (job_pending) {
+            cnd_wait(&job_done, &mutex);
+        }
+        mtx_unlock(&mutex);
+    }
+
+    for (uint32_t i = 0; i < slice_count; i++) {
+        recorded[i] = workers[i].command_buffers[frame];
+    }
+    *count = slice_count;
+
+    return recorded;
+}
@@ -0,0 +1,970 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include "common/bvh.h"
+#include "game/io.h"
+#include "graphics/io.h"
+#include "graphics/vertex.h"
+
+// flicker-meshc converts a binary stl into a .vertex container. It produces
+// the same bytes as script/create_meshes.py: every floating point expression
+// below is evaluated in the same order as in the script, so keep the two in
+// sync when changing either.
+
+#define STL_HEADER_SIZE 80
+#define STL_TRIANGLE_SIZE 50
+// triangles each thread decodes per chunk, bounds the read buffer
+#define CHUNK_TRIANGLE_COUNT (64 * 1024)
+#define DEFAULT_THREAD_COUNT 4
+#define MAX_THREAD_COUNT 64
+
+// vertex cache model used by the optimizer (Forsyth's LRU) and by the FIFO
+// statistics, see script/create_meshes.py
+#define OPTIMIZER_CACHE_SIZE 32
+#define STATISTICS_CACHE_SIZE 16
+#define OVERDRAW_THRESHOLD 1.05
+
+struct Triangle {
+    float pos[3][3];
+    float centroid[3];
+};
+
+struct DecodeJob {
+    thrd_t thread;
+    uint8_t const *records;
+    uint32_t count;
+    struct Triangle *triangles;
+};
+
+// open addressing table of vertex indices, keyed by position or by the
+// whole vertex depending on is_position_key
+struct VertexTable {
+    struct Vertex const *vertices;
+    int is_position_key;
+    uint32_t capacity;
+    // vertex index + 1, 0 marks an empty slot
+    uint32_t *slots;
+};
+
+struct FifoCache {
+    uint32_t entries[STATISTICS_CACHE_SIZE];
+    uint32_t count;
+    uint32_t next;
+};
+
+struct Cluster {
+    // negated occlusion, clusters sort ascending like the script's tuples
+    double key;
+    uint32_t start;
+    uint32_t end;
+};
+
+struct Mesh {
+    uint32_t triangle_count;
+    uint32_t vertex_count;
+    struct Vertex *vertices;
+    uint32_t *indices;
+    struct IoMeshBounds bounds;
+};
+
+/* Private Functions */
+
+static int
+decode_triangles(void *arg)
+{
+    struct DecodeJob *job = arg;
+
+    for (uint32_t i = 0; i < job->count; i++) {
+        struct Triangle *triangle = &job->triangles[i];
+        // skip the facet normal, the records are not 4 byte aligned
+        memcpy(triangle->pos, job->records + (size_t)i * STL_TRIANGLE_SIZE + 12, sizeof triangle->pos);
+        for (int j = 0; j < 3; j++) {
+            double sum = (double)triangle->pos[0][j] + triangle->pos[1][j] + triangle->pos[2][j];
+            triangle->centroid[j] = (float)(sum / 3.0);
+        }
+    }
+
+    return 0;
+}
+
+// Streams the records in chunks, each chunk is decoded by all threads.
+// *triangles is 0 unless the result is IO_RESULT_OK.
+static enum IoResult
+read_stl(struct IoReader *stl, uint32_t const thread_count, uint32_t *triangle_count, struct Triangle **triangles)
+{
+    *triangles = 0;
+    uint8_t header[STL_HEADER_SIZE + 4];
+    enum IoResult result = io_read(stl, sizeof header, header);
+    if (result != IO_RESULT_OK) {
+        return result;
+    }
+    uint32_t count = header[STL_HEADER_SIZE]
+        | (uint32_t)header[STL_HEADER_SIZE + 1] << 8
+        | (uint32_t)header[STL_HEADER_SIZE + 2] << 16
+        | (uint32_t)header[STL_HEADER_SIZE + 3] << 24;
+
+    // the weld tables keep two 32 bit slots per triangle corner
+    if (count > UINT32_MAX / 6) {
+        return IO_RESULT_INVALID;
+    }
+    // a truncated file fails before decoding anything, one that changes
+    // while being read fails on the short read
+    if (stl->size < sizeof header + (uint64_t)count * STL_TRIANGLE_SIZE) {
+        return IO_RESULT_SHORT_READ;
+    }
+
+    size_t chunk_count = (size_t)CHUNK_TRIANGLE_COUNT * thread_count;
+    uint8_t *records = malloc(chunk_count * STL_TRIANGLE_SIZE);
+    struct Triangle *decoded = malloc((count ? count : 1) * sizeof *decoded);
+    assert(records && decoded);
+
+    struct DecodeJob jobs[MAX_THREAD_COUNT];
+    for (uint32_t first = 0; first < count;) {
+        uint32_t n = count - first < chunk_count ? count - first : chunk_count;
+        result = io_read(stl, (size_t)n * STL_TRIANGLE_SIZE, records);
+        if (result != IO_RESULT_OK) {
+            free(decoded);
+            decoded = 0;
+            break;
+        }
+
+        // thread 0 is the calling thread
+        for (uint32_t i = 0; i < thread_count; i++) {
+            uint32_t begin = (uint64_t)n * i / thread_count;
+            uint32_t end = (uint64_t)n * (i + 1) / thread_count;
+            jobs[i] = (struct DecodeJob){
+                .records = records + (size_t)begin * STL_TRIANGLE_SIZE,
+                .count = end - begin,
+                .triangles = decoded + first + begin,
+            };
+            if (i) {
+                int status = thrd_create(&jobs[i].thread, decode_triangles, &jobs[i]);
+                assert(status == thrd_success);
+                (void)status;
+            }
+        }
+        decode_triangles(&jobs[0]);
+        for (uint32_t i = 1; i < thread_count; i++) {
+            thrd_join(jobs[i].thread, 0);
+        }
+
+        first += n;
+    }
+
+    free(records);
+    *triangle_count = count;
+    *triangles = decoded;
+
+    return result;
+}
+
+static uint32_t
+hash_floats(float const *values, int const count)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < count; i++) {
+        // -0.0 and 0.0 compare equal, so they have to hash equal too
+        float value = values[i] == 0.0f ? 0.0f : values[i];
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof bits);
+        hash = (hash ^ bits) * 16777619u;
+        hash ^= hash >> 15;
+    }
+
+    return hash;
+}
+
+static int
+is_key_equal(struct VertexTable const *table, uint32_t const index, struct Vertex const *key)
+{
+    struct Vertex const *vertex = &table->vertices[index];
+    int is_equal = vertex->pos.x == key->pos.x && vertex->pos.y == key->pos.y && vertex->pos.z == key->pos.z;
+    if (!table->is_position_key) {
+        is_equal = is_equal
+            && vertex->centroid.x == key->centroid.x
+            && vertex->centroid.y == key->centroid.y
+            && vertex->centroid.z == key->centroid.z;
+    }
+
+    return is_equal;
+}
+
+static uint32_t *
+find_slot(struct VertexTable const *table, struct Vertex const *key)
+{
+    float values[6] = {
+        key->pos.x, key->pos.y, key->pos.z,
+        key->centroid.x, key->centroid.y, key->centroid.z,
+    };
+    uint32_t mask = table->capacity - 1;
+    uint32_t slot = hash_floats(values, table->is_position_key ? 3 : 6) & mask;
+
+    while (table->slots[slot] && !is_key_equal(table, table->slots[slot] - 1, key)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return &table->slots[slot];
+}
+
+static void
+init_vertex_table(struct VertexTable *table, struct Vertex const *vertices, int const is_position_key, uint32_t const max_count)
+{
+    uint32_t capacity = 16;
+    while (capacity < 2ull * max_count) {
+        capacity *= 2;
+    }
+
+    table->vertices = vertices;
+    table->is_position_key = is_position_key;
+    table->capacity = capacity;
+    table->slots = calloc(capacity, sizeof *table->slots);
+    assert(table->slots);
+}
+
+// Same as the script's add_vertex: the vertex is only appended when no equal
+// one exists and the first vertex at a position is the one others reuse.
+static uint32_t
+add_vertex(struct Mesh *mesh, struct VertexTable *by_key, struct VertexTable *by_position, struct Vertex const *vertex)
+{
+    uint32_t *key_slot = find_slot(by_key, vertex);
+    if (!*key_slot) {
+        mesh->vertices[mesh->vertex_count] = *vertex;
+        *key_slot = ++mesh->vertex_count;
+    }
+
+    uint32_t *position_slot = find_slot(by_position, vertex);
+    if (!*position_slot) {
+        *position_slot = *key_slot;
+    }
+
+    return *key_slot - 1;
+}
+
+static void
+build_vertices(struct Mesh *mesh, struct Triangle const *triangles)
+{
+    uint32_t corner_count = 3 * mesh->triangle_count;
+    struct VertexTable by_key;
+    struct VertexTable by_position;
+
+    mesh->vertex_count = 0;
+    mesh->vertices = malloc((corner_count ? corner_count : 1) * sizeof *mesh->vertices);
+    mesh->indices = malloc((corner_count ? corner_count : 1) * sizeof *mesh->indices);
+    assert(mesh->vertices && mesh->indices);
+    init_vertex_table(&by_key, mesh->vertices, 0, corner_count);
+    init_vertex_table(&by_position, mesh->vertices, 1, corner_count);
+
+    for (uint32_t t = 0; t < mesh->triangle_count; t++) {
+        struct Triangle const *triangle = &triangles[t];
+        struct Vertex corners[3];
+        for (int i = 0; i < 3; i++) {
+            memcpy(&corners[i].pos, triangle->pos[i], sizeof corners[i].pos);
+            memcpy(&corners[i].centroid, triangle->centroid, sizeof corners[i].centroid);
+        }
+
+        // rotate the provoking corner onto a position without a vertex yet
+        int first = 0;
+        for (int i = 0; i < 3; i++) {
+            if (!*find_slot(&by_position, &corners[i])) {
+                first = i;
+                break;
+            }
+        }
+
+        uint32_t *indices = &mesh->indices[3 * t];
+        indices[0] = add_vertex(mesh, &by_key, &by_position, &corners[first]);
+        for (int i = 1; i < 3; i++) {
+            struct Vertex const *corner = &corners[(first + i) % 3];
+            uint32_t slot = *find_slot(&by_position, corner);
+            indices[i] = slot ? slot - 1 : add_vertex(mesh, &by_key, &by_position, corner);
+        }
+    }
+
+    free(by_position.slots);
+    free(by_key.slots);
+}
+
+static void
+build_bounds(struct Mesh *mesh, struct Triangle const *triangles)
+{
+    memset(&mesh->bounds, 0, sizeof mesh->bounds);
+    if (!mesh->triangle_count) {
+        return;
+    }
+
+    memcpy(mesh->bounds.min, triangles[0].pos[0], sizeof mesh->bounds.min);
+    memcpy(mesh->bounds.max, triangles[0].pos[0], sizeof mesh->bounds.max);
+    for (uint32_t t = 0; t < mesh->triangle_count; t++) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                float value = triangles[t].pos[i][j];
+                if (value < mesh->bounds.min[j]) {
+                    mesh->bounds.min[j] = value;
+                }
+                if (value > mesh->bounds.max[j]) {
+                    mesh->bounds.max[j] = value;
+                }
+            }
+        }
+    }
+}
+
+static int
+fifo_cache_contains(struct FifoCache const *cache, uint32_t const vertex)
+{
+    for (uint32_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i] == vertex) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// returns 1 when the vertex was not cached
+static int
+fifo_cache_access(struct FifoCache *cache, uint32_t const vertex)
+{
+    if (fifo_cache_contains(cache, vertex)) {
+        return 0;
+    }
+
+    if (cache->count < STATISTICS_CACHE_SIZE) {
+        cache->entries[cache->count++] = vertex;
+    } else {
+        cache->entries[cache->next] = vertex;
+        cache->next = (cache->next + 1) % STATISTICS_CACHE_SIZE;
+    }
+
+    return 1;
+}
+
+// vertices a FIFO post transform cache shades for triangles [start, end)
+static uint32_t
+transformed_vertex_count(uint32_t const *indices, uint32_t const start, uint32_t const end)
+{
+    struct FifoCache cache = {0};
+    uint32_t misses = 0;
+
+    for (uint32_t i = 3 * start; i < 3 * end; i++) {
+        misses += fifo_cache_access(&cache, indices[i]);
+    }
+
+    return misses;
+}
+
+static void
+print_cache_statistics(char const *name, struct Mesh const *mesh)
+{
+    double misses = transformed_vertex_count(mesh->indices, 0, mesh->triangle_count);
+    printf(
+        "    %-10s ACMR %.3f  ATVR %.3f\n",
+        name,
+        misses / (mesh->triangle_count ? mesh->triangle_count : 1),
+        misses / (mesh->vertex_count ? mesh->vertex_count : 1)
+    );
+}
+
+static double
+forsyth_vertex_score(int32_t const cache_position, uint32_t const valence)
+{
+    if (valence == 0) {
+        return -1.0;
+    }
+
+    double score = 0.0;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            // the last triangle's vertices, deliberately not the best choice
+            score = 0.75;
+        } else {
+            score = pow(1.0 - (double)(cache_position - 3) / (OPTIMIZER_CACHE_SIZE - 3), 1.5);
+        }
+    }
+    // favour vertices with few triangles left so they get finished off
+    return score + 2.0 * pow(valence, -0.5);
+}
+
+static int
+compare_uint32(void const *a, void const *b)
+{
+    uint32_t x = *(uint32_t const *)a;
+    uint32_t y = *(uint32_t const *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Tom Forsyth's linear speed vertex cache optimisation, only the triangle
+// order changes so the provoking vertex stays first.
+static void
+optimize_vertex_cache(struct Mesh *mesh)
+{
+    uint32_t triangle_count = mesh->triangle_count;
+    uint32_t vertex_count = mesh->vertex_count;
+    uint32_t const *indices = mesh->indices;
+
+    // triangles per vertex, the first valence[v] entries are not emitted yet
+    uint32_t *first_triangle = calloc(vertex_count + 1, sizeof *first_triangle);
+    uint32_t *valence = calloc(vertex_count ? vertex_count : 1, sizeof *valence);
+    uint32_t *vertex_triangles = malloc((triangle_count ? 3 * triangle_count : 1) * sizeof *vertex_triangles);
+    int32_t *cache_position = malloc((vertex_count ? vertex_count : 1) * sizeof *cache_position);
+    double *vertex_score = malloc((vertex_count ? vertex_count : 1) * sizeof *vertex_score);
+    uint8_t *is_emitted = calloc(triangle_count ? triangle_count : 1, sizeof *is_emitted);
+    uint32_t *order = malloc((triangle_count ? 3 * triangle_count : 1) * sizeof *order);
+    assert(first_triangle && valence && vertex_triangles && cache_position && vertex_score && is_emitted && order);
+
+    for (uint32_t i = 0; i < 3 * triangle_count; i++) {
+        valence[indices[i]] += 1;
+    }
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        first_triangle[v + 1] = first_triangle[v] + valence[v];
+        valence[v] = 0;
+    }
+    for (uint32_t i = 0; i < 3 * triangle_count; i++) {
+        uint32_t v = indices[i];
+        vertex_triangles[first_triangle[v] + valence[v]++] = i / 3;
+    }
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        cache_position[v] = -1;
+        vertex_score[v] = forsyth_vertex_score(-1, valence[v]);
+    }
+
+    int64_t best = -1;
+    double best_score = 0.0;
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        uint32_t const *triangle = &indices[3 * t];
+        double score = vertex_score[triangle[0]] + vertex_score[triangle[1]] + vertex_score[triangle[2]];
+        if (best < 0 || score > best_score) {
+            best = t;
+            best_score = score;
+        }
+    }
+
+    uint32_t cache[OPTIMIZER_CACHE_SIZE + 3];
+    uint32_t cache_count = 0;
+    uint32_t touched_capacity = 64;
+    uint32_t *touched = malloc(touched_capacity * sizeof *touched);
+    assert(touched);
+    uint32_t next_unemitted = 0;
+
+    for (uint32_t emitted = 0; emitted < triangle_count; emitted++) {
+        if (best < 0) {
+            // nothing in the cache touches a triangle left, start elsewhere
+            while (is_emitted[next_unemitted]) {
+                next_unemitted += 1;
+            }
+            best = next_unemitted;
+        }
+
+        uint32_t const *triangle = &indices[3 * best];
+        is_emitted[best] = 1;
+        memcpy(&order[3 * emitted], triangle, 3 * sizeof *order);
+        for (int i = 0; i < 3; i++) {
+            uint32_t v = triangle[i];
+            uint32_t *list = &vertex_triangles[first_triangle[v]];
+            for (uint32_t j = 0; j < valence[v]; j++) {
+                if (list[j] == best) {
+                    list[j] = list[--valence[v]];
+                    break;
+                }
+            }
+        }
+
+        // the triangle's distinct vertices move to the front of the cache
+        uint32_t next_cache[OPTIMIZER_CACHE_SIZE + 3];
+        uint32_t next_count = 0;
+        for (int i = 0; i < 3; i++) {
+            if ((i < 1 || triangle[i] != triangle[0]) && (i < 2 || triangle[i] != triangle[1])) {
+                next_cache[next_count++] = triangle[i];
+            }
+        }
+        for (uint32_t i = 0; i < cache_count; i++) {
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2]) {
+                next_cache[next_count++] = cache[i];
+            }
+        }
+        for (uint32_t i = OPTIMIZER_CACHE_SIZE; i < next_count; i++) {
+            cache_position[next_cache[i]] = -1;
+        }
+        for (uint32_t i = 0; i < next_count && i < OPTIMIZER_CACHE_SIZE; i++) {
+            cache_position[next_cache[i]] = i;
+        }
+
+        uint32_t touched_count = 0;
+        for (uint32_t i = 0; i < next_count; i++) {
+            uint32_t v = next_cache[i];
+            vertex_score[v] = forsyth_vertex_score(cache_position[v], valence[v]);
+            if (touched_count + valence[v] > touched_capacity) {
+                while (touched_count + valence[v] > touched_capacity) {
+                    touched_capacity *= 2;
+                }
+                touched = realloc(touched, touched_capacity * sizeof *touched);
+                assert(touched);
+            }
+            memcpy(&touched[touched_count], &vertex_triangles[first_triangle[v]], valence[v] * sizeof *touched);
+            touched_count += valence[v];
+        }
+        cache_count = next_count < OPTIMIZER_CACHE_SIZE ? next_count : OPTIMIZER_CACHE_SIZE;
+        memcpy(cache, next_cache, cache_count * sizeof *cache);
+
+        // ascending order makes ties deterministic, matching the script
+        qsort(touched, touched_count, sizeof *touched, compare_uint32);
+        best = -1;
+        best_score = -1.0;
+        for (uint32_t i = 0; i < touched_count; i++) {
+            uint32_t t = touched[i];
+            if (i && t == touched[i - 1]) {
+                continue;
+            }
+            uint32_t const *candidate = &indices[3 * t];
+            double score = vertex_score[candidate[0]] + vertex_score[candidate[1]] + vertex_score[candidate[2]];
+            if (score > best_score) {
+                best = t;
+                best_score = score;
+            }
+        }
+    }
+
+    free(mesh->indices);
+    mesh->indices = order;
+
+    free(touched);
+    free(is_emitted);
+    free(vertex_score);
+    free(cache_position);
+    free(vertex_triangles);
+    free(valence);
+    free(first_triangle);
+}
+
+// Splits the cache optimized order into clusters that can be reordered
+// without losing more than OVERDRAW_THRESHOLD of cache efficiency (Sander et
+// al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+static uint32_t *
+cluster_boundaries(struct Mesh const *mesh, uint32_t *boundary_count)
+{
+    uint32_t triangle_count = mesh->triangle_count;
+    uint32_t const *indices = mesh->indices;
+    uint32_t *hard = malloc((triangle_count + 2) * sizeof *hard);
+    uint32_t *boundaries = malloc((triangle_count + 2) * sizeof *boundaries);
+    uint32_t hard_count = 0;
+    uint32_t count = 0;
+    assert(hard && boundaries);
+
+    // hard boundaries where the cache starts over, every corner missed
+    struct FifoCache cache = {0};
+    hard[hard_count++] = 0;
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        uint32_t const *triangle = &indices[3 * t];
+        int is_cold = !fifo_cache_contains(&cache, triangle[0])
+            && !fifo_cache_contains(&cache, triangle[1])
+            && !fifo_cache_contains(&cache, triangle[2]);
+        if (t && is_cold) {
+            hard[hard_count++] = t;
+        }
+        for (int i = 0; i < 3; i++) {
+            fifo_cache_access(&cache, triangle[i]);
+        }
+    }
+    hard[hard_count++] = triangle_count;
+
+    // soft boundaries inside each hard cluster, wherever the cluster so far
+    // is already within the threshold of the whole cluster's ACMR
+    for (uint32_t h = 0; h + 1 < hard_count; h++) {
+        uint32_t start = hard[h];
+        uint32_t end = hard[h + 1];
+        double threshold = OVERDRAW_THRESHOLD * transformed_vertex_count(indices, start, end) / (end - start);
+        boundaries[count++] = start;
+
+        struct FifoCache cluster_cache = {0};
+        uint32_t misses = 0;
+        uint32_t cluster_start = start;
+        for (uint32_t t = start; t < end; t++) {
+            for (int i = 0; i < 3; i++) {
+                misses += fifo_cache_access(&cluster_cache, indices[3 * t + i]);
+            }
+            if (t + 1 < end && (double)misses / (t + 1 - cluster_start) <= threshold) {
+                boundaries[count++] = t + 1;
+                memset(&cluster_cache, 0, sizeof cluster_cache);
+                misses = 0;
+                cluster_start = t + 1;
+            }
+        }
+    }
+    boundaries[count++] = triangle_count;
+
+    free(hard);
+    *boundary_count = count;
+
+    return boundaries;
+}
+
+static int
+compare_cluster(void const *a, void const *b)
+{
+    struct Cluster const *x = a;
+    struct Cluster const *y = b;
+
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Draws clusters facing away from the mesh center first, they are the most
+// likely to occlude the rest. Returns the number of clusters.
+static uint32_t
+optimize_overdraw(struct Mesh *mesh)
+{
+    uint32_t boundary_count;
+    uint32_t *boundaries = cluster_boundaries(mesh, &boundary_count);
+    uint32_t cluster_count = boundary_count - 1;
+    struct Cluster *clusters = malloc((cluster_count ? cluster_count : 1) * sizeof *clusters);
+    assert(clusters);
+
+    double mesh_center[3] = {0.0, 0.0, 0.0};
+    for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+        mesh_center[0] += mesh->vertices[v].pos.x;
+        mesh_center[1] += mesh->vertices[v].pos.y;
+        mesh_center[2] += mesh->vertices[v].pos.z;
+    }
+    for (int i = 0; i < 3; i++) {
+        mesh_center[i] /= mesh->vertex_count ? mesh->vertex_count : 1;
+    }
+
+    for (uint32_t c = 0; c < cluster_count; c++) {
+        double area_center[3] = {0.0, 0.0, 0.0};
+        double normal[3] = {0.0, 0.0, 0.0};
+        double area_sum = 0.0;
+
+        for (uint32_t t = boundaries[c]; t < boundaries[c + 1]; t++) {
+            struct VertexPos const *corners[3];
+            for (int i = 0; i < 3; i++) {
+                corners[i] = &mesh->vertices[mesh->indices[3 * t + i]].pos;
+            }
+            double a[3] = { corners[0]->x, corners[0]->y, corners[0]->z };
+            double b[3] = { corners[1]->x, corners[1]->y, corners[1]->z };
+            double d[3] = { corners[2]->x, corners[2]->y, corners[2]->z };
+            double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            double w[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+            double n[3] = {
+                u[1] * w[2] - u[2] * w[1],
+                u[2] * w[0] - u[0] * w[2],
+                u[0] * w[1] - u[1] * w[0],
+            };
+            double area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int i = 0; i < 3; i++) {
+                area_center[i] += area * (a[i] + b[i] + d[i]) / 3;
+                normal[i] += n[i];
+            }
+            area_sum += area;
+        }
+
+        if (area_sum != 0.0) {
+            for (int i = 0; i < 3; i++) {
+                area_center[i] /= area_sum;
+            }
+        }
+        double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length == 0.0) {
+            length = 1.0;
+        }
+        double occlusion = 0.0;
+        for (int i = 0; i < 3; i++) {
+            occlusion += (area_center[i] - mesh_center[i]) * normal[i] / length;
+        }
+
+        clusters[c] = (struct Cluster){ .key = -occlusion, .start = boundaries[c], .end = boundaries[c + 1] };
+    }
+
+    qsort(clusters, cluster_count, sizeof *clusters, compare_cluster);
+
+    uint32_t *indices = malloc((mesh->triangle_count ? 3 * mesh->triangle_count : 1) * sizeof *indices);
+    assert(indices);
+    uint32_t offset = 0;
+    for (uint32_t c = 0; c < cluster_count; c++) {
+        uint32_t count = 3 * (clusters[c].end - clusters[c].start);
+        memcpy(&indices[offset], &mesh->indices[3 * clusters[c].start], count * sizeof *indices);
+        offset += count;
+    }
+    free(mesh->indices);
+    mesh->indices = indices;
+
+    free(clusters);
+    free(boundaries);
+
+    return cluster_count;
+}
+
+// renumbers the vertices in the order the indices first use them so vertex
+// fetches walk memory forward
+static void
+optimize_vertex_fetch(struct Mesh *mesh)
+{
+    uint32_t *remap = malloc((mesh->vertex_count ? mesh->vertex_count : 1) * sizeof *remap);
+    struct Vertex *vertices = malloc((mesh->vertex_count ? mesh->vertex_count : 1) * sizeof *vertices);
+    assert(remap && vertices);
+    memset(remap, 0xff, mesh->vertex_count * sizeof *remap);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 3 * mesh->triangle_count; i++) {
+        uint32_t v = mesh->indices[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = count;
+            vertices[count++] = mesh->vertices[v];
+        }
+        mesh->indices[i] = remap[v];
+    }
+
+    free(mesh->vertices);
+    mesh->vertices = vertices;
+    mesh->vertex_count = count;
+    free(remap);
+}
+
+// struct VertexQuantized records, positions snorm and centroids 10 bit unorm
+// relative to the bounds, rounded as floor(x + 0.5) like the script
+static struct VertexQuantized *
+quantize_vertices(struct Mesh const *mesh)
+{
+    struct VertexQuantized *quantized = calloc(mesh->vertex_count ? mesh->vertex_count : 1, sizeof *quantized);
+    assert(quantized);
+
+    for (uint32_t v = 0; v < mesh->vertex_count; v++) {
+        struct Vertex const *vertex = &mesh->vertices[v];
+        float pos[3] = { vertex->pos.x, vertex->pos.y, vertex->pos.z };
+        float centroid[3] = { vertex->centroid.x, vertex->centroid.y, vertex->centroid.z };
+        int16_t quantized_pos[3] = {0};
+        for (int i = 0; i < 3; i++) {
+            double low = mesh->bounds.min[i];
+            double extent = (double)mesh->bounds.max[i] - low;
+            if (!(extent > 0.0)) {
+                continue;
+            }
+
+            double snorm = floor(((pos[i] - low) / extent * 2 - 1) * 32767 + 0.5);
+            quantized_pos[i] = snorm < -32767 ? -32767 : snorm > 32767 ? 32767 : (int16_t)snorm;
+            double unorm = floor((centroid[i] - low) / extent * 1023 + 0.5);
+            uint32_t value = unorm < 0 ? 0 : unorm > 1023 ? 1023 : (uint32_t)unorm;
+            quantized[v].centroid |= value << (10 * i);
+        }
+        quantized[v].pos.x = quantized_pos[0];
+        quantized[v].pos.y = quantized_pos[1];
+        quantized[v].pos.z = quantized_pos[2];
+    }
+
+    return quantized;
+}
+
+// Boxes around each chunk of BVH_CHUNK_TRIANGLE_COUNT triangles in the final
+// order, grown by twice the largest quantization error so they also enclose
+// the dequantized positions, then the BVH over them.
+static uint32_t
+build_bvh(struct Mesh const *mesh, uint32_t const thread_count, struct BvhNode **nodes, uint32_t **primitives)
+{
+    uint32_t chunk_count = (mesh->triangle_count + BVH_CHUNK_TRIANGLE_COUNT - 1) / BVH_CHUNK_TRIANGLE_COUNT;
+    struct BvhBox *boxes = malloc((chunk_count ? chunk_count : 1) * sizeof *boxes);
+    *nodes = malloc((chunk_count ? 2 * chunk_count - 1 : 1) * sizeof **nodes);
+    *primitives = malloc((chunk_count ? chunk_count : 1) * sizeof **primitives);
+    assert(boxes && *nodes && *primitives);
+
+    double pad[3];
+    for (int i = 0; i < 3; i++) {
+        pad[i] = ((double)mesh->bounds.max[i] - mesh->bounds.min[i]) / 32767;
+    }
+
+    for (uint32_t c = 0; c < chunk_count; c++) {
+        float low[3] = {INFINITY, INFINITY, INFINITY};
+        float high[3] = {-INFINITY, -INFINITY, -INFINITY};
+        uint32_t end = (c + 1) * BVH_CHUNK_TRIANGLE_COUNT;
+        end = end < mesh->triangle_count ? end : mesh->triangle_count;
+        for (uint32_t i = 3 * c * BVH_CHUNK_TRIANGLE_COUNT; i < 3 * end; i++) {
+            struct VertexPos const *pos = &mesh->vertices[mesh->indices[i]].pos;
+            float values[3] = { pos->x, pos->y, pos->z };
+            for (int j = 0; j < 3; j++) {
+                low[j] = values[j] < low[j] ? values[j] : low[j];
+                high[j] = values[j] > high[j] ? values[j] : high[j];
+            }
+        }
+        for (int j = 0; j < 3; j++) {
+            boxes[c].min[j] = (float)(low[j] - pad[j]);
+            boxes[c].max[j] = (float)(high[j] + pad[j]);
+        }
+    }
+
+    uint32_t node_count = bvh_build(chunk_count, boxes, thread_count, *nodes, *primitives);
+    free(boxes);
+
+    return node_count;
+}
+
+static size_t
+align_up(size_t const offset)
+{
+    return (offset + IO_MESH_ALIGNMENT - 1) & ~(size_t)(IO_MESH_ALIGNMENT - 1);
+}
+
+static int
+write_padding(FILE *out, size_t size)
+{
+    static uint8_t const zeros[IO_MESH_ALIGNMENT];
+    return fwrite(zeros, 1, size, out) == size;
+}
+
+// The sections are written in the order given, payloads 16 byte aligned and
+// the section table last, like the script's write_container.
+static int
+write_container(FILE *out, uint32_t const section_count, struct IoMeshSection sections[], void const *payloads[])
+{
+    size_t offset = align_up(sizeof(struct IoMeshHeader));
+    for (uint32_t i = 0; i < section_count; i++) {
+        sections[i].offset = offset;
+        sections[i].checksum = io_crc32(payloads[i], sections[i].size);
+        sections[i].reserved = 0;
+        offset = align_up(offset + sections[i].size);
+    }
+
+    struct IoMeshHeader header = {
+        .version_major = IO_MESH_VERSION_MAJOR,
+        .version_minor = IO_MESH_VERSION_MINOR,
+        .endian_marker = IO_MESH_ENDIAN_MARKER,
+        .section_count = section_count,
+        .section_table_offset = offset,
+        .file_size = offset + section_count * sizeof *sections,
+    };
+    memcpy(header.magic, IO_MESH_MAGIC, sizeof header.magic);
+
+    int is_written = fwrite(&header, sizeof header, 1, out) == 1;
+    size_t position = sizeof header;
+    for (uint32_t i = 0; i < section_count; i++) {
+        is_written = is_written
+            && write_padding(out, sections[i].offset - position)
+            && fwrite(payloads[i], 1, sections[i].size, out) == sections[i].size;
+        position = sections[i].offset + sections[i].size;
+    }
+    is_written = is_written
+        && write_padding(out, header.section_table_offset - position)
+        && fwrite(sections, sizeof *sections, section_count, out) == section_count;
+
+    return is_written;
+}
+
+static char const *
+get_file_name(char const *path)
+{
+    char const *name = path;
+    for (char const *c = path; *c; c++) {
+        if (*c == '/' || *c == '\\') {
+            name = c + 1;
+        }
+    }
+
+    return name;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t thread_count = argc > 3 ? strtoul(argv[3], 0, 10) : DEFAULT_THREAD_COUNT;
+    if (argc < 3 || thread_count == 0 || thread_count > MAX_THREAD_COUNT) {
+        fprintf(stderr, "usage: %s input.stl output.vertex [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Mesh mesh = {0};
+    struct Triangle *triangles = 0;
+    struct IoReader stl;
+    enum IoResult result = io_open_reader(argv[1], 0, &stl);
+    if (result == IO_RESULT_OK) {
+        result = read_stl(&stl, thread_count, &mesh.triangle_count, &triangles);
+    }
+    io_close_reader(&stl);
+    if (result != IO_RESULT_OK) {
+        fprintf(stderr, "failed to read %s as a binary stl file: %s\n", argv[1], io_result_string(result));
+        return EXIT_FAILURE;
+    }
+
+    printf("%s:\n", get_file_name(argv[2]));
+    build_vertices(&mesh, triangles);
+    build_bounds(&mesh, triangles);
+    free(triangles);
+
+    print_cache_statistics("input", &mesh);
+    optimize_vertex_cache(&mesh);
+    uint32_t cluster_count = optimize_overdraw(&mesh);
+    optimize_vertex_fetch(&mesh);
+    print_cache_statistics("optimized", &mesh);
+    printf("    %u overdraw clusters\n", cluster_count);
+
+    struct BvhNode *bvh_nodes;
+    uint32_t *bvh_primitives;
+    uint32_t bvh_node_count = build_bvh(&mesh, thread_count, &bvh_nodes, &bvh_primitives);
+    uint32_t chunk_count = (mesh.triangle_count + BVH_CHUNK_TRIANGLE_COUNT - 1) / BVH_CHUNK_TRIANGLE_COUNT;
+    printf("    %u bvh nodes over %u chunks\n", bvh_node_count, chunk_count);
+
+    // 16 bit indices when every vertex can be addressed with them
+    uint32_t index_count = 3 * mesh.triangle_count;
+    uint32_t index_size = mesh.vertex_count <= 0x10000 ? 2 : 4;
+    void *index_payload = mesh.indices;
+    if (index_size == 2) {
+        uint16_t *indices = malloc((index_count ? index_count : 1) * sizeof *indices);
+        assert(indices);
+        for (uint32_t i = 0; i < index_count; i++) {
+            indices[i] = mesh.indices[i];
+        }
+        index_payload = indices;
+    }
+
+    struct VertexQuantized *quantized = quantize_vertices(&mesh);
+    struct IoMeshSection sections[] = {
+        { .type = IO_MESH_SECTION_VERTEX_QUANTIZED, .element_size = sizeof *quantized, .size = (uint64_t)mesh.vertex_count * sizeof *quantized },
+        { .type = IO_MESH_SECTION_INDEX, .element_size = index_size, .size = (uint64_t)index_count * index_size },
+        { .type = IO_MESH_SECTION_BOUNDS, .element_size = sizeof mesh.bounds, .size = sizeof mesh.bounds },
+        { .type = IO_MESH_SECTION_BVH_NODE, .element_size = sizeof *bvh_nodes, .size = (uint64_t)bvh_node_count * sizeof *bvh_nodes },
+        { .type = IO_MESH_SECTION_BVH_PRIMITIVE, .element_size = sizeof *bvh_primitives, .size = (uint64_t)chunk_count * sizeof *bvh_primitives },
+    };
+    void const *payloads[] = { quantized, index_payload, &mesh.bounds, bvh_nodes, bvh_primitives };
+
+    FILE *out = fopen(argv[2], "wb");
+    int is_written = out && write_container(out, sizeof sections / sizeof *sections, sections, payloads);
+    if (out && fclose(out) != 0) {
+        is_written = 0;
+    }
+    if (!is_written) {
+        fprintf(stderr, "failed to write %s\n", argv[2]);
+        remove(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    // bytes the gpu fetches to draw the mesh once, before welding and
+    // quantizing and after
+    uint64_t unwelded_size = (uint64_t)index_count * sizeof *mesh.vertices;
+    uint64_t welded_size = sections[0].size + sections[1].size;
+    printf(
+        "    %u -> %u vertices (%.2fx fewer), %u bit indices, %llu -> %llu bytes (%.1f%% saved)\n",
+        index_count,
+        mesh.vertex_count,
+        (double)index_count / (mesh.vertex_count ? mesh.vertex_count : 1),
+        8 * index_size,
+        (unsigned long long)unwelded_size,
+        (unsigned long long)welded_size,
+        100.0 * (1 - (double)welded_size / (unwelded_size ? unwelded_size : 1))
+    );
+
+    free(bvh_primitives);
+    free(bvh_nodes);
+    free(quantized);
+    if (index_payload != mesh.indices) {
+        free(index_payload);
+    }
+    free(mesh.indices);
+    free(mesh.vertices);
+
+    return EXIT_SUCCESS;
+}
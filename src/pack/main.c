@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics/io.h"
+#include "graphics/pack.h"
+
+// flicker-pack merges processed assets into one pack, see graphics/pack.h.
+// Payloads are written in argument order, so assets loaded together should
+// be listed together to be read sequentially.
+
+struct Asset {
+    char const *name;
+    uint32_t name_size;
+    uint32_t name_offset;
+    uint64_t offset;
+    void *data;
+    size_t size;
+};
+
+static uint64_t
+align_up(uint64_t const size)
+{
+    return (size + IO_PACK_ALIGNMENT - 1) & ~(uint64_t)(IO_PACK_ALIGNMENT - 1);
+}
+
+static char const *
+get_file_name(char const *path)
+{
+    char const *name = path;
+    for (char const *c = path; *c; c++) {
+        if (*c == '/' || *c == '\\') {
+            name = c + 1;
+        }
+    }
+
+    return name;
+}
+
+// at least twice the entry count, so probes stay short and always end
+static uint32_t
+get_bucket_count(uint32_t const entry_count)
+{
+    uint32_t bucket_count = 1;
+    while (bucket_count < 2 * entry_count) {
+        bucket_count *= 2;
+    }
+
+    return bucket_count;
+}
+
+// Returns 0 when two assets share a name.
+static int
+build_buckets(
+    uint32_t const asset_count,
+    struct Asset const assets[],
+    char const *names,
+    uint32_t const bucket_count,
+    struct IoPackEntry buckets[])
+{
+    uint32_t mask = bucket_count - 1;
+
+    for (uint32_t i = 0; i < asset_count; i++) {
+        struct Asset const *asset = &assets[i];
+        uint64_t hash = io_hash_pack_name(asset->name, asset->name_size);
+        uint32_t b = hash & mask;
+        for (; buckets[b].name_size; b = (b + 1) & mask) {
+            if (buckets[b].hash == hash
+                && buckets[b].name_size == asset->name_size
+                && !memcmp(names + buckets[b].name_offset, asset->name, asset->name_size)) {
+                return 0;
+            }
+        }
+        buckets[b] = (struct IoPackEntry){
+            .hash = hash,
+            .offset = asset->offset,
+            .size = asset->size,
+            .name_offset = asset->name_offset,
+            .name_size = asset->name_size,
+        };
+    }
+
+    return 1;
+}
+
+static int
+write_padding(FILE *out, uint64_t size)
+{
+    static uint8_t const zeros[IO_PACK_ALIGNMENT];
+    return fwrite(zeros, 1, size, out) == size;
+}
+
+static int
+write_pack(
+    FILE *out,
+    struct IoPackHeader const *header,
+    struct IoPackEntry const buckets[],
+    char const *names,
+    uint32_t const asset_count,
+    struct Asset const assets[])
+{
+    int is_written = fwrite(header, sizeof *header, 1, out) == 1
+        && write_padding(out, header->bucket_offset - sizeof *header)
+        && fwrite(buckets, sizeof *buckets, header->bucket_count, out) == header->bucket_count
+        && fwrite(names, 1, header->name_size, out) == header->name_size;
+    uint64_t position = header->name_offset + header->name_size;
+
+    for (uint32_t i = 0; i < asset_count; i++) {
+        is_written = is_written
+            && write_padding(out, assets[i].offset - position)
+            && fwrite(assets[i].data, 1, assets[i].size, out) == assets[i].size;
+        position = assets[i].offset + assets[i].size;
+    }
+
+    return is_written;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s output.pack input...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t asset_count = argc - 2;
+    struct Asset *assets = calloc(asset_count, sizeof *assets);
+    assert(assets);
+    uint64_t name_size = 0;
+    for (uint32_t i = 0; i < asset_count; i++) {
+        char const *path = argv[i + 2];
+        assets[i].name = get_file_name(path);
+        assets[i].name_size = strlen(assets[i].name);
+        assets[i].name_offset = name_size;
+        name_size += assets[i].name_size;
+        if (!assets[i].name_size || name_size > UINT32_MAX) {
+            fprintf(stderr, "%s has no usable name\n", path);
+            return EXIT_FAILURE;
+        }
+        enum IoResult result = io_read_file(path, &assets[i].size, &assets[i].data);
+        if (result != IO_RESULT_OK) {
+            fprintf(stderr, "failed to read %s: %s\n", path, io_result_string(result));
+            return EXIT_FAILURE;
+        }
+    }
+
+    char *names = malloc(name_size ? name_size : 1);
+    assert(names);
+    for (uint32_t i = 0; i < asset_count; i++) {
+        memcpy(names + assets[i].name_offset, assets[i].name, assets[i].name_size);
+    }
+
+    // the table of contents fills the first pages, the payloads follow
+    struct IoPackHeader header = {
+        .version_major = IO_PACK_VERSION_MAJOR,
+        .version_minor = IO_PACK_VERSION_MINOR,
+        .endian_marker = IO_PACK_ENDIAN_MARKER,
+        .entry_count = asset_count,
+        .bucket_count = get_bucket_count(asset_count),
+        .bucket_offset = sizeof header,
+    };
+    memcpy(header.magic, IO_PACK_MAGIC, sizeof header.magic);
+    header.name_offset = header.bucket_offset + (uint64_t)header.bucket_count * sizeof(struct IoPackEntry);
+    header.name_size = name_size;
+    header.file_size = header.name_offset + header.name_size;
+    uint64_t offset = align_up(header.file_size);
+    for (uint32_t i = 0; i < asset_count; i++) {
+        assets[i].offset = offset;
+        header.file_size = offset + assets[i].size;
+        offset = align_up(header.file_size);
+    }
+
+    struct IoPackEntry *buckets = calloc(header.bucket_count, sizeof *buckets);
+    assert(buckets);
+    if (!build_buckets(asset_count, assets, names, header.bucket_count, buckets)) {
+        fprintf(stderr, "two assets share a name\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fopen(argv[1], "wb");
+    int is_written = out && write_pack(out, &header, buckets, names, asset_count, assets);
+    if (out && fclose(out) != 0) {
+        is_written = 0;
+    }
+    if (!is_written) {
+        fprintf(stderr, "failed to write %s\n", argv[1]);
+        remove(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    printf(
+        "%s: %u assets, %u buckets, %llu bytes\n",
+        get_file_name(argv[1]),
+        asset_count,
+        header.bucket_count,
+        (unsigned long long)header.file_size
+    );
+
+    free(buckets);
+    free(names);
+    for (uint32_t i = 0; i < asset_count; i++) {
+        free(assets[i].data);
+    }
+    free(assets);
+
+    return EXIT_SUCCESS;
+}